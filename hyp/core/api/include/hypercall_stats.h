@@ -0,0 +1,16 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Per-hypercall latency statistics, enabled by HYPERCALL_STATS.
+//
+// These are called by the generated hypercall wrappers, with preemption
+// enabled, on entry to and exit from each hypercall.
+
+// Return the start timestamp of a hypercall.
+ticks_t
+hypercall_stats_start(void);
+
+// Record the latency of a hypercall that started at the given timestamp.
+void
+hypercall_stats_record(index_t hypercall_num, ticks_t start);
@@ -0,0 +1,116 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#if defined(HYPERCALL_STATS)
+
+#include <assert.h>
+#include <hyptypes.h>
+#include <string.h>
+
+#include <hypcall_def.h>
+
+#include <atomic.h>
+#include <compiler.h>
+#include <cpulocal.h>
+#include <platform_security.h>
+#include <platform_timer.h>
+#include <preempt.h>
+#include <util.h>
+
+#include "hypercall_stats.h"
+#include "useraccess.h"
+
+CPULOCAL_DECLARE_STATIC(hypercall_stats_cpu_t,
+			hypercall_stats_cpu)[HYPERCALL_NUM];
+
+ticks_t
+hypercall_stats_start(void)
+{
+	return platform_timer_get_current_ticks();
+}
+
+void
+hypercall_stats_record(index_t hypercall_num, ticks_t start)
+{
+	assert(hypercall_num < HYPERCALL_NUM);
+
+	ticks_t	 now = platform_timer_get_current_ticks();
+	uint64_t ns  = platform_timer_convert_ticks_to_ns(now - start);
+
+	index_t bucket = (ns == 0U) ? 0U : compiler_msb(ns);
+	bucket	       = util_min(bucket, HYPERCALL_STATS_BUCKETS - 1U);
+
+	// The thread may have been migrated if the hypercall blocked, in which
+	// case the latency is recorded on the CPU that completed it. Preemption
+	// must be disabled while the statistics are updated, so the thread
+	// stays on that CPU.
+	preempt_disable();
+
+	hypercall_stats_cpu_t *stats =
+		&CPULOCAL(hypercall_stats_cpu)[hypercall_num];
+
+	// Only this CPU writes its statistics, so no atomic read-modify-write
+	// is needed.
+	atomic_store_relaxed(&stats->calls,
+			     atomic_load_relaxed(&stats->calls) + 1U);
+	atomic_store_relaxed(&stats->total_ns,
+			     atomic_load_relaxed(&stats->total_ns) + ns);
+	if (ns > atomic_load_relaxed(&stats->max_ns)) {
+		atomic_store_relaxed(&stats->max_ns, ns);
+	}
+	atomic_store_relaxed(&stats->buckets[bucket],
+			     atomic_load_relaxed(&stats->buckets[bucket]) + 1U);
+
+	preempt_enable();
+}
+
+error_t
+hypercall_hypercall_stats_query(index_t hypercall_num, user_ptr_t buffer,
+				size_t buf_size)
+{
+	error_t		  err;
+	hypercall_stats_t total;
+
+	if (platform_security_state_debug_disabled()) {
+		err = ERROR_DENIED;
+		goto out;
+	}
+
+	if (hypercall_num >= HYPERCALL_NUM) {
+		err = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	(void)memset_s(&total, sizeof(total), 0, sizeof(total));
+
+	// Sum the statistics of all CPUs. This is not an atomic snapshot; a
+	// concurrent call may be partially counted.
+	for (cpu_index_t cpu = 0U; cpu < PLATFORM_MAX_CORES; cpu++) {
+		hypercall_stats_cpu_t *stats =
+			&CPULOCAL_BY_INDEX(hypercall_stats_cpu,
+					   cpu)[hypercall_num];
+
+		total.calls += atomic_load_relaxed(&stats->calls);
+		total.total_ns += atomic_load_relaxed(&stats->total_ns);
+		total.max_ns = util_max(total.max_ns,
+					atomic_load_relaxed(&stats->max_ns));
+		for (index_t i = 0U; i < HYPERCALL_STATS_BUCKETS; i++) {
+			total.buckets[i] +=
+				atomic_load_relaxed(&stats->buckets[i]);
+		}
+	}
+
+	size_result_t ret = useraccess_copy_to_guest_va(
+		(gvaddr_t)buffer, buf_size, &total, sizeof(total), false);
+	err = ret.e;
+
+out:
+	return err;
+}
+
+#else
+
+extern char unused;
+
+#endif
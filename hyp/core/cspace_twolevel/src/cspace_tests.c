@@ -147,6 +147,13 @@ tests_cspace_start(void)
 		}
 	}
 
+	// Revoked caps must not be found, even if their slots are still in
+	// the lookup cache
+	for (count_t i = num_delete; i < TEST_CAP_COPIES; i++) {
+		err = tests_cspace_cap_lookup(cap[i], rights);
+		assert(err == ERROR_CSPACE_CAP_REVOKED);
+	}
+
 	// Delete the revoked caps
 	for (count_t i = num_delete; i < TEST_CAP_COPIES; i++) {
 		err = cspace_delete_cap(test_cspace, cap[i]);
@@ -13,6 +13,7 @@
 #include <atomic.h>
 #include <bitmap.h>
 #include <compiler.h>
+#include <cpulocal.h>
 #include <cspace.h>
 #include <list.h>
 #include <object.h>
@@ -42,6 +43,14 @@ static_assert(_Alignof(cap_table_t) == CAP_TABLE_ALLOC_SIZE,
 static_assert(sizeof(cspace_t) == CSPACE_ALLOC_SIZE,
 	      "Cspace not sized correctly");
 
+// Generation count of the cap tables of all cspaces. This is incremented
+// whenever a cap table is released, after it is unlinked from its cspace and
+// before it is freed, so a lookup cache entry that was filled with the current
+// generation still refers to a live cap table.
+static _Atomic uint64_t cspace_table_generation;
+
+CPULOCAL_DECLARE_STATIC(cspace_lookup_cache_t, cspace_lookup_cache);
+
 cspace_t *
 cspace_get_self(void)
 {
@@ -247,6 +256,53 @@ cspace_lookup_cap_slot(const cspace_t *cspace, cap_id_t cap_id, cap_t **cap)
 	return err;
 }
 
+// Look up a cap slot using the per-CPU lookup cache, which avoids decoding the
+// cap ID and walking the tables for repeated lookups of the same cap. The
+// caller must be in an RCU critical section, which also disables preemption.
+//
+// Only the slot is cached; the caller must still check the cap data, so
+// deleted or revoked caps and changed rights are always seen.
+static error_t
+cspace_lookup_cap_slot_cached(const cspace_t *cspace, cap_id_t cap_id,
+			      cap_t **cap)
+{
+	error_t err;
+
+	// The generation must be read before the tables; see
+	// cspace_table_released().
+	uint64_t generation = atomic_load_acquire(&cspace_table_generation);
+
+	cspace_lookup_cache_entry_t *entry =
+		&CPULOCAL(cspace_lookup_cache)
+			 .entries[cap_id % CSPACE_LOOKUP_CACHE_ENTRIES];
+
+	if (compiler_expected((entry->cspace == cspace) &&
+			      (entry->cap_id == cap_id) &&
+			      (entry->generation == generation))) {
+		*cap = entry->cap;
+		err  = OK;
+	} else {
+		err = cspace_lookup_cap_slot(cspace, cap_id, cap);
+		if (compiler_expected(err == OK)) {
+			entry->cspace	  = cspace;
+			entry->cap_id	  = cap_id;
+			entry->cap	  = *cap;
+			entry->generation = generation;
+		}
+	}
+
+	return err;
+}
+
+// Invalidate all lookup cache entries. This must be called after a cap table
+// is unlinked from its cspace, and before it is freed.
+static void
+cspace_table_released(void)
+{
+	(void)atomic_fetch_add_explicit(&cspace_table_generation, 1U,
+					memory_order_release);
+}
+
 static error_t
 cspace_allocate_cap_table(cspace_t *cspace, cap_table_t **table,
 			  index_t *upper_index)
@@ -434,6 +490,7 @@ cspace_free_cap_slot(cspace_t *cspace, cap_t *cap)
 						   memory_order_relaxed);
 		bitmap_clear(cspace->available_tables, upper_index);
 		atomic_store_relaxed(&cspace->tables[upper_index], NULL);
+		cspace_table_released();
 		rcu_enqueue(&table->rcu_entry,
 			    RCU_UPDATE_CLASS_CSPACE_RELEASE_LEVEL);
 	}
@@ -454,7 +511,7 @@ cspace_lookup_object(cspace_t *cspace, cap_id_t cap_id, object_type_t type,
 
 	rcu_read_start();
 
-	err = cspace_lookup_cap_slot(cspace, cap_id, &cap);
+	err = cspace_lookup_cap_slot_cached(cspace, cap_id, &cap);
 	if (compiler_unexpected(err != OK)) {
 		ret = object_ptr_result_error(err);
 		goto lookup_object_error;
@@ -503,7 +560,7 @@ cspace_lookup_object_any(cspace_t *cspace, cap_id_t cap_id,
 
 	rcu_read_start();
 
-	err = cspace_lookup_cap_slot(cspace, cap_id, &cap);
+	err = cspace_lookup_cap_slot_cached(cspace, cap_id, &cap);
 	if (compiler_unexpected(err != OK)) {
 		ret = object_ptr_result_error(err);
 		goto lookup_object_error;
@@ -576,6 +633,10 @@ cspace_twolevel_handle_object_activate_cspace(cspace_t *cspace)
 void
 cspace_twolevel_handle_object_cleanup_cspace(cspace_t *cspace)
 {
+	// The cspace may be reallocated at the same address, so any lookup
+	// cache entries for it must be invalidated.
+	cspace_table_released();
+
 	// Ensure all lower levels destroyed
 	for (index_t i = 0U; i < CSPACE_NUM_CAP_TABLES; i++) {
 		cap_table_t *table = atomic_load_relaxed(&cspace->tables[i]);
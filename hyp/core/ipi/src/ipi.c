@@ -60,6 +60,7 @@ static_assert(((size_t)IPI_REASON__MAX + 1U) < REGISTER_BITS,
 #endif
 
 CPULOCAL_DECLARE_STATIC(ipi_pending_t, ipi_pending);
+CPULOCAL_DECLARE_STATIC(ipi_batch_t, ipi_batch);
 
 void
 ipi_others_relaxed(ipi_reason_t ipi)
@@ -122,16 +123,78 @@ ipi_one_and_check_wakeup_needed(ipi_reason_t ipi, cpu_index_t cpu)
 #endif
 }
 
+static void
+ipi_send_platform_ipi(ipi_reason_t ipi, cpu_index_t cpu)
+{
+#if PLATFORM_IPI_LINES > ENUM_IPI_REASON_MAX_VALUE
+	platform_ipi_one(ipi, cpu);
+#else
+	(void)ipi;
+	platform_ipi_one(cpu);
+#endif
+}
+
 void
 ipi_one(ipi_reason_t ipi, cpu_index_t cpu)
 {
 	if (ipi_one_and_check_wakeup_needed(ipi, cpu)) {
+		preempt_disable();
+		ipi_batch_t *batch = &CPULOCAL(ipi_batch);
+		if (batch->depth != 0U) {
+			batch->targets[cpu] |= util_bit(ipi);
+		} else {
+			ipi_send_platform_ipi(ipi, cpu);
+		}
+		preempt_enable();
+	}
+}
+
+void
+ipi_batch_start(void)
+{
+	assert_preempt_disabled();
+
+	CPULOCAL(ipi_batch).depth++;
+}
+
+void
+ipi_batch_finish(void)
+{
+	assert_preempt_disabled();
+
+	ipi_batch_t *batch = &CPULOCAL(ipi_batch);
+
+	assert(batch->depth > 0U);
+	batch->depth--;
+	if (batch->depth != 0U) {
+		goto out;
+	}
+
+	for (cpu_index_t cpu = 0U; cpulocal_index_valid(cpu); cpu++) {
+		register_t reasons = batch->targets[cpu];
+
+		batch->targets[cpu] = 0U;
+
 #if PLATFORM_IPI_LINES > ENUM_IPI_REASON_MAX_VALUE
-		platform_ipi_one(ipi, cpu);
+		// Each reason has its own line, so only duplicates of the same
+		// reason can be coalesced.
+		while (reasons != 0U) {
+			index_t bit = compiler_ctz(reasons);
+			reasons &= ~util_bit(bit);
+			ipi_send_platform_ipi((ipi_reason_t)bit, cpu);
+		}
 #else
-		platform_ipi_one(cpu);
+		// The handler processes every pending reason, so one interrupt
+		// is enough for all of them.
+		if (reasons != 0U) {
+			ipi_send_platform_ipi(
+				(ipi_reason_t)compiler_ctz(reasons), cpu);
+		}
 #endif
 	}
+
+out:
+	return;
 }
 
 void
@@ -8,11 +8,15 @@
 #include <hyprights.h>
 
 #include <atomic.h>
+#include <cpulocal.h>
 #include <cspace.h>
 #include <cspace_lookup.h>
 #include <object.h>
 #include <scheduler.h>
 #include <thread.h>
+#if defined(INTERFACE_VPM)
+#include <vpm.h>
+#endif
 
 error_t
 hypercall_scheduler_yield(scheduler_yield_control_t control, register_t arg1)
@@ -49,6 +53,50 @@ hypercall_scheduler_yield(scheduler_yield_control_t control, register_t arg1)
 		ret = OK;
 		break;
 	}
+	case SCHEDULER_YIELD_HINT_YIELD_TO_VCPU:
+#if defined(INTERFACE_VPM)
+	{
+		// A paravirtualised hint from a guest that is waiting for a
+		// lock held by another of its VCPUs, e.g. one that has been
+		// preempted. Yielding boosts the holder if it is runnable on
+		// this CPU, so it can release the lock sooner.
+		thread_t *current = thread_get_self();
+		if (current->kind != THREAD_KIND_VCPU) {
+			ret = ERROR_DENIED;
+			goto out;
+		}
+
+		thread_ptr_result_t result =
+			vpm_get_sibling_vcpu(current, (index_t)arg1);
+		if (result.e != OK) {
+			ret = result.e;
+			goto out;
+		}
+
+		// Don't yield to a VCPU that is already running, can't run, or
+		// is queued on another CPU, where a directed yield from this
+		// CPU can't run it; the caller should keep spinning in that
+		// case.
+		scheduler_lock(result.r);
+		bool can_boost = (result.r != current) &&
+				 scheduler_is_runnable(result.r) &&
+				 !scheduler_is_running(result.r) &&
+				 (scheduler_get_affinity(result.r) ==
+				  cpulocal_get_index());
+		scheduler_unlock(result.r);
+
+		if (can_boost) {
+			scheduler_yield_to(result.r);
+		}
+
+		object_put_thread(result.r);
+		ret = OK;
+		break;
+	}
+#else
+		ret = ERROR_UNIMPLEMENTED;
+		break;
+#endif
 	case SCHEDULER_YIELD_HINT_YIELD_LOWER:
 	default:
 		ret = ERROR_ARGUMENT_INVALID;
@@ -18,6 +18,10 @@
 #include <list.h>
 #include <object.h>
 #include <panic.h>
+#include <platform_cpu.h>
+#if defined(SCHEDULER_LOAD_BALANCE) && defined(INTERFACE_PSCI)
+#include <platform_psci.h>
+#endif
 #include <preempt.h>
 #include <rcu.h>
 #include <scheduler.h>
@@ -28,6 +32,9 @@
 #if defined(INTERFACE_VCPU)
 #include <vcpu.h>
 #endif
+#if defined(SCHEDULER_LOAD_BALANCE) && defined(INTERFACE_PSCI)
+#include <vpm.h>
+#endif
 
 #include <events/scheduler.h>
 
@@ -141,6 +148,11 @@ add_to_runqueue(scheduler_t *scheduler, thread_t *target, bool at_tail)
 	if (was_empty) {
 		bitmap_set(scheduler->prio_bitmap, i);
 	}
+
+#if defined(SCHEDULER_LOAD_BALANCE)
+	(void)atomic_fetch_add_explicit(&scheduler->balance_nr_queued, 1U,
+					memory_order_relaxed);
+#endif
 }
 
 static void
@@ -160,6 +172,11 @@ remove_from_runqueue(scheduler_t *scheduler, thread_t *target)
 		assert(list_is_empty(list));
 		bitmap_clear(scheduler->prio_bitmap, i);
 	}
+
+#if defined(SCHEDULER_LOAD_BALANCE)
+	(void)atomic_fetch_sub_explicit(&scheduler->balance_nr_queued, 1U,
+					memory_order_relaxed);
+#endif
 }
 
 static thread_t *
@@ -204,6 +221,23 @@ scheduler_fprr_handle_boot_cold_init(void)
 		scheduler_t *scheduler = &CPULOCAL_BY_INDEX(scheduler, i);
 		spinlock_init(&scheduler->lock);
 		timer_init_object(&scheduler->timer, TIMER_ACTION_RESCHEDULE);
+#if defined(SCHEDULER_LOAD_BALANCE)
+		timer_init_object(&scheduler->balance_timer,
+				  TIMER_ACTION_SCHEDULER_BALANCE);
+		timer_set_slack(&scheduler->balance_timer,
+				timer_convert_ns_to_ticks(
+					SCHEDULER_BALANCE_SLACK));
+		atomic_init(&scheduler->balance_nr_queued, 0U);
+		atomic_init(&scheduler->balance_idle, false);
+#if defined(INTERFACE_PSCI)
+		// The cluster topology is only known to platforms that
+		// implement the PSCI module's platform interface.
+		scheduler->balance_cluster =
+			platform_psci_get_cluster_index(i);
+#else
+		scheduler->balance_cluster = 0U;
+#endif
+#endif
 		for (index_t j = 0U; j < SCHEDULER_NUM_PRIORITIES; j++) {
 			list_init(&scheduler->runqueue[j]);
 		}
@@ -234,6 +268,9 @@ scheduler_fprr_handle_object_create_thread(thread_create_t thread_create)
 	spinlock_init(&thread->scheduler_lock);
 	atomic_init(&thread->scheduler_active_affinity, CPU_INDEX_INVALID);
 	thread->scheduler_prev_affinity = CPU_INDEX_INVALID;
+#if defined(SCHEDULER_LOAD_BALANCE)
+	atomic_init(&thread->scheduler_balance_pinned, false);
+#endif
 
 	cpu_index_t cpu		   = thread_create.scheduler_affinity_valid
 					     ? thread_create.scheduler_affinity
@@ -577,11 +614,242 @@ select_yield_target(thread_t *target, bool *can_idle) REQUIRE_PREEMPT_DISABLED
 	return next;
 }
 
+#if defined(SCHEDULER_LOAD_BALANCE)
+static void
+balance_update(scheduler_t *scheduler, thread_t *target, ticks_t curticks)
+	REQUIRE_SPINLOCK(scheduler->lock)
+{
+	assert_spinlock_held(&scheduler->lock);
+
+	bool idle = target == idle_thread();
+
+	atomic_store_relaxed(&scheduler->balance_idle, idle);
+
+	// If other threads are waiting behind the target, arm the push
+	// balancer so idle CPUs can be prompted to take them. Note that the
+	// timer may still be queued on another CPU if this one went offline.
+	if (!idle &&
+	    !bitmap_empty(scheduler->prio_bitmap, SCHEDULER_NUM_PRIORITIES) &&
+	    !timer_is_queued(&scheduler->balance_timer)) {
+		timer_enqueue(&scheduler->balance_timer,
+			      curticks + timer_convert_ns_to_ticks(
+						 SCHEDULER_BALANCE_INTERVAL));
+	}
+}
+
+// Returns true if the balancer should not move the thread to another cluster.
+// This is the case for VCPUs of a VPM group that has asked for its VCPUs to be
+// balanced only within their cluster, e.g. because they share a working set.
+// Explicit affinity changes are not restricted. VPM groups are implemented by
+// the PSCI module.
+static bool
+balance_keep_in_cluster(const thread_t *thread)
+{
+#if defined(INTERFACE_PSCI)
+	return (thread->kind == THREAD_KIND_VCPU) &&
+	       vpm_is_balanced_in_cluster(thread);
+#else
+	(void)thread;
+	return false;
+#endif
+}
+
+static thread_t *
+balance_find_candidate(scheduler_t *victim, bool cross_cluster)
+	REQUIRE_PREEMPT_DISABLED
+{
+	thread_t *candidate = NULL;
+	count_t	  scanned   = 0U;
+
+	spinlock_acquire_nopreempt(&victim->lock);
+
+	// Prefer the highest priority waiting threads, since they are the
+	// ones whose latency is affected most by the victim being busy.
+	BITMAP_FOREACH_SET_BEGIN(i, victim->prio_bitmap,
+				 SCHEDULER_NUM_PRIORITIES)
+		thread_t *thread;
+
+		list_foreach_container (thread, &victim->runqueue[i], thread,
+					scheduler_list_node) {
+			if (scanned == SCHEDULER_BALANCE_SCAN_LIMIT) {
+				break;
+			}
+			scanned++;
+
+			if (!atomic_load_relaxed(
+				    &thread->scheduler_balance_pinned) &&
+			    !atomic_load_relaxed(&thread->scheduler_yielding) &&
+			    (!cross_cluster ||
+			     !balance_keep_in_cluster(thread))) {
+				candidate = thread;
+				break;
+			}
+		}
+
+		if ((candidate != NULL) ||
+		    (scanned == SCHEDULER_BALANCE_SCAN_LIMIT)) {
+			break;
+		}
+	BITMAP_FOREACH_SET_END
+
+	if (candidate != NULL) {
+		// Queued threads hold a reference to themselves until they
+		// exit, so it is safe to take an additional reference here.
+		(void)object_get_thread_additional(candidate);
+	}
+
+	spinlock_release_nopreempt(&victim->lock);
+
+	return candidate;
+}
+
+// Try to steal a queued thread from the busiest other CPU, preferring CPUs in
+// the same cluster. This is called when the local CPU is about to run its idle
+// thread. Returns true if a thread was migrated to this CPU and can be
+// selected immediately.
+//
+// If the affinity change needs a synchronisation (e.g. for a VCPU with a
+// virtual GIC redistributor), the stolen thread stays blocked until an RCU
+// grace period has elapsed, so it can't be selected yet. It is added to this
+// CPU's runqueue when it is unblocked, which triggers a reschedule here.
+static bool
+balance_steal(void) REQUIRE_PREEMPT_DISABLED
+{
+	cpu_index_t cpu	     = cpulocal_get_index();
+	uint32_t    cluster  = CPULOCAL(scheduler).balance_cluster;
+	cpu_index_t victim   = CPU_INDEX_INVALID;
+	count_t	    busiest  = 0U;
+	bool	    stolen   = false;
+	bool	    runnable = false;
+
+	for (cpu_index_t i = 0U; i < PLATFORM_MAX_CORES; i++) {
+		if (i == cpu) {
+			continue;
+		}
+
+		scheduler_t *remote = &CPULOCAL_BY_INDEX(scheduler, i);
+		count_t	     queued =
+			atomic_load_relaxed(&remote->balance_nr_queued);
+		if (queued == 0U) {
+			continue;
+		}
+
+		if (remote->balance_cluster == cluster) {
+			queued += SCHEDULER_BALANCE_CLUSTER_BIAS;
+		}
+		if (queued > busiest) {
+			busiest = queued;
+			victim	= i;
+		}
+	}
+
+	if (!cpulocal_index_valid(victim)) {
+		goto out;
+	}
+
+	// Threads that must stay in their cluster are skipped if the victim is
+	// in a different cluster.
+	scheduler_t *victim_sched  = &CPULOCAL_BY_INDEX(scheduler, victim);
+	bool	     cross_cluster = victim_sched->balance_cluster != cluster;
+
+	thread_t *candidate =
+		balance_find_candidate(victim_sched, cross_cluster);
+	if (candidate == NULL) {
+		goto out;
+	}
+
+	// The candidate may have run, blocked or been moved since it was
+	// selected; only migrate it if it is still waiting on the victim.
+	scheduler_lock_nopreempt(candidate);
+	if (sched_state_get_queued(&candidate->scheduler_state) &&
+	    !sched_state_get_running(&candidate->scheduler_state) &&
+	    (candidate->scheduler_affinity == victim) &&
+	    (candidate->scheduler_pin_count == 0U) &&
+	    can_be_scheduled(candidate)) {
+		stolen = scheduler_set_affinity(candidate, cpu) == OK;
+		// The affinity change blocks the thread until it completes.
+		runnable = stolen && can_be_scheduled(candidate);
+	}
+	scheduler_unlock_nopreempt(candidate);
+
+	if (stolen) {
+		TRACE(INFO, INFO, "scheduler: stole {:#x} from CPU {:d}",
+		      (uintptr_t)candidate, (register_t)victim);
+	}
+
+	object_put_thread(candidate);
+out:
+	return runnable;
+}
+
+bool
+scheduler_fprr_handle_timer_balance(void)
+{
+	assert_preempt_disabled();
+
+	cpu_index_t  cpu       = cpulocal_get_index();
+	scheduler_t *scheduler = &CPULOCAL(scheduler);
+	count_t	     waiting =
+		atomic_load_relaxed(&scheduler->balance_nr_queued);
+
+	// Prompt idle CPUs to run their schedulers, which will steal the
+	// waiting threads. The first pass only considers CPUs in the local
+	// cluster, which share caches with this one. Start after the local
+	// CPU to spread the load.
+	for (index_t pass = 0U; pass < 2U; pass++) {
+		bool same_cluster = pass == 0U;
+
+		for (cpu_index_t n = 1U;
+		     (n < PLATFORM_MAX_CORES) && (waiting > 0U); n++) {
+			cpu_index_t i =
+				(cpu_index_t)((cpu + n) % PLATFORM_MAX_CORES);
+			scheduler_t *remote = &CPULOCAL_BY_INDEX(scheduler, i);
+
+			if ((remote->balance_cluster ==
+			     scheduler->balance_cluster) != same_cluster) {
+				continue;
+			}
+
+			if (platform_cpu_exists(i) &&
+			    atomic_load_relaxed(&remote->balance_idle)) {
+				atomic_store_relaxed(&remote->balance_idle,
+						     false);
+				ipi_one(IPI_REASON_RESCHEDULE, i);
+				waiting--;
+			}
+		}
+	}
+
+	spinlock_acquire_nopreempt(&scheduler->lock);
+	if (!bitmap_empty(scheduler->prio_bitmap, SCHEDULER_NUM_PRIORITIES) &&
+	    !timer_is_queued(&scheduler->balance_timer)) {
+		timer_enqueue(&scheduler->balance_timer,
+			      timer_get_current_timer_ticks() +
+				      timer_convert_ns_to_ticks(
+					      SCHEDULER_BALANCE_INTERVAL));
+	}
+	spinlock_release_nopreempt(&scheduler->lock);
+
+	return true;
+}
+
+void
+scheduler_fprr_handle_power_cpu_offline(void)
+{
+	// Don't prompt an offline CPU to steal threads. The flag is set again
+	// once the CPU comes back online and runs its idle thread.
+	atomic_store_relaxed(&CPULOCAL(scheduler).balance_idle, false);
+}
+#endif
+
 bool
 scheduler_schedule(void)
 {
 	bool must_schedule = true;
 	bool switched	   = false;
+#if defined(SCHEDULER_LOAD_BALANCE)
+	bool tried_steal = false;
+#endif
 
 	preempt_disable();
 
@@ -603,8 +871,29 @@ scheduler_schedule(void)
 		bool can_idle = bitmap_empty(scheduler->prio_bitmap,
 					     SCHEDULER_NUM_PRIORITIES);
 		set_next_timeout(scheduler, target);
+#if defined(SCHEDULER_LOAD_BALANCE)
+		balance_update(scheduler, target, curticks);
+#endif
 		spinlock_release_nopreempt(&scheduler->lock);
 
+#if defined(SCHEDULER_LOAD_BALANCE)
+		// Try to steal a thread at most once per call, so a thread
+		// that can't be selected here (e.g. because it is blocked
+		// again or its affinity changes) doesn't make this CPU steal
+		// repeatedly. A stolen thread that is still completing its
+		// affinity change triggers a reschedule here when it becomes
+		// runnable, so this CPU can idle until then.
+		if (!tried_steal && (target == idle_thread())) {
+			tried_steal = true;
+			if (balance_steal()) {
+				// A runnable thread was migrated to this CPU;
+				// select the next target again to consider it.
+				rcu_read_finish();
+				continue;
+			}
+		}
+#endif
+
 		target = select_yield_target(target, &can_idle);
 
 		trigger_scheduler_selected_thread_event(target, &can_idle);
@@ -1091,6 +1380,9 @@ scheduler_pin(thread_t *thread)
 {
 	assert_spinlock_held(&thread->scheduler_lock);
 	thread->scheduler_pin_count++;
+#if defined(SCHEDULER_LOAD_BALANCE)
+	atomic_store_relaxed(&thread->scheduler_balance_pinned, true);
+#endif
 }
 
 void
@@ -1099,6 +1391,10 @@ scheduler_unpin(thread_t *thread)
 	assert_spinlock_held(&thread->scheduler_lock);
 	assert(thread->scheduler_pin_count > 0U);
 	thread->scheduler_pin_count--;
+#if defined(SCHEDULER_LOAD_BALANCE)
+	atomic_store_relaxed(&thread->scheduler_balance_pinned,
+			     thread->scheduler_pin_count != 0U);
+#endif
 }
 
 cpu_index_t
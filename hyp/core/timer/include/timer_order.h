@@ -0,0 +1,57 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Ordered timer storage for a timer queue.
+//
+// By default timers are kept in a sorted list, which has O(n) insertion. If
+// TIMER_QUEUE_HEAP is configured, a pairing heap is used instead, which has
+// O(1) insertion and amortised O(log n) removal.
+//
+// All of these functions must be called with the queue's lock held.
+
+// Return the latest time a timer may expire, which is its timeout plus its
+// slack.
+static inline ticks_t
+timer_order_latest_expiry(const timer_t *timer)
+{
+	ticks_t max_expiry = TIMER_INVALID_TIMEOUT - 1U;
+	ticks_t expiry;
+
+	if (timer->timeout >= max_expiry) {
+		expiry = timer->timeout;
+	} else if (timer->slack > (max_expiry - timer->timeout)) {
+		expiry = max_expiry;
+	} else {
+		expiry = timer->timeout + timer->slack;
+	}
+
+	return expiry;
+}
+
+// Initialise an empty queue.
+void
+timer_order_init(timer_queue_t *tq);
+
+// Add a timer to the queue, ordered by its timeout. Returns true if the timer
+// is now the queue's earliest timer.
+bool
+timer_order_insert(timer_queue_t *tq, timer_t *timer)
+	REQUIRE_SPINLOCK(tq->lock);
+
+// Remove a timer from the queue.
+void
+timer_order_remove(timer_queue_t *tq, timer_t *timer)
+	REQUIRE_SPINLOCK(tq->lock);
+
+// Return the latest time at which the queue's earliest timer can expire,
+// without any timer that is due by then exceeding its slack. This may only
+// examine a bounded number of timers, and will fall back to the earliest
+// timer's timeout if that is not enough. Returns TIMER_INVALID_TIMEOUT if the
+// queue is empty.
+ticks_t
+timer_order_get_deadline(timer_queue_t *tq) REQUIRE_SPINLOCK(tq->lock);
+
+// Return the queue's earliest timer, or NULL if the queue is empty.
+timer_t *
+timer_order_get_head(timer_queue_t *tq) REQUIRE_SPINLOCK(tq->lock);
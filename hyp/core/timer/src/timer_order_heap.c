@@ -0,0 +1,220 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#if defined(TIMER_QUEUE_HEAP)
+
+#include <assert.h>
+#include <hyptypes.h>
+
+#include <spinlock.h>
+#include <util.h>
+
+#include "timer_order.h"
+
+// Timer queue ordering using a pairing heap.
+//
+// Each timer links to its first child, and its siblings form a doubly linked
+// list in which the first child's prev pointer refers to the parent. The root
+// has no siblings and a NULL prev pointer.
+
+// Merge two heaps, returning the new root. Both roots must have no siblings.
+static timer_t *
+heap_meld(timer_t *a, timer_t *b)
+{
+	timer_t *root  = a;
+	timer_t *child = b;
+
+	assert((a->heap_next == NULL) && (b->heap_next == NULL));
+
+	if (b->timeout < a->timeout) {
+		root  = b;
+		child = a;
+	}
+
+	child->heap_prev = root;
+	child->heap_next = root->heap_child;
+	if (root->heap_child != NULL) {
+		root->heap_child->heap_prev = child;
+	}
+	root->heap_child = child;
+	root->heap_prev	 = NULL;
+
+	return root;
+}
+
+// Merge a list of siblings into a single heap, returning its root.
+//
+// This is the standard two-pass pairing: siblings are melded in pairs from
+// left to right, then the pairs are melded from right to left. The first
+// pass keeps the melded pairs on a stack linked through heap_next.
+static timer_t *
+heap_merge_pairs(timer_t *first)
+{
+	timer_t *pairs = NULL;
+	timer_t *a     = first;
+
+	while (a != NULL) {
+		timer_t *b    = a->heap_next;
+		timer_t *rest = NULL;
+
+		a->heap_next = NULL;
+		if (b != NULL) {
+			rest	     = b->heap_next;
+			b->heap_next = NULL;
+			a	     = heap_meld(a, b);
+		}
+		a->heap_prev = NULL;
+		a->heap_next = pairs;
+		pairs	     = a;
+		a	     = rest;
+	}
+
+	timer_t *root = NULL;
+	while (pairs != NULL) {
+		timer_t *next = pairs->heap_next;
+
+		pairs->heap_next = NULL;
+		if (root == NULL) {
+			root = pairs;
+		} else {
+			root = heap_meld(pairs, root);
+		}
+		pairs = next;
+	}
+
+	return root;
+}
+
+void
+timer_order_init(timer_queue_t *tq)
+{
+	tq->heap = NULL;
+}
+
+bool
+timer_order_insert(timer_queue_t *tq, timer_t *timer)
+{
+	timer->heap_child = NULL;
+	timer->heap_next  = NULL;
+	timer->heap_prev  = NULL;
+
+	// As for the sorted list, a new timer with the same timeout as the
+	// current head does not replace it.
+	tq->heap = (tq->heap == NULL) ? timer : heap_meld(tq->heap, timer);
+
+	return tq->heap == timer;
+}
+
+void
+timer_order_remove(timer_queue_t *tq, timer_t *timer)
+{
+	assert(tq->heap != NULL);
+
+	if (tq->heap == timer) {
+		tq->heap = heap_merge_pairs(timer->heap_child);
+	} else {
+		timer_t *prev = timer->heap_prev;
+
+		assert(prev != NULL);
+
+		// Unlink the timer from its parent or previous sibling.
+		if (prev->heap_child == timer) {
+			prev->heap_child = timer->heap_next;
+		} else {
+			prev->heap_next = timer->heap_next;
+		}
+		if (timer->heap_next != NULL) {
+			timer->heap_next->heap_prev = prev;
+		}
+		timer->heap_next = NULL;
+
+		// Every timer in the removed timer's subtree expires no
+		// earlier than the root, so the root does not change.
+		timer_t *subtree = heap_merge_pairs(timer->heap_child);
+		if (subtree != NULL) {
+			tq->heap = heap_meld(tq->heap, subtree);
+		}
+	}
+
+	timer->heap_child = NULL;
+	timer->heap_next  = NULL;
+	timer->heap_prev  = NULL;
+}
+
+// Find the parent of a timer that is not the root.
+static timer_t *
+heap_get_parent(timer_t *timer)
+{
+	timer_t *first = timer;
+
+	while (first->heap_prev->heap_child != first) {
+		first = first->heap_prev;
+	}
+
+	return first->heap_prev;
+}
+
+ticks_t
+timer_order_get_deadline(timer_queue_t *tq)
+{
+	timer_t *root	  = tq->heap;
+	ticks_t	 deadline = TIMER_INVALID_TIMEOUT;
+	count_t	 count	  = 1U;
+
+	if (root == NULL) {
+		goto out;
+	}
+
+	deadline = timer_order_latest_expiry(root);
+
+	// Walk the heap in preorder. A timer's children are never due before
+	// it, so the subtree of any timer not due by the deadline is skipped.
+	timer_t *timer = root->heap_child;
+	while (timer != NULL) {
+		if (count == TIMER_COALESCE_SCAN_LIMIT) {
+			// Too many timers to examine; don't coalesce.
+			deadline = root->timeout;
+			break;
+		}
+		count++;
+
+		if ((timer->timeout <= deadline) &&
+		    (timer->heap_child != NULL)) {
+			deadline = util_min(deadline,
+					    timer_order_latest_expiry(timer));
+			timer = timer->heap_child;
+		} else {
+			if (timer->timeout <= deadline) {
+				deadline = util_min(
+					deadline,
+					timer_order_latest_expiry(timer));
+			}
+
+			// Move to the next sibling of this timer or of its
+			// nearest ancestor that has one, below the root.
+			while ((timer != NULL) && (timer->heap_next == NULL)) {
+				timer_t *parent = heap_get_parent(timer);
+				timer = (parent != root) ? parent : NULL;
+			}
+			if (timer != NULL) {
+				timer = timer->heap_next;
+			}
+		}
+	}
+
+out:
+	return deadline;
+}
+
+timer_t *
+timer_order_get_head(timer_queue_t *tq)
+{
+	return tq->heap;
+}
+
+#else
+
+extern char unused;
+
+#endif
@@ -0,0 +1,84 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#if !defined(TIMER_QUEUE_HEAP)
+
+#include <assert.h>
+#include <hyptypes.h>
+
+#include <hypcontainers.h>
+
+#include <list.h>
+#include <spinlock.h>
+#include <util.h>
+
+#include "timer_order.h"
+
+static bool
+is_timeout_a_smaller_than_b(list_node_t *node_a, list_node_t *node_b)
+{
+	ticks_t timeout_a = timer_container_of_list_node(node_a)->timeout;
+	ticks_t timeout_b = timer_container_of_list_node(node_b)->timeout;
+
+	return timeout_a < timeout_b;
+}
+
+void
+timer_order_init(timer_queue_t *tq)
+{
+	list_init(&tq->list);
+}
+
+bool
+timer_order_insert(timer_queue_t *tq, timer_t *timer)
+{
+	return list_insert_in_order(&tq->list, &timer->list_node,
+				    is_timeout_a_smaller_than_b);
+}
+
+void
+timer_order_remove(timer_queue_t *tq, timer_t *timer)
+{
+	(void)list_delete_node(&tq->list, &timer->list_node);
+}
+
+ticks_t
+timer_order_get_deadline(timer_queue_t *tq)
+{
+	ticks_t	 deadline = TIMER_INVALID_TIMEOUT;
+	count_t	 count	  = 0U;
+	timer_t *timer;
+
+	// Walk the timers in timeout order until one is not due by the
+	// deadline; all later timers are due after it.
+	list_foreach_container (timer, &tq->list, timer, list_node) {
+		if (timer->timeout > deadline) {
+			break;
+		}
+		if (count == TIMER_COALESCE_SCAN_LIMIT) {
+			// Don't look any further. Every timer due by this
+			// timer's timeout has been examined, so it is safe.
+			deadline = timer->timeout;
+			break;
+		}
+		deadline = util_min(deadline, timer_order_latest_expiry(timer));
+		count++;
+	}
+
+	return deadline;
+}
+
+timer_t *
+timer_order_get_head(timer_queue_t *tq)
+{
+	list_node_t *head = list_get_head(&tq->list);
+
+	return (head != NULL) ? timer_container_of_list_node(head) : NULL;
+}
+
+#else
+
+extern char unused;
+
+#endif
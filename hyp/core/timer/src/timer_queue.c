@@ -5,13 +5,10 @@
 #include <assert.h>
 #include <hyptypes.h>
 
-#include <hypcontainers.h>
-
 #include <atomic.h>
 #include <compiler.h>
 #include <cpulocal.h>
 #include <ipi.h>
-#include <list.h>
 #include <object.h>
 #include <panic.h>
 #include <partition.h>
@@ -25,6 +22,7 @@
 #include <events/timer.h>
 
 #include "event_handlers.h"
+#include "timer_order.h"
 
 CPULOCAL_DECLARE_STATIC(timer_queue_t, timer_queue);
 
@@ -38,9 +36,10 @@ timer_handle_boot_cold_init(cpu_index_t boot_cpu_index)
 	     cpu_index++) {
 		timer_queue_t *tq = &CPULOCAL_BY_INDEX(timer_queue, cpu_index);
 		spinlock_init(&tq->lock);
-		list_init(&tq->list);
-		tq->timeout = TIMER_INVALID_TIMEOUT;
-		tq->online  = (cpu_index == boot_cpu_index);
+		timer_order_init(tq);
+		tq->timeout  = TIMER_INVALID_TIMEOUT;
+		tq->deadline = TIMER_INVALID_TIMEOUT;
+		tq->online   = (cpu_index == boot_cpu_index);
 	}
 }
 
@@ -76,25 +75,26 @@ timer_convert_ticks_to_ns(ticks_t ticks)
 	return platform_timer_convert_ticks_to_ns(ticks);
 }
 
-static bool
-is_timeout_a_smaller_than_b(list_node_t *node_a, list_node_t *node_b)
-{
-	ticks_t timeout_a = timer_container_of_list_node(node_a)->timeout;
-	ticks_t timeout_b = timer_container_of_list_node(node_b)->timeout;
-
-	return timeout_a < timeout_b;
-}
-
 void
 timer_init_object(timer_t *timer, timer_action_t action)
 {
 	assert(timer != NULL);
 
 	timer->timeout = TIMER_INVALID_TIMEOUT;
+	timer->slack   = 0U;
 	timer->action  = action;
 	atomic_init(&timer->queue, NULL);
 }
 
+void
+timer_set_slack(timer_t *timer, ticks_t slack)
+{
+	assert(timer != NULL);
+	assert(!timer_is_queued(timer));
+
+	timer->slack = slack;
+}
+
 bool
 timer_is_queued(timer_t *timer)
 {
@@ -110,7 +110,7 @@ timer_queue_get_next_timeout(void)
 	ticks_t	       timeout;
 
 	spinlock_acquire_nopreempt(&tq->lock);
-	timeout = tq->timeout;
+	timeout = tq->deadline;
 	spinlock_release_nopreempt(&tq->lock);
 
 	return timeout;
@@ -122,13 +122,60 @@ timer_update_timeout(timer_queue_t *tq) REQUIRE_SPINLOCK(tq->lock)
 	assert_preempt_disabled();
 	assert(tq == &CPULOCAL(timer_queue));
 
-	if (tq->timeout != TIMER_INVALID_TIMEOUT) {
-		platform_timer_set_timeout(tq->timeout);
+	if (tq->deadline != TIMER_INVALID_TIMEOUT) {
+		platform_timer_set_timeout(tq->deadline);
 	} else {
 		platform_timer_cancel_timeout();
 	}
 }
 
+// Add a timer to a queue. Returns true if the queue's deadline has changed.
+static bool
+timer_queue_insert(timer_queue_t *tq, timer_t *timer) REQUIRE_SPINLOCK(tq->lock)
+{
+	bool changed = false;
+
+	if (timer_order_insert(tq, timer)) {
+		tq->timeout  = timer->timeout;
+		tq->deadline = timer_order_get_deadline(tq);
+		changed	     = true;
+	} else if (timer->timeout <= tq->deadline) {
+		// The timer will be expired at the current deadline, so the
+		// deadline must not be later than the end of its slack.
+		ticks_t expiry = timer_order_latest_expiry(timer);
+		if (expiry < tq->deadline) {
+			tq->deadline = expiry;
+			changed	     = true;
+		}
+	} else {
+		// The timer will be expired in a later batch.
+	}
+
+	return changed;
+}
+
+// Remove a timer from a queue. Returns true if the queue's deadline may have
+// changed.
+static bool
+timer_queue_remove(timer_queue_t *tq, timer_t *timer)
+	REQUIRE_SPINLOCK(tq->lock)
+{
+	bool was_head = timer_order_get_head(tq) == timer;
+
+	timer_order_remove(tq, timer);
+	if (was_head) {
+		timer_t *head = timer_order_get_head(tq);
+		tq->timeout =
+			(head != NULL) ? head->timeout : TIMER_INVALID_TIMEOUT;
+		tq->deadline = timer_order_get_deadline(tq);
+	} else {
+		// Removing a timer never makes the deadline too late, so it
+		// is left unchanged.
+	}
+
+	return was_head;
+}
+
 static void
 timer_enqueue_internal(timer_queue_t *tq, timer_t *timer, ticks_t timeout)
 	REQUIRE_SPINLOCK(tq->lock)
@@ -153,10 +200,7 @@ timer_enqueue_internal(timer_queue_t *tq, timer_t *timer, ticks_t timeout)
 	// condition is already met.
 	timer->timeout = timeout;
 
-	bool new_head = list_insert_in_order(&tq->list, &timer->list_node,
-					     is_timeout_a_smaller_than_b);
-	if (new_head) {
-		tq->timeout = timeout;
+	if (timer_queue_insert(tq, timer)) {
 		timer_update_timeout(tq);
 	}
 }
@@ -173,18 +217,7 @@ timer_dequeue_internal(timer_queue_t *tq, timer_t *timer)
 	// acquiring its lock. Ensure the timer's queue has not changed before
 	// dequeuing.
 	if (compiler_expected(atomic_load_relaxed(&timer->queue) == tq)) {
-		bool new_head = list_delete_node(&tq->list, &timer->list_node);
-		if (new_head) {
-			list_node_t *head = list_get_head(&tq->list);
-			tq->timeout =
-				timer_container_of_list_node(head)->timeout;
-			new_timeout = true;
-		} else if (list_is_empty(&tq->list)) {
-			tq->timeout = TIMER_INVALID_TIMEOUT;
-			new_timeout = true;
-		} else {
-			// The queue's timeout has not changed.
-		}
+		new_timeout = timer_queue_remove(tq, timer);
 
 		// Clear the timer's queue pointer. We need release ordering to
 		// ensure this dequeue is observed by the next enqueue.
@@ -215,19 +248,11 @@ timer_update_internal(timer_queue_t *tq, timer_t *timer, ticks_t timeout)
 
 		// Delete timer from queue, update it, and add it again to queue
 
-		bool new_head_delete =
-			list_delete_node(&tq->list, &timer->list_node);
-
-		timer->timeout = timeout;
-
-		bool new_head_insert =
-			list_insert_in_order(&tq->list, &timer->list_node,
-					     is_timeout_a_smaller_than_b);
+		bool removed_changed = timer_queue_remove(tq, timer);
+		timer->timeout	     = timeout;
+		bool inserted_changed = timer_queue_insert(tq, timer);
 
-		if (new_head_delete || new_head_insert) {
-			list_node_t *head = list_get_head(&tq->list);
-			tq->timeout =
-				timer_container_of_list_node(head)->timeout;
+		if (removed_changed || inserted_changed) {
 			timer_update_timeout(tq);
 		}
 	}
@@ -305,8 +330,7 @@ timer_dequeue_expired(void) REQUIRE_PREEMPT_DISABLED
 	spinlock_acquire_nopreempt(&tq->lock);
 
 	while (tq->timeout <= current_ticks) {
-		list_node_t *head  = list_get_head(&tq->list);
-		timer_t	    *timer = timer_container_of_list_node(head);
+		timer_t *timer = timer_order_get_head(tq);
 		(void)timer_dequeue_internal(tq, timer);
 		spinlock_release_nopreempt(&tq->lock);
 		(void)trigger_timer_action_event(timer->action, timer);
@@ -386,13 +410,9 @@ timer_try_move_to_cpu(timer_t *timer, cpu_index_t target)
 			panic("Request to move timer that is already queued");
 		}
 
-		// Call IPI if the queue HEAD changed so the target CPU can
+		// Call IPI if the queue deadline changed so the target CPU can
 		// update its local timer
-		bool new_head =
-			list_insert_in_order(&ttq->list, &timer->list_node,
-					     is_timeout_a_smaller_than_b);
-		if (new_head) {
-			ttq->timeout = timer->timeout;
+		if (timer_queue_insert(ttq, timer)) {
 			spinlock_release_nopreempt(&ttq->lock);
 			ipi_one(IPI_REASON_TIMER_QUEUE_SYNC, target);
 		} else {
@@ -425,8 +445,7 @@ timer_handle_power_cpu_offline(void)
 
 	// Move all active timers in this CPU timer queue to an active CPU
 	while (tq->timeout != TIMER_INVALID_TIMEOUT) {
-		list_node_t *head  = list_get_head(&tq->list);
-		timer_t	    *timer = timer_container_of_list_node(head);
+		timer_t *timer = timer_order_get_head(tq);
 
 		// Remove timer from this core.
 		(void)timer_dequeue_internal(tq, timer);
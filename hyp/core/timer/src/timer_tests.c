@@ -31,6 +31,85 @@ CPULOCAL_DECLARE_STATIC(uint8_t, test_num);
 CPULOCAL_DECLARE_STATIC(_Atomic bool, in_progress);
 CPULOCAL_DECLARE_STATIC(ticks_t, expected_timeout);
 
+// Number of timers queued on each CPU by the benchmark.
+#define TIMER_BENCH_COUNT 256U
+
+#if defined(TIMER_QUEUE_HEAP)
+#define TIMER_BENCH_IMPL "heap"
+#else
+#define TIMER_BENCH_IMPL "list"
+#endif
+
+static timer_t timer_bench_timers[PLATFORM_MAX_CORES][TIMER_BENCH_COUNT];
+
+static ticks_t
+timer_bench_random(uint64_t *state)
+{
+	// xorshift64
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+
+	return (ticks_t)x;
+}
+
+static nanoseconds_t
+timer_bench_per_op_ns(ticks_t start)
+{
+	ticks_t ticks = timer_get_current_timer_ticks() - start;
+
+	return timer_convert_ticks_to_ns(ticks) / TIMER_BENCH_COUNT;
+}
+
+// Measure the timer queue under synthetic load: queue many timers with random
+// timeouts on this CPU, re-arm each of them with a new random timeout, then
+// dequeue them all. The timeouts are far enough in the future that none of
+// them expire. Run with and without TIMER_QUEUE_HEAP to compare the queue
+// implementations.
+static void
+tests_timer_benchmark(void)
+{
+	timer_t *timers = timer_bench_timers[cpulocal_get_index()];
+	uint64_t seed	= 0x9e3779b97f4a7c15U + cpulocal_get_index();
+	ticks_t	 base	= timer_get_current_timer_ticks() +
+		       timer_convert_ns_to_ticks(10000000000U);
+	ticks_t	 spread = timer_convert_ns_to_ticks(1000000000U);
+	ticks_t	 start;
+
+	for (index_t i = 0U; i < TIMER_BENCH_COUNT; i++) {
+		timer_init_object(&timers[i], TIMER_ACTION_TEST);
+	}
+
+	start = timer_get_current_timer_ticks();
+	for (index_t i = 0U; i < TIMER_BENCH_COUNT; i++) {
+		timer_enqueue(&timers[i],
+			      base + (timer_bench_random(&seed) % spread));
+	}
+	nanoseconds_t enqueue_ns = timer_bench_per_op_ns(start);
+
+	start = timer_get_current_timer_ticks();
+	for (index_t i = 0U; i < TIMER_BENCH_COUNT; i++) {
+		timer_update(&timers[i],
+			     base + (timer_bench_random(&seed) % spread));
+	}
+	nanoseconds_t update_ns = timer_bench_per_op_ns(start);
+
+	start = timer_get_current_timer_ticks();
+	for (index_t i = 0U; i < TIMER_BENCH_COUNT; i++) {
+		timer_dequeue(&timers[i]);
+	}
+	nanoseconds_t dequeue_ns = timer_bench_per_op_ns(start);
+
+	LOG(DEBUG, INFO,
+	    "Timer benchmark (" TIMER_BENCH_IMPL "): core {:d}, {:d} timers,"
+	    " ns/op enqueue {:d} update {:d} dequeue {:d}",
+	    cpulocal_get_index(), TIMER_BENCH_COUNT, enqueue_ns, update_ns,
+	    dequeue_ns);
+}
+
 bool
 tests_timer(void)
 {
@@ -81,6 +160,8 @@ tests_timer(void)
 
 	// TODO: Add more tests
 
+	tests_timer_benchmark();
+
 	LOG(DEBUG, INFO, "Timer tests successfully finished on core {:d}",
 	    cpulocal_get_index());
 	return false;
@@ -49,6 +49,13 @@ timer_init_object(timer_t *timer)
 	timer->timeout = TIMER_INVALID_TIMEOUT;
 }
 
+void
+timer_set_slack(timer_t *timer, ticks_t slack)
+{
+	(void)timer;
+	(void)slack;
+}
+
 void
 timer_enqueue(timer_t *timer, ticks_t timeout, timer_action_t action)
 {
@@ -37,16 +37,26 @@ addrspace_configure_info_area(addrspace_t *addrspace, memextent_t *info_area_me,
 // of nominated address ranges, ERROR_ARGUMENT_INVALID if the specified range
 // overlaps an existing VMMIO range, or ERROR_UNIMPLEMENTED if there is no way
 // to forward faults to an unprivileged VMM.
+//
+// If coalesce is true, writes to the range are appended to the address space's
+// VMMIO ring, if it has one, rather than being forwarded immediately.
 error_t
-addrspace_add_vmmio_range(addrspace_t *addrspace, vmaddr_t base, size_t size);
+addrspace_add_vmmio_range(addrspace_t *addrspace, vmaddr_t base, size_t size,
+			  bool coalesce);
 
 // Remove an address range from the ranges handled by an unprivileged VMM.
 //
 // The range must match one that was previously added to the address space by
-// calling addrspace_add_vmmio_range().
+// calling addrspace_add_vmmio_range() with the same coalesce argument.
 error_t
 addrspace_remove_vmmio_range(addrspace_t *addrspace, vmaddr_t base,
-			     size_t size);
+			     size_t size, bool coalesce);
+
+// Configure the memextent used for the VMMIO write coalescing ring.
+//
+// The address space must not have been activated yet.
+error_t
+addrspace_configure_vmmio_ring(addrspace_t *addrspace, memextent_t *ring_me);
 
 // Translate a VA to PA in the current guest address space.
 //
@@ -19,5 +19,26 @@ allocator_allocate_object(allocator_t *allocator, size_t size,
 error_t
 allocator_deallocate_object(allocator_t *allocator, void *object, size_t size);
 
+// Add a range of memory, mapped at the given hypervisor address, to the heap.
+// This is normally called by the allocator_add_ram_range handler.
+error_t
+allocator_heap_add_memory(allocator_t *allocator, uintptr_t addr, size_t size);
+
 error_t
 allocator_heap_remove_memory(allocator_t *allocator, void *obj, size_t size);
+
+#if defined(UNIT_TESTS)
+// Temporarily replace the allocator's heap with a single free block, so that
+// tests can force allocation failures. Memory cached outside the heap is
+// returned to the original heap first. The original heap is returned, and
+// must be passed to allocator_test_restore_heap().
+void *
+allocator_test_replace_heap(allocator_t *allocator, void *block, size_t size);
+
+// Restore a heap replaced by allocator_test_replace_heap(). Returns true if
+// the replacement heap is again a single free block of the given size; i.e.
+// everything allocated from it has been freed.
+bool
+allocator_test_restore_heap(allocator_t *allocator, void *saved, void *block,
+			    size_t size);
+#endif
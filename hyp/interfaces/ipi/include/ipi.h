@@ -62,6 +62,19 @@ ipi_others_idle(ipi_reason_t ipi) REQUIRE_PREEMPT_DISABLED;
 void
 ipi_one(ipi_reason_t ipi, cpu_index_t cpu);
 
+// Defer the physical interrupts for IPIs sent by ipi_one() on this CPU until
+// the matching call to ipi_batch_finish(), so that each target CPU is only
+// interrupted once however many IPIs are sent to it. Pending IPI reasons are
+// still set immediately, so a target that handles its IPIs for another reason
+// in the meantime will see them.
+//
+// Calls may be nested; the interrupts are sent by the outermost finish call.
+void
+ipi_batch_start(void) REQUIRE_PREEMPT_DISABLED;
+
+void
+ipi_batch_finish(void) REQUIRE_PREEMPT_DISABLED;
+
 // Send the specified IPI to a single CPU, with low priority.
 //
 // This implies a release barrier.
@@ -40,6 +40,26 @@ bool
 memdb_is_ownership_contiguous(paddr_t start_addr, paddr_t end_addr,
 			      uintptr_t object, memdb_type_t type);
 
+// Initialise a reverse index for an object.
+//
+// If the memdb_get_index event returns this index for an object, the memdb
+// records the ranges owned by the object in the index, so walking them does not
+// need to traverse the whole database. The index is allocated from the given
+// partition. If the index can't be allocated, or any update of it fails, it is
+// discarded, and walks fall back to traversing the database.
+//
+// The object must not own any ranges when this is called.
+void
+memdb_index_init(memdb_index_t *index, partition_t *partition);
+
+// Destroy a reverse index.
+//
+// The object must not own any ranges when this is called. The index may also
+// be zero-initialised, if the object was destroyed before memdb_index_init()
+// was called.
+void
+memdb_index_destroy(memdb_index_t *index);
+
 // Walk through the entire database and add the address ranges that are owned
 // by the object passed as argument.
 error_t
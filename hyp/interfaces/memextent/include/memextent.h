@@ -2,6 +2,11 @@
 //
 // SPDX-License-Identifier: BSD-3-Clause
 
+// Function performing one piece of a preemptible range operation. The offset
+// is relative to the start of the range.
+typedef error_t (*memextent_preempt_fnptr)(size_t offset, size_t size,
+					   void *arg);
+
 // Memory extents.
 //
 // These are ranges of memory that can be mapped, whole, into VM address
@@ -104,6 +109,17 @@ memextent_unmap_all(memextent_t *me);
 error_t
 memextent_zero_range(memextent_t *me, size_t offset, size_t size);
 
+// Queue all owned regions of a memory extent in the given range to be zeroed
+// in the background.
+//
+// The contents of the range are undefined after this call. A subsequent call
+// to memextent_zero_range() is still required before the memory is reused, but
+// completes quickly for any part of the range that has already been zeroed. If
+// background zeroing is not supported, or the range is mapped, it is zeroed
+// synchronously instead.
+error_t
+memextent_zero_range_deferred(memextent_t *me, size_t offset, size_t size);
+
 // Cache clean all owned regions of a memory extent in the given range.
 error_t
 memextent_cache_clean_range(memextent_t *me, size_t offset, size_t size);
@@ -112,6 +128,31 @@ memextent_cache_clean_range(memextent_t *me, size_t offset, size_t size);
 error_t
 memextent_cache_flush_range(memextent_t *me, size_t offset, size_t size);
 
+// Perform a preemptible range operation.
+//
+// Long range operations are split into pieces that are each performed by a
+// separate call to fn, with no locks held and preemption enabled between them.
+// The pieces are split at aligned boundaries of base plus their offset in the
+// range; the base may be a VM address so that large page mappings are not
+// split.
+//
+// After each piece, memextent_preempt_check() is called, and if it returns
+// true, the operation stops with ERROR_RETRY. The size of the completed part
+// of the range is returned in progress, including if fn fails.
+error_t
+memextent_preempt_range(size_t base, size_t size, memextent_preempt_fnptr fn,
+			void *arg, size_t *progress);
+
+// Check whether a preemptible range operation should stop early.
+//
+// This returns true if the calling VCPU has a pending wakeup. The operation
+// should then return ERROR_RETRY to the caller, with the size of the completed
+// part of the range, so the caller can handle the wakeup and resume from that
+// point. Note that the calling VCPU may make progress even if this persistently
+// returns true, because at least one piece is completed before it is checked.
+bool
+memextent_preempt_check(void);
+
 // Update the access rights on an existing mapping.
 //
 // There may still be in-progress EL2 operations using the old access rights.
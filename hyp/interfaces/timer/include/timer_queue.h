@@ -10,6 +10,14 @@
 void
 timer_init_object(timer_t *timer, timer_action_t action);
 
+// Set the amount of time, in ticks, that a timer's expiry may be delayed past
+// its timeout. Expiries of timers with overlapping slack windows are
+// coalesced into a single interrupt. The default slack is zero.
+//
+// The timer must not be queued.
+void
+timer_set_slack(timer_t *timer, ticks_t slack);
+
 // Returns whether this timer already belongs to a queue
 bool
 timer_is_queued(timer_t *timer);
@@ -43,6 +51,6 @@ timer_convert_ns_to_ticks(nanoseconds_t ns);
 nanoseconds_t
 timer_convert_ticks_to_ns(ticks_t ticks);
 
-// Get next timeout from cpu local queue
+// Get next expiry time from cpu local queue, including any coalescing slack
 ticks_t
 timer_queue_get_next_timeout(void) REQUIRE_PREEMPT_DISABLED;
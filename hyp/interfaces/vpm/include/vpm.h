@@ -31,3 +31,13 @@ vpm_unbind_virq(vpm_group_t *vpm_group);
 
 vpm_state_t
 vpm_get_state(vpm_group_t *vpm_group);
+
+// Get an additional reference to the VCPU attached at the given index of the
+// VPM group that the specified VCPU is attached to.
+thread_ptr_result_t
+vpm_get_sibling_vcpu(const thread_t *vcpu, index_t index);
+
+// Returns true if the specified VCPU is attached to a VPM group whose VCPUs
+// must not be moved to another CPU cluster by the scheduler's load balancer.
+bool
+vpm_is_balanced_in_cluster(const thread_t *vcpu);
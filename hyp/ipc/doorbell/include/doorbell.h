@@ -6,6 +6,13 @@
 doorbell_flags_result_t
 doorbell_send(doorbell_t *doorbell, doorbell_flags_t new_flags);
 
+// Sets flags of the doorbells in a list of entries, looking up their caps in
+// the given cspace. This stops at the first entry whose lookup fails. The
+// number of doorbells that were sent is returned in count.
+error_t
+doorbell_send_multi(cspace_t *cspace, const doorbell_send_entry_t *entries,
+		    count_t num_entries, count_t *count);
+
 // Reads and clears the flags of the doorbell. Returns old flags.
 doorbell_flags_result_t
 doorbell_receive(doorbell_t *doorbell, doorbell_flags_t clear_flags);
@@ -29,3 +36,22 @@ doorbell_bind(doorbell_t *doorbell, vic_t *vic, virq_t virq);
 // Unbinds a Doorbell from a virtual interrupt.
 void
 doorbell_unbind(doorbell_t *doorbell);
+
+// Binds a Doorbell to a guest write of the given size to an IPA in an
+// address space. If match is true, only writes of match_value are bound.
+error_t
+doorbell_bind_vmmio(doorbell_t *doorbell, addrspace_t *addrspace, vmaddr_t ipa,
+		    size_t size, doorbell_flags_t new_flags, bool match,
+		    uint64_t match_value);
+
+// Unbinds a Doorbell from its VMMIO address. Returns true if it was bound, in
+// which case it must not be bound again until an RCU grace period has elapsed.
+bool
+doorbell_unbind_vmmio(doorbell_t *doorbell);
+
+// Sends the Doorbell bound to a guest write of the given size and value to an
+// IPA in an address space, if there is one. Returns true if a Doorbell was
+// sent. The caller must be in an RCU read-side critical section.
+bool
+doorbell_vmmio_write(addrspace_t *addrspace, vmaddr_t ipa, size_t size,
+		     uint64_t value);
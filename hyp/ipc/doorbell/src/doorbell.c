@@ -6,8 +6,15 @@
 #include <hyptypes.h>
 
 #include <hypcontainers.h>
+#include <hyprights.h>
 
 #include <atomic.h>
+#include <compiler.h>
+#include <cspace.h>
+#include <cspace_lookup.h>
+#include <ipi.h>
+#include <object.h>
+#include <preempt.h>
 #include <scheduler.h>
 #include <spinlock.h>
 #include <vic.h>
@@ -20,28 +27,97 @@ doorbell_flags_result_t
 doorbell_send(doorbell_t *doorbell, doorbell_flags_t new_flags)
 {
 	doorbell_flags_result_t ret = { 0 };
+	doorbell_flags_t	flags;
+	bool			edge_only;
 
 	assert(doorbell != NULL);
 	ret.e = OK;
 
-	spinlock_acquire(&doorbell->lock);
-
-	ret.r = doorbell->flags;
-
-	doorbell->flags |= new_flags;
+	// The masks are read without the lock, so a concurrent doorbell_mask()
+	// may or may not take effect for this send. A level assertion for a
+	// flag that the concurrent call disables is spurious, and is cancelled
+	// by the virq_check_pending handler. A flag that it enables is checked
+	// again below.
+	doorbell_flags_t enable_mask =
+		atomic_load_acquire(&doorbell->enable_mask);
+	doorbell_flags_t ack_mask = atomic_load_relaxed(&doorbell->ack_mask);
+
+	doorbell_flags_t old_flags = atomic_load_relaxed(&doorbell->flags);
+	do {
+		flags = old_flags | new_flags;
+
+		// Level-triggered assert if there are flags enabled; else
+		// edge-only
+		edge_only = (flags & enable_mask) == 0U;
+
+		// Automatically clear ack_mask flags if there was a level
+		// assertion
+		if (!edge_only) {
+			flags &= ~ack_mask;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(
+		&doorbell->flags, &old_flags, flags, memory_order_release,
+		memory_order_relaxed));
+
+	ret.r = old_flags;
+
+	if (edge_only) {
+		// The fence pairs with the one in doorbell_mask(), so either
+		// this load sees a newly enabled mask, or doorbell_mask() sees
+		// the new flags and asserts the level itself. Without it, the
+		// flags update may not be visible to doorbell_mask() before it
+		// reads the flags, and the level assertion would be lost.
+		atomic_thread_fence(memory_order_seq_cst);
+		enable_mask = atomic_load_relaxed(&doorbell->enable_mask);
+		if ((flags & enable_mask) != 0U) {
+			edge_only = false;
+			ack_mask  = atomic_load_relaxed(&doorbell->ack_mask);
+			(void)atomic_fetch_and_explicit(&doorbell->flags,
+							~ack_mask,
+							memory_order_relaxed);
+		}
+	}
 
-	// Level-triggered assert if there are flags enabled; else edge-only
-	bool edge_only = (doorbell->flags & doorbell->enable_mask) == 0U;
 	(void)virq_assert(&doorbell->source, edge_only);
 
-	// Automatically clear ack_mask flags if there was a level assertion
-	if (!edge_only) {
-		doorbell->flags &= ~doorbell->ack_mask;
+	return ret;
+}
+
+error_t
+doorbell_send_multi(cspace_t *cspace, const doorbell_send_entry_t *entries,
+		    count_t num_entries, count_t *count)
+{
+	error_t err = OK;
+
+	assert(cspace != NULL);
+	assert(entries != NULL);
+	assert(count != NULL);
+
+	*count = 0U;
+
+	// Defer the IPIs for the virq assertions, so each physical CPU that
+	// runs a target VCPU is interrupted at most once.
+	preempt_disable();
+	ipi_batch_start();
+
+	for (index_t i = 0U; i < num_entries; i++) {
+		doorbell_ptr_result_t p = cspace_lookup_doorbell(
+			cspace, entries[i].doorbell, CAP_RIGHTS_DOORBELL_SEND);
+		if (compiler_unexpected(p.e != OK)) {
+			err = p.e;
+			break;
+		}
+
+		(void)doorbell_send(p.r,
+				    (doorbell_flags_t)entries[i].new_flags);
+		object_put_doorbell(p.r);
+		(*count)++;
 	}
 
-	spinlock_release(&doorbell->lock);
+	ipi_batch_finish();
+	preempt_enable();
 
-	return ret;
+	return err;
 }
 
 doorbell_flags_result_t
@@ -57,13 +133,8 @@ doorbell_receive(doorbell_t *doorbell, doorbell_flags_t clear_flags)
 		goto out;
 	}
 
-	spinlock_acquire(&doorbell->lock);
-
-	ret.r = doorbell->flags;
-
-	doorbell->flags &= ~clear_flags;
-
-	spinlock_release(&doorbell->lock);
+	ret.r = atomic_fetch_and_explicit(&doorbell->flags, ~clear_flags,
+					  memory_order_acquire);
 
 out:
 	return ret;
@@ -81,9 +152,9 @@ doorbell_reset(doorbell_t *doorbell)
 	// If there is a pending bound interrupt, it will be de-asserted
 	(void)virq_clear(&doorbell->source);
 
-	doorbell->flags	      = 0U;
-	doorbell->ack_mask    = 0U;
-	doorbell->enable_mask = ~doorbell->ack_mask;
+	atomic_store_relaxed(&doorbell->flags, 0U);
+	atomic_store_relaxed(&doorbell->ack_mask, 0U);
+	atomic_store_release(&doorbell->enable_mask, ~(doorbell_flags_t)0U);
 
 	spinlock_release(&doorbell->lock);
 
@@ -100,11 +171,19 @@ doorbell_mask(doorbell_t *doorbell, doorbell_flags_t new_enable_mask,
 
 	spinlock_acquire(&doorbell->lock);
 
-	bool was_asserted = (doorbell->flags & doorbell->enable_mask) != 0U;
-	bool now_asserted = (doorbell->flags & new_enable_mask) != 0U;
+	// The ack mask is written first, so a sender that sees the new enable
+	// mask also sees the new ack mask.
+	doorbell_flags_t old_enable_mask =
+		atomic_load_relaxed(&doorbell->enable_mask);
+	atomic_store_relaxed(&doorbell->ack_mask, new_ack_mask);
+	atomic_store_release(&doorbell->enable_mask, new_enable_mask);
+
+	// Order the mask update before the flags load; see doorbell_send().
+	atomic_thread_fence(memory_order_seq_cst);
+	doorbell_flags_t flags = atomic_load_acquire(&doorbell->flags);
 
-	doorbell->enable_mask = new_enable_mask;
-	doorbell->ack_mask    = new_ack_mask;
+	bool was_asserted = (flags & old_enable_mask) != 0U;
+	bool now_asserted = (flags & new_enable_mask) != 0U;
 
 	if (was_asserted && !now_asserted) {
 		// Deassert if new mask disables all currently asserted flags
@@ -113,9 +192,11 @@ doorbell_mask(doorbell_t *doorbell, doorbell_flags_t new_enable_mask,
 	} else if (!was_asserted && now_asserted) {
 		// Assert if new mask enables flags that are already set
 		(void)virq_assert(&doorbell->source, false);
-		doorbell->flags &= ~doorbell->ack_mask;
+		(void)atomic_fetch_and_explicit(&doorbell->flags, ~new_ack_mask,
+						memory_order_relaxed);
 	} else if (was_asserted && now_asserted) {
-		doorbell->flags &= ~doorbell->ack_mask;
+		(void)atomic_fetch_and_explicit(&doorbell->flags, ~new_ack_mask,
+						memory_order_relaxed);
 	} else {
 		// Nothing to do.
 	}
@@ -140,7 +221,8 @@ doorbell_handle_virq_check_pending(virq_source_t *source, bool reasserted)
 		// doorbell_send() or doorbell_mask() on another CPU.
 		ret = true;
 	} else {
-		ret = ((doorbell->flags & doorbell->enable_mask) != 0U);
+		ret = ((atomic_load_relaxed(&doorbell->flags) &
+			atomic_load_relaxed(&doorbell->enable_mask)) != 0U);
 	}
 
 	return ret;
@@ -175,13 +257,9 @@ doorbell_handle_object_create_doorbell(doorbell_create_t params)
 
 	spinlock_init(&params.doorbell->lock);
 
-	spinlock_acquire(&params.doorbell->lock);
-
-	params.doorbell->flags	     = 0U;
-	params.doorbell->ack_mask    = 0U;
-	params.doorbell->enable_mask = ~params.doorbell->ack_mask;
-
-	spinlock_release(&params.doorbell->lock);
+	atomic_init(&params.doorbell->flags, 0U);
+	atomic_init(&params.doorbell->ack_mask, 0U);
+	atomic_init(&params.doorbell->enable_mask, ~(doorbell_flags_t)0U);
 
 	return OK;
 }
@@ -196,4 +274,8 @@ doorbell_handle_object_deactivate_doorbell(doorbell_t *doorbell)
 	vic_unbind(&doorbell->source);
 
 	spinlock_release(&doorbell->lock);
+
+	// The doorbell is freed after an RCU grace period, so it is not
+	// necessary to wait for VMMIO handlers to stop using it.
+	(void)doorbell_unbind_vmmio(doorbell);
 }
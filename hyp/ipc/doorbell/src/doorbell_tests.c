@@ -0,0 +1,371 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#if defined(UNIT_TESTS)
+
+#include <assert.h>
+#include <hyptypes.h>
+
+#include <atomic.h>
+#include <cpulocal.h>
+#include <cspace.h>
+#include <log.h>
+#include <object.h>
+#include <panic.h>
+#include <partition.h>
+#include <partition_alloc.h>
+#include <rcu.h>
+#include <spinlock.h>
+#include <timer_queue.h>
+#include <trace.h>
+#include <util.h>
+#include <virq.h>
+
+#include <asm/event.h>
+
+#include "doorbell.h"
+#include "event_handlers.h"
+
+// Number of operations performed on each CPU by each test phase.
+#define DOORBELL_TEST_ITERATIONS 10000U
+
+static_assert(PLATFORM_MAX_CORES <= 64U,
+	      "Doorbell tests need a flag for each CPU");
+
+static doorbell_t     *test_doorbell;
+static _Atomic count_t test_doorbell_sync_count;
+
+static doorbell_t *
+tests_doorbell_create(void)
+{
+	doorbell_create_t params = { NULL };
+
+	doorbell_ptr_result_t ret =
+		partition_allocate_doorbell(partition_get_private(), params);
+	assert(ret.e == OK);
+
+	error_t err = object_activate_doorbell(ret.r);
+	assert(err == OK);
+
+	return ret.r;
+}
+
+void
+tests_doorbell_init(void)
+{
+	test_doorbell = tests_doorbell_create();
+
+	atomic_init(&test_doorbell_sync_count, 0U);
+}
+
+// Wait until all CPUs have reached the given phase.
+static void
+tests_doorbell_sync(count_t phase)
+{
+	(void)atomic_fetch_add_explicit(&test_doorbell_sync_count, 1U,
+					memory_order_release);
+	while (asm_event_load_before_wait(&test_doorbell_sync_count) <
+	       (phase * PLATFORM_MAX_CORES)) {
+		asm_event_wait(&test_doorbell_sync_count);
+	}
+}
+
+// The flags update as it was done before doorbell_send() became lock-free,
+// used as a baseline for the benchmark.
+static doorbell_flags_t
+tests_doorbell_locked_send(doorbell_t *doorbell, doorbell_flags_t new_flags)
+{
+	spinlock_acquire_nopreempt(&doorbell->lock);
+
+	doorbell_flags_t old_flags = atomic_load_relaxed(&doorbell->flags);
+	doorbell_flags_t flags	   = old_flags | new_flags;
+
+	bool edge_only =
+		(flags & atomic_load_relaxed(&doorbell->enable_mask)) == 0U;
+	(void)virq_assert(&doorbell->source, edge_only);
+
+	if (!edge_only) {
+		flags &= ~atomic_load_relaxed(&doorbell->ack_mask);
+	}
+	atomic_store_relaxed(&doorbell->flags, flags);
+
+	spinlock_release_nopreempt(&doorbell->lock);
+
+	return old_flags;
+}
+
+static void
+tests_doorbell_vmmio_write(addrspace_t *addrspace, vmaddr_t ipa, size_t size,
+			   uint64_t value, bool expected)
+{
+	rcu_read_start();
+	bool sent = doorbell_vmmio_write(addrspace, ipa, size, value);
+	rcu_read_finish();
+
+	if (sent != expected) {
+		panic("Doorbell VMMIO write did not match as expected");
+	}
+}
+
+// Check and clear the flags that are set in a doorbell.
+static void
+tests_doorbell_check_flags(doorbell_t *doorbell, doorbell_flags_t expected)
+{
+	doorbell_flags_result_t ret =
+		doorbell_receive(doorbell, ~(doorbell_flags_t)0U);
+	if ((ret.e != OK) || (ret.r != expected)) {
+		panic("Doorbell has the wrong flags");
+	}
+}
+
+static void
+tests_doorbell_vmmio_unbind(doorbell_t *doorbell, bool expected)
+{
+	if (doorbell_unbind_vmmio(doorbell) != expected) {
+		panic("Doorbell VMMIO unbind failed");
+	}
+}
+
+// Bind doorbells to VMMIO addresses, and check that guest writes send only
+// the doorbells whose address, size and value they match.
+static void
+tests_doorbell_vmmio(void)
+{
+	error_t	    err;
+	doorbell_t *db[3];
+
+	addrspace_create_t     as_params = { NULL };
+	addrspace_ptr_result_t as_ret =
+		partition_allocate_addrspace(partition_get_private(),
+					     as_params);
+	assert(as_ret.e == OK);
+	addrspace_t *addrspace = as_ret.r;
+
+	for (index_t i = 0U; i < util_array_size(db); i++) {
+		db[i] = tests_doorbell_create();
+	}
+
+	// Bad sizes, alignments and match values are rejected.
+	err = doorbell_bind_vmmio(db[1], addrspace, 0x1000U, 3U, 2U, false, 0U);
+	assert(err == ERROR_ARGUMENT_SIZE);
+	err = doorbell_bind_vmmio(db[1], addrspace, 0x1002U, 4U, 2U, false, 0U);
+	assert(err == ERROR_ARGUMENT_ALIGNMENT);
+	err = doorbell_bind_vmmio(db[1], addrspace, 0x1000U, 4U, 2U, true,
+				  util_bit(32));
+	assert(err == ERROR_ARGUMENT_INVALID);
+
+	// A doorbell can only have one binding, and an unmatched binding
+	// conflicts with any other binding that overlaps it.
+	err = doorbell_bind_vmmio(db[0], addrspace, 0x1000U, 4U, 1U, false, 0U);
+	assert(err == OK);
+	err = doorbell_bind_vmmio(db[0], addrspace, 0x2000U, 4U, 1U, false, 0U);
+	assert(err == ERROR_BUSY);
+	err = doorbell_bind_vmmio(db[1], addrspace, 0x1000U, 4U, 2U, true, 5U);
+	assert(err == ERROR_BUSY);
+	err = doorbell_bind_vmmio(db[1], addrspace, 0x1000U, 8U, 2U, false, 0U);
+	assert(err == ERROR_BUSY);
+
+	// Only a write of the bound size to the bound address matches.
+	tests_doorbell_vmmio_write(addrspace, 0x1000U, 4U, 0x1234U, true);
+	tests_doorbell_check_flags(db[0], 1U);
+	tests_doorbell_vmmio_write(addrspace, 0x1000U, 2U, 0x1234U, false);
+	tests_doorbell_vmmio_write(addrspace, 0x1004U, 4U, 0x1234U, false);
+	tests_doorbell_check_flags(db[0], 0U);
+
+	tests_doorbell_vmmio_unbind(db[0], true);
+	tests_doorbell_vmmio_unbind(db[0], false);
+	tests_doorbell_vmmio_write(addrspace, 0x1000U, 4U, 0x1234U, false);
+
+	// Matched bindings of the same address send only the doorbell whose
+	// value matches. The value is truncated to the access size.
+	err = doorbell_bind_vmmio(db[1], addrspace, 0x2000U, 4U, 2U, true, 5U);
+	assert(err == OK);
+	err = doorbell_bind_vmmio(db[2], addrspace, 0x2000U, 4U, 4U, true, 6U);
+	assert(err == OK);
+
+	tests_doorbell_vmmio_write(addrspace, 0x2000U, 4U, util_bit(32) | 6U,
+				   true);
+	tests_doorbell_check_flags(db[1], 0U);
+	tests_doorbell_check_flags(db[2], 4U);
+	tests_doorbell_vmmio_write(addrspace, 0x2000U, 4U, 5U, true);
+	tests_doorbell_check_flags(db[1], 2U);
+	tests_doorbell_vmmio_write(addrspace, 0x2000U, 4U, 7U, false);
+
+	tests_doorbell_vmmio_unbind(db[1], true);
+	tests_doorbell_vmmio_unbind(db[2], true);
+	assert(addrspace->doorbell_vmmio_count == 0U);
+
+	for (index_t i = 0U; i < util_array_size(db); i++) {
+		object_put_doorbell(db[i]);
+	}
+	object_put_addrspace(addrspace);
+}
+
+static cspace_t *
+tests_doorbell_create_cspace(void)
+{
+	cspace_create_t	    params = { NULL };
+	cspace_ptr_result_t ret =
+		partition_allocate_cspace(partition_get_private(), params);
+	assert(ret.e == OK);
+
+	spinlock_acquire(&ret.r->header.lock);
+	error_t err = cspace_configure(ret.r, 8U);
+	spinlock_release(&ret.r->header.lock);
+	assert(err == OK);
+
+	err = object_activate_cspace(ret.r);
+	assert(err == OK);
+
+	return ret.r;
+}
+
+static error_t
+tests_doorbell_send_multi_check(cspace_t		    *cspace,
+				const doorbell_send_entry_t *entries,
+				count_t num_entries, count_t expected_count)
+{
+	count_t count = 0U;
+	error_t err   = doorbell_send_multi(cspace, entries, num_entries,
+					    &count);
+	if ((count != expected_count) ||
+	    ((err == OK) != (count == num_entries))) {
+		panic("Doorbell send multi did not stop at the failed entry");
+	}
+
+	return err;
+}
+
+// Send multiple doorbells where a lookup fails part way through. The entries
+// before the failure must be sent, and counted, and the later ones must not.
+static void
+tests_doorbell_send_multi(void)
+{
+	doorbell_t *db[3];
+	cap_id_t    caps[3];
+
+	cspace_t *cspace = tests_doorbell_create_cspace();
+
+	for (index_t i = 0U; i < util_array_size(db); i++) {
+		db[i] = tests_doorbell_create();
+
+		object_ptr_t	obj = { .doorbell = db[i] };
+		cap_id_result_t ret = cspace_create_master_cap(
+			cspace, obj, OBJECT_TYPE_DOORBELL);
+		assert(ret.e == OK);
+		caps[i] = ret.r;
+	}
+
+	// A copy of the second cap without the send right.
+	cap_id_result_t recv_cap = cspace_copy_cap(
+		cspace, cspace, caps[1],
+		cap_rights_doorbell_raw(CAP_RIGHTS_DOORBELL_RECEIVE));
+	assert(recv_cap.e == OK);
+
+	doorbell_send_entry_t entries[] = {
+		{ .doorbell = caps[0], .new_flags = 1U },
+		{ .doorbell = caps[1], .new_flags = 2U },
+		{ .doorbell = recv_cap.r, .new_flags = 2U },
+		{ .doorbell = caps[2], .new_flags = 4U },
+	};
+
+	error_t err = tests_doorbell_send_multi_check(
+		cspace, entries, util_array_size(entries), 2U);
+	assert(err == ERROR_CSPACE_INSUFFICIENT_RIGHTS);
+	tests_doorbell_check_flags(db[0], 1U);
+	tests_doorbell_check_flags(db[1], 2U);
+	tests_doorbell_check_flags(db[2], 0U);
+
+	entries[0].doorbell = caps[2];
+	entries[1].doorbell = CSPACE_CAP_INVALID;
+	(void)tests_doorbell_send_multi_check(cspace, entries, 2U, 1U);
+	tests_doorbell_check_flags(db[2], 4U);
+
+	entries[2].doorbell = caps[0];
+	(void)tests_doorbell_send_multi_check(cspace, &entries[2], 2U, 2U);
+	tests_doorbell_check_flags(db[0], 2U);
+	tests_doorbell_check_flags(db[2], 4U);
+
+	err = cspace_delete_cap(cspace, recv_cap.r);
+	assert(err == OK);
+	for (index_t i = 0U; i < util_array_size(db); i++) {
+		err = cspace_delete_cap(cspace, caps[i]);
+		assert(err == OK);
+		object_put_doorbell(db[i]);
+	}
+	object_put_cspace(cspace);
+}
+
+static nanoseconds_t
+tests_doorbell_per_op_ns(ticks_t start)
+{
+	ticks_t ticks = timer_get_current_timer_ticks() - start;
+
+	return timer_convert_ticks_to_ns(ticks) / DOORBELL_TEST_ITERATIONS;
+}
+
+bool
+tests_doorbell_start(void)
+{
+	doorbell_flags_t flag = util_bit(cpulocal_get_index());
+	ticks_t		 start;
+
+	if (cpulocal_get_index() == 0U) {
+		tests_doorbell_vmmio();
+		tests_doorbell_send_multi();
+	}
+
+	// Every CPU sets and clears its own flag in the shared doorbell. The
+	// concurrent updates by other CPUs must never affect it.
+	tests_doorbell_sync(1U);
+
+	for (index_t i = 0U; i < DOORBELL_TEST_ITERATIONS; i++) {
+		doorbell_flags_result_t ret;
+
+		ret = doorbell_send(test_doorbell, flag);
+		assert((ret.e == OK) && ((ret.r & flag) == 0U));
+
+		ret = doorbell_receive(test_doorbell, flag);
+		assert((ret.e == OK) && ((ret.r & flag) != 0U));
+	}
+
+	tests_doorbell_sync(2U);
+	assert(atomic_load_relaxed(&test_doorbell->flags) == 0U);
+
+	// Compare the throughput of many CPUs signalling one doorbell, with
+	// and without the lock.
+	tests_doorbell_sync(3U);
+
+	start = timer_get_current_timer_ticks();
+	for (index_t i = 0U; i < DOORBELL_TEST_ITERATIONS; i++) {
+		(void)tests_doorbell_locked_send(test_doorbell, flag);
+	}
+	nanoseconds_t locked_ns = tests_doorbell_per_op_ns(start);
+
+	tests_doorbell_sync(4U);
+
+	start = timer_get_current_timer_ticks();
+	for (index_t i = 0U; i < DOORBELL_TEST_ITERATIONS; i++) {
+		(void)doorbell_send(test_doorbell, flag);
+	}
+	nanoseconds_t lockfree_ns = tests_doorbell_per_op_ns(start);
+
+	LOG(DEBUG, INFO,
+	    "Doorbell benchmark: core {:d}, {:d} CPUs, send ns/op locked {:d}"
+	    " lock-free {:d}",
+	    cpulocal_get_index(), PLATFORM_MAX_CORES, locked_ns, lockfree_ns);
+
+	tests_doorbell_sync(5U);
+
+	if (cpulocal_get_index() == 0U) {
+		object_put_doorbell(test_doorbell);
+	}
+
+	return false;
+}
+#else
+
+extern char unused;
+
+#endif
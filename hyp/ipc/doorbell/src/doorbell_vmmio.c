@@ -0,0 +1,236 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <assert.h>
+#include <hyptypes.h>
+
+#include <hypcontainers.h>
+
+#include <list.h>
+#include <object.h>
+#include <rcu.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <util.h>
+
+#include "doorbell.h"
+#include "event_handlers.h"
+
+// Doorbell VMMIO bindings.
+//
+// A doorbell may be bound to a naturally aligned IPA in an address space, with
+// an optional value match. A matching guest write that is not handled by a
+// virtual device is completed in the hypervisor by sending the doorbell, so
+// the VCPU does not need to exit to its proxy scheduler. Accesses that do not
+// match a binding fall through to the VMMIO range handler, if any.
+//
+// Each address space keeps its bindings in a list that is read under RCU. A
+// binding's fields are constant while it is in the list.
+
+error_t
+doorbell_handle_object_create_addrspace(addrspace_create_t params)
+{
+	addrspace_t *addrspace = params.addrspace;
+	assert(addrspace != NULL);
+
+	spinlock_init(&addrspace->doorbell_vmmio_lock);
+	list_init(&addrspace->doorbell_vmmio_list);
+	addrspace->doorbell_vmmio_count = 0U;
+
+	return OK;
+}
+
+static uint64_t
+doorbell_vmmio_value_mask(size_t size)
+{
+	return (size < sizeof(uint64_t)) ? util_mask(size * 8U) : UINT64_MAX;
+}
+
+// Two bindings may only overlap if they are for the same address and size,
+// and match different values.
+static bool
+doorbell_vmmio_conflicts(const doorbell_t *other, vmaddr_t ipa, size_t size,
+			 bool match, uint64_t match_value)
+{
+	bool ret;
+
+	if ((ipa >= (other->vmmio_ipa + other->vmmio_size)) ||
+	    (other->vmmio_ipa >= (ipa + size))) {
+		ret = false;
+	} else if ((ipa == other->vmmio_ipa) && (size == other->vmmio_size) &&
+		   match && other->vmmio_match) {
+		ret = match_value == other->vmmio_value;
+	} else {
+		ret = true;
+	}
+
+	return ret;
+}
+
+static bool
+doorbell_vmmio_find_conflict(addrspace_t *addrspace, vmaddr_t ipa, size_t size,
+			     bool match, uint64_t match_value)
+	REQUIRE_SPINLOCK(addrspace->doorbell_vmmio_lock)
+{
+	bool	    ret = false;
+	doorbell_t *other;
+
+	list_foreach_container (other, &addrspace->doorbell_vmmio_list,
+				doorbell, vmmio_node) {
+		if (doorbell_vmmio_conflicts(other, ipa, size, match,
+					     match_value)) {
+			ret = true;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+error_t
+doorbell_bind_vmmio(doorbell_t *doorbell, addrspace_t *addrspace, vmaddr_t ipa,
+		    size_t size, doorbell_flags_t new_flags, bool match,
+		    uint64_t match_value)
+{
+	error_t err = OK;
+
+	assert(doorbell != NULL);
+	assert(addrspace != NULL);
+
+	if ((size > sizeof(uint64_t)) || !util_is_p2(size)) {
+		err = ERROR_ARGUMENT_SIZE;
+		goto out;
+	}
+
+	if (!util_is_baligned(ipa, size)) {
+		err = ERROR_ARGUMENT_ALIGNMENT;
+		goto out;
+	}
+
+	if (util_add_overflows(ipa, size)) {
+		err = ERROR_ADDR_OVERFLOW;
+		goto out;
+	}
+
+	if (match &&
+	    ((match_value & ~doorbell_vmmio_value_mask(size)) != 0U)) {
+		err = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	spinlock_acquire(&doorbell->lock);
+
+	if (doorbell->vmmio_addrspace != NULL) {
+		err = ERROR_BUSY;
+		goto out_locked;
+	}
+
+	spinlock_acquire_nopreempt(&addrspace->doorbell_vmmio_lock);
+
+	if (addrspace->doorbell_vmmio_count == DOORBELL_MAX_VMMIO_BINDINGS) {
+		err = ERROR_NORESOURCES;
+		goto out_addrspace_locked;
+	}
+
+	if (doorbell_vmmio_find_conflict(addrspace, ipa, size, match,
+					 match_value)) {
+		err = ERROR_BUSY;
+		goto out_addrspace_locked;
+	}
+
+	doorbell->vmmio_addrspace = object_get_addrspace_additional(addrspace);
+	doorbell->vmmio_ipa	  = ipa;
+	doorbell->vmmio_size	  = size;
+	doorbell->vmmio_match	  = match;
+	doorbell->vmmio_value	  = match_value;
+	doorbell->vmmio_flags	  = new_flags;
+
+	list_insert_at_tail_release(&addrspace->doorbell_vmmio_list,
+				    &doorbell->vmmio_node);
+	addrspace->doorbell_vmmio_count++;
+
+out_addrspace_locked:
+	spinlock_release_nopreempt(&addrspace->doorbell_vmmio_lock);
+out_locked:
+	spinlock_release(&doorbell->lock);
+out:
+	return err;
+}
+
+bool
+doorbell_unbind_vmmio(doorbell_t *doorbell)
+{
+	assert(doorbell != NULL);
+
+	spinlock_acquire(&doorbell->lock);
+
+	addrspace_t *addrspace = doorbell->vmmio_addrspace;
+	if (addrspace != NULL) {
+		spinlock_acquire_nopreempt(&addrspace->doorbell_vmmio_lock);
+		(void)list_delete_node(&addrspace->doorbell_vmmio_list,
+				       &doorbell->vmmio_node);
+		assert(addrspace->doorbell_vmmio_count > 0U);
+		addrspace->doorbell_vmmio_count--;
+		spinlock_release_nopreempt(&addrspace->doorbell_vmmio_lock);
+
+		doorbell->vmmio_addrspace = NULL;
+	}
+
+	spinlock_release(&doorbell->lock);
+
+	if (addrspace != NULL) {
+		object_put_addrspace(addrspace);
+	}
+
+	return addrspace != NULL;
+}
+
+bool
+doorbell_vmmio_write(addrspace_t *addrspace, vmaddr_t ipa, size_t size,
+		     uint64_t value)
+{
+	bool	    ret	    = false;
+	uint64_t    written = value & doorbell_vmmio_value_mask(size);
+	doorbell_t *doorbell;
+
+	assert(addrspace != NULL);
+
+	list_foreach_container_consume (doorbell,
+					&addrspace->doorbell_vmmio_list,
+					doorbell, vmmio_node) {
+		if ((doorbell->vmmio_ipa == ipa) &&
+		    (doorbell->vmmio_size == size) &&
+		    (!doorbell->vmmio_match ||
+		     (doorbell->vmmio_value == written))) {
+			(void)doorbell_send(doorbell, doorbell->vmmio_flags);
+			ret = true;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+#if defined(INTERFACE_VDEVICE)
+vcpu_trap_result_t
+doorbell_handle_vdevice_access_fixed_addr(vmaddr_t ipa, size_t access_size,
+					  register_t *value, bool is_write)
+{
+	vcpu_trap_result_t ret	     = VCPU_TRAP_RESULT_UNHANDLED;
+	addrspace_t	  *addrspace = thread_get_self()->addrspace;
+
+	assert(addrspace != NULL);
+
+	if (is_write) {
+		rcu_read_start();
+		if (doorbell_vmmio_write(addrspace, ipa, access_size,
+					 (uint64_t)*value)) {
+			ret = VCPU_TRAP_RESULT_EMULATED;
+		}
+		rcu_read_finish();
+	}
+
+	return ret;
+}
+#endif
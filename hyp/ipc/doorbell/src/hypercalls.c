@@ -8,13 +8,16 @@
 #include <hypcall_def.h>
 #include <hyprights.h>
 
+#include <atomic.h>
 #include <compiler.h>
 #include <cspace.h>
 #include <cspace_lookup.h>
 #include <object.h>
+#include <rcu.h>
 #include <thread.h>
 
 #include "doorbell.h"
+#include "useraccess.h"
 
 error_t
 hypercall_doorbell_bind_virq(cap_id_t doorbell_cap, cap_id_t vic_cap,
@@ -97,6 +100,37 @@ out:
 	return ret;
 }
 
+// The entries are copied to the EL2 stack, so the batch is limited to the
+// same size as the other IPC batch hypercalls.
+static_assert(sizeof(doorbell_send_entry_t[DOORBELL_MAX_SEND_MULTI]) <= 256U,
+	      "Doorbell send multi batch is too large for the stack");
+
+hypercall_doorbell_send_multi_result_t
+hypercall_doorbell_send_multi(user_ptr_t entries, count_t num_entries)
+{
+	hypercall_doorbell_send_multi_result_t ret    = { 0 };
+	cspace_t			      *cspace = cspace_get_self();
+	doorbell_send_entry_t		       batch[DOORBELL_MAX_SEND_MULTI];
+
+	if ((num_entries == 0U) || (num_entries > DOORBELL_MAX_SEND_MULTI)) {
+		ret.error = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	size_t	      batch_size = num_entries * sizeof(batch[0]);
+	size_result_t copy_ret	 = useraccess_copy_from_guest_va(
+		  batch, sizeof(batch), (gvaddr_t)entries, batch_size);
+	if (copy_ret.e != OK) {
+		ret.error = copy_ret.e;
+		goto out;
+	}
+
+	ret.error = doorbell_send_multi(cspace, batch, num_entries, &ret.count);
+
+out:
+	return ret;
+}
+
 hypercall_doorbell_receive_result_t
 hypercall_doorbell_receive(cap_id_t doorbell_cap, uint64_t clear_flags)
 {
@@ -168,3 +202,76 @@ hypercall_doorbell_mask(cap_id_t doorbell_cap, uint64_t enable_mask,
 out:
 	return err;
 }
+
+error_t
+hypercall_doorbell_bind_vmmio(cap_id_t doorbell_cap, cap_id_t addrspace_cap,
+			      vmaddr_t ipa, size_t size, uint64_t new_flags,
+			      doorbell_vmmio_options_t options,
+			      uint64_t match_value)
+{
+	error_t	  err;
+	cspace_t *cspace = cspace_get_self();
+
+	if (doorbell_vmmio_options_get_res_0(&options) != 0U) {
+		err = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	doorbell_ptr_result_t p = cspace_lookup_doorbell(
+		cspace, doorbell_cap, CAP_RIGHTS_DOORBELL_SEND);
+	if (compiler_unexpected(p.e != OK)) {
+		err = p.e;
+		goto out;
+	}
+	doorbell_t *doorbell = p.r;
+
+	addrspace_ptr_result_t a = cspace_lookup_addrspace_any(
+		cspace, addrspace_cap, CAP_RIGHTS_ADDRSPACE_ADD_VMMIO_RANGE);
+	if (compiler_unexpected(a.e != OK)) {
+		err = a.e;
+		goto out_doorbell_release;
+	}
+	addrspace_t *addrspace = a.r;
+
+	object_state_t state = atomic_load_relaxed(&addrspace->header.state);
+	if ((state != OBJECT_STATE_INIT) && (state != OBJECT_STATE_ACTIVE)) {
+		err = ERROR_OBJECT_STATE;
+		goto out_addrspace_release;
+	}
+
+	err = doorbell_bind_vmmio(
+		doorbell, addrspace, ipa, size, (doorbell_flags_t)new_flags,
+		doorbell_vmmio_options_get_match_value(&options), match_value);
+
+out_addrspace_release:
+	object_put_addrspace(addrspace);
+out_doorbell_release:
+	object_put_doorbell(doorbell);
+out:
+	return err;
+}
+
+error_t
+hypercall_doorbell_unbind_vmmio(cap_id_t doorbell_cap)
+{
+	error_t	  err	 = OK;
+	cspace_t *cspace = cspace_get_self();
+
+	doorbell_ptr_result_t p = cspace_lookup_doorbell(
+		cspace, doorbell_cap, CAP_RIGHTS_DOORBELL_SEND);
+	if (compiler_unexpected(p.e != OK)) {
+		err = p.e;
+		goto out;
+	}
+	doorbell_t *doorbell = p.r;
+
+	if (doorbell_unbind_vmmio(doorbell)) {
+		// Wait for any VMMIO handlers that might still be using the
+		// binding, so it can safely be bound again.
+		rcu_sync();
+	}
+
+	object_put_doorbell(doorbell);
+out:
+	return err;
+}
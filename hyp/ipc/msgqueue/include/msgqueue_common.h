@@ -4,10 +4,20 @@
 
 // Configure the message queue.
 // The object's header lock must be held and object state must be
-// OBJECT_STATE_INIT.
+// OBJECT_STATE_INIT. If spsc is true, the queue is used in single-producer
+// single-consumer mode, where send and receive do not share a lock, and the
+// queue depth must be a power of two. If shared is true, the queue is used in
+// shared memory mode, which implies spsc, and a memextent must be configured
+// with msgqueue_configure_shm().
 error_t
 msgqueue_configure(msgqueue_t *msgqueue, size_t max_msg_size,
-		   count_t queue_depth);
+		   count_t queue_depth, bool spsc, bool shared);
+
+// Configure the memextent holding a shared memory message queue.
+// The object's header lock must be held and object state must be
+// OBJECT_STATE_INIT.
+error_t
+msgqueue_configure_shm(msgqueue_t *msgqueue, memextent_t *memextent);
 
 // Send a message to a message queue
 // The argument from_kernel, if true, indicates that the message is in a kernel
@@ -23,9 +33,59 @@ receive_info_result_t
 msgqueue_receive_msg(msgqueue_t *msgqueue, kernel_or_gvaddr_t buffer,
 		     size_t max_size, bool to_kernel);
 
+// Send a batch of messages, stopping at the first message that cannot be
+// sent. The receiver virq is asserted at most once. An error is returned if
+// the batch stopped for any reason other than the queue being full after at
+// least one message was sent.
+// The argument from_kernel, if true, indicates that the entries point to
+// kernel buffers.
+msgqueue_batch_info_result_t
+msgqueue_send_batch(msgqueue_t *msgqueue, const msgqueue_batch_entry_t *entries,
+		    count_t num_entries, bool push, bool from_kernel);
+
+// Receive a batch of messages, stopping at the first message that cannot be
+// received, and updating the entries with the received message sizes. The
+// sender virq is asserted at most once. An error is returned if the batch
+// stopped for any reason other than the queue being empty after at least one
+// message was received.
+// The argument to_kernel, if true, indicates that the entries point to kernel
+// buffers.
+msgqueue_batch_info_result_t
+msgqueue_receive_batch(msgqueue_t *msgqueue, msgqueue_batch_entry_t *entries,
+		       count_t num_entries, bool to_kernel);
+
 void
 msgqueue_flush_queue(msgqueue_t *msgqueue);
 
+// Return the number of messages in the queue.
+count_t
+msgqueue_get_count(const msgqueue_t *msgqueue);
+
+// SPSC mode variants of the functions above.
+bool_result_t
+msgqueue_spsc_send_msg(msgqueue_t *msgqueue, size_t size,
+		       kernel_or_gvaddr_t msg, bool push, bool from_kernel);
+
+receive_info_result_t
+msgqueue_spsc_receive_msg(msgqueue_t *msgqueue, kernel_or_gvaddr_t buffer,
+			  size_t max_size, bool to_kernel);
+
+msgqueue_batch_info_result_t
+msgqueue_spsc_send_batch(msgqueue_t		    *msgqueue,
+			 const msgqueue_batch_entry_t *entries,
+			 count_t num_entries, bool push, bool from_kernel);
+
+msgqueue_batch_info_result_t
+msgqueue_spsc_receive_batch(msgqueue_t		   *msgqueue,
+			    msgqueue_batch_entry_t *entries,
+			    count_t num_entries, bool to_kernel);
+
+void
+msgqueue_spsc_flush(msgqueue_t *msgqueue);
+
+count_t
+msgqueue_spsc_get_count(const msgqueue_t *msgqueue);
+
 error_t
 msgqueue_bind(msgqueue_t *msgqueue, vic_t *vic, virq_t virq,
 	      virq_source_t *source, virq_trigger_t trigger);
@@ -18,6 +18,7 @@
 
 #include "msgqueue.h"
 #include "msgqueue_common.h"
+#include "useraccess.h"
 
 error_t
 hypercall_msgqueue_bind_send_virq(cap_id_t msgqueue_cap, cap_id_t vic_cap,
@@ -179,6 +180,111 @@ out:
 	return ret;
 }
 
+hypercall_msgqueue_send_batch_result_t
+hypercall_msgqueue_send_batch(cap_id_t msgqueue_cap, user_ptr_t entries,
+			      count_t num_entries,
+			      msgqueue_send_flags_t send_flags)
+{
+	hypercall_msgqueue_send_batch_result_t ret    = { 0 };
+	cspace_t			      *cspace = cspace_get_self();
+	msgqueue_batch_entry_t		       batch[MSGQUEUE_MAX_BATCH];
+
+	if ((num_entries == 0U) || (num_entries > MSGQUEUE_MAX_BATCH)) {
+		ret.error = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	msgqueue_ptr_result_t p = cspace_lookup_msgqueue(
+		cspace, msgqueue_cap, CAP_RIGHTS_MSGQUEUE_SEND);
+	if (compiler_unexpected(p.e != OK)) {
+		ret.error = p.e;
+		goto out;
+	}
+	msgqueue_t *msgqueue = p.r;
+
+	size_t	      batch_size = num_entries * sizeof(batch[0]);
+	size_result_t copy_ret	 = useraccess_copy_from_guest_va(
+		  batch, sizeof(batch), (gvaddr_t)entries, batch_size);
+	if (copy_ret.e != OK) {
+		ret.error = copy_ret.e;
+		goto out_msgqueue_release;
+	}
+
+	bool push = msgqueue_send_flags_get_push(&send_flags);
+
+	msgqueue_batch_info_result_t res =
+		msgqueue_send_batch(msgqueue, batch, num_entries, push, false);
+
+	ret.error    = res.e;
+	ret.count    = res.r.count;
+	ret.not_full = res.r.more;
+
+out_msgqueue_release:
+	object_put_msgqueue(msgqueue);
+out:
+	return ret;
+}
+
+hypercall_msgqueue_receive_batch_result_t
+hypercall_msgqueue_receive_batch(cap_id_t msgqueue_cap, user_ptr_t entries,
+				 count_t num_entries)
+{
+	hypercall_msgqueue_receive_batch_result_t ret	 = { 0 };
+	cspace_t				 *cspace = cspace_get_self();
+	msgqueue_batch_entry_t			  batch[MSGQUEUE_MAX_BATCH];
+
+	if ((num_entries == 0U) || (num_entries > MSGQUEUE_MAX_BATCH)) {
+		ret.error = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	msgqueue_ptr_result_t p = cspace_lookup_msgqueue(
+		cspace, msgqueue_cap, CAP_RIGHTS_MSGQUEUE_RECEIVE);
+	if (compiler_unexpected(p.e != OK)) {
+		ret.error = p.e;
+		goto out;
+	}
+	msgqueue_t *msgqueue = p.r;
+
+	size_t	      batch_size = num_entries * sizeof(batch[0]);
+	size_result_t copy_ret	 = useraccess_copy_from_guest_va(
+		  batch, sizeof(batch), (gvaddr_t)entries, batch_size);
+	if (copy_ret.e != OK) {
+		ret.error = copy_ret.e;
+		goto out_msgqueue_release;
+	}
+
+	// Check that the descriptors are writable before dequeuing anything,
+	// so the received sizes can't be lost after the messages are consumed.
+	copy_ret = useraccess_copy_to_guest_va((gvaddr_t)entries, batch_size,
+					       batch, batch_size, false);
+	if (copy_ret.e != OK) {
+		ret.error = copy_ret.e;
+		goto out_msgqueue_release;
+	}
+
+	msgqueue_batch_info_result_t res =
+		msgqueue_receive_batch(msgqueue, batch, num_entries, false);
+
+	ret.error     = res.e;
+	ret.count     = res.r.count;
+	ret.not_empty = res.r.more;
+
+	if (res.r.count != 0U) {
+		copy_ret = useraccess_copy_to_guest_va(
+			(gvaddr_t)entries, batch_size, batch,
+			res.r.count * sizeof(batch[0]), false);
+		if ((copy_ret.e != OK) && (ret.error == OK)) {
+			ret.error = copy_ret.e;
+		}
+	}
+
+out_msgqueue_release:
+	object_put_msgqueue(msgqueue);
+out:
+	return ret;
+}
+
 error_t
 hypercall_msgqueue_flush(cap_id_t msgqueue_cap)
 {
@@ -276,11 +382,59 @@ hypercall_msgqueue_configure(cap_id_t		    msgqueue_cap,
 		msgqueue_create_info_get_max_msg_size(&create_info);
 	count_t queue_depth =
 		msgqueue_create_info_get_queue_depth(&create_info);
+	bool spsc   = msgqueue_create_info_get_spsc(&create_info);
+	bool shared = msgqueue_create_info_get_shared(&create_info);
 
 	if (atomic_load_relaxed(&target_msgqueue->header.state) ==
 	    OBJECT_STATE_INIT) {
 		err = msgqueue_configure(target_msgqueue, max_msg_size,
-					 queue_depth);
+					 queue_depth, spsc, shared);
+	} else {
+		err = ERROR_OBJECT_STATE;
+	}
+
+	spinlock_release(&target_msgqueue->header.lock);
+out_msgqueue_release:
+	object_put(type, o.r);
+out:
+	return err;
+}
+
+error_t
+hypercall_msgqueue_configure_shm(cap_id_t msgqueue_cap, cap_id_t memextent_cap)
+{
+	error_t	      err;
+	cspace_t     *cspace = cspace_get_self();
+	object_type_t type;
+
+	memextent_ptr_result_t m = cspace_lookup_memextent(
+		cspace, memextent_cap, CAP_RIGHTS_MEMEXTENT_ATTACH);
+	if (compiler_unexpected(m.e != OK)) {
+		err = m.e;
+		goto out;
+	}
+
+	memextent_t *memextent = m.r;
+
+	object_ptr_result_t o = cspace_lookup_object_any(
+		cspace, msgqueue_cap, CAP_RIGHTS_GENERIC_OBJECT_ACTIVATE,
+		&type);
+	if (compiler_unexpected(o.e != OK)) {
+		err = o.e;
+		goto out_memextent_release;
+	}
+	if (type != OBJECT_TYPE_MSGQUEUE) {
+		err = ERROR_CSPACE_WRONG_OBJECT_TYPE;
+		goto out_msgqueue_release;
+	}
+
+	msgqueue_t *target_msgqueue = o.r.msgqueue;
+
+	spinlock_acquire(&target_msgqueue->header.lock);
+
+	if (atomic_load_relaxed(&target_msgqueue->header.state) ==
+	    OBJECT_STATE_INIT) {
+		err = msgqueue_configure_shm(target_msgqueue, memextent);
 	} else {
 		err = ERROR_OBJECT_STATE;
 	}
@@ -288,6 +442,8 @@ hypercall_msgqueue_configure(cap_id_t		    msgqueue_cap,
 	spinlock_release(&target_msgqueue->header.lock);
 out_msgqueue_release:
 	object_put(type, o.r);
+out_memextent_release:
+	object_put_memextent(memextent);
 out:
 	return err;
 }
@@ -7,10 +7,15 @@
 #include <string.h>
 
 #include <atomic.h>
+#include <hyp_aspace.h>
+#include <memextent.h>
+#include <object.h>
 #include <panic.h>
 #include <partition.h>
+#include <pgtable.h>
 #include <scheduler.h>
 #include <spinlock.h>
+#include <util.h>
 #include <vic.h>
 #include <virq.h>
 
@@ -18,6 +23,11 @@
 #include "msgqueue.h"
 #include "msgqueue_common.h"
 
+static_assert(sizeof(msgqueue_shm_header_t) <= MSGQUEUE_SHM_DATA_OFFSET,
+	      "Shared msgqueue header must fit before the first slot");
+static_assert(util_is_baligned(MSGQUEUE_SHM_DATA_OFFSET, PGTABLE_VM_PAGE_SIZE),
+	      "Shared msgqueue slots must start on a page boundary");
+
 bool_result_t
 msgqueue_send(msgqueue_t *msgqueue, size_t size, gvaddr_t data, bool push)
 {
@@ -66,7 +76,7 @@ msgqueue_configure_send(msgqueue_t *msgqueue, count_t notfull_thd,
 	if (notfull_thd != MSGQUEUE_THRESHOLD_UNCHANGED) {
 		msgqueue->notfull_thd = notfull_thd;
 
-		if (msgqueue->count <= msgqueue->notfull_thd) {
+		if (msgqueue_get_count(msgqueue) <= msgqueue->notfull_thd) {
 			(void)virq_assert(&msgqueue->send_source, false);
 		} else {
 			(void)virq_clear(&msgqueue->send_source);
@@ -98,14 +108,18 @@ msgqueue_configure_receive(msgqueue_t *msgqueue, count_t notempty_thd,
 		goto out;
 	}
 
-	spinlock_acquire(&msgqueue->lock);
+	// In SPSC mode the receive side has its own lock.
+	spinlock_t *lock =
+		msgqueue->spsc ? &msgqueue->rcv_lock : &msgqueue->lock;
+
+	spinlock_acquire(lock);
 
 	if (notempty_thd == MSGQUEUE_THRESHOLD_MAXIMUM) {
 		msgqueue->notempty_thd = msgqueue->queue_depth;
 	} else if (notempty_thd != MSGQUEUE_THRESHOLD_UNCHANGED) {
 		msgqueue->notempty_thd = notempty_thd;
 
-		if (msgqueue->count >= msgqueue->notempty_thd) {
+		if (msgqueue_get_count(msgqueue) >= msgqueue->notempty_thd) {
 			(void)virq_assert(&msgqueue->rcv_source, false);
 		} else {
 			(void)virq_clear(&msgqueue->rcv_source);
@@ -114,7 +128,7 @@ msgqueue_configure_receive(msgqueue_t *msgqueue, count_t notempty_thd,
 		// Nothing to do. Value stays the same.
 	}
 
-	spinlock_release(&msgqueue->lock);
+	spinlock_release(lock);
 out:
 	return ret;
 }
@@ -151,23 +165,33 @@ msgqueue_handle_object_create_msgqueue(msgqueue_create_t params)
 	msgqueue_t *msgqueue = params.msgqueue;
 	assert(msgqueue != NULL);
 	spinlock_init(&msgqueue->lock);
+	spinlock_init(&msgqueue->rcv_lock);
 
 	return OK;
 }
 
 error_t
 msgqueue_configure(msgqueue_t *msgqueue, size_t max_msg_size,
-		   count_t queue_depth)
+		   count_t queue_depth, bool spsc, bool shared)
 {
 	error_t ret = OK;
 
 	assert(msgqueue != NULL);
 
+	// Shared memory queues are not copied through the hypervisor, so
+	// their message size is only limited by the memextent size.
+	//
+	// SPSC queues use free running indices, so their depth must be a
+	// power of two for the slot of an index to stay consistent when the
+	// indices wrap.
 	if ((queue_depth != 0U) && (max_msg_size != 0U) &&
 	    (queue_depth < MSGQUEUE_MAX_QUEUE_DEPTH) &&
-	    (max_msg_size < MSGQUEUE_MAX_MAX_MSG_SIZE)) {
+	    (shared || (max_msg_size < MSGQUEUE_MAX_MAX_MSG_SIZE)) &&
+	    (!(spsc || shared) || util_is_p2(queue_depth))) {
 		msgqueue->max_msg_size = max_msg_size;
 		msgqueue->queue_depth  = queue_depth;
+		msgqueue->spsc	       = spsc || shared;
+		msgqueue->shared       = shared;
 	} else {
 		ret = ERROR_ARGUMENT_INVALID;
 	}
@@ -176,18 +200,70 @@ msgqueue_configure(msgqueue_t *msgqueue, size_t max_msg_size,
 }
 
 error_t
-msgqueue_handle_object_activate_msgqueue(msgqueue_t *msgqueue)
+msgqueue_configure_shm(msgqueue_t *msgqueue, memextent_t *memextent)
 {
-	error_t ret = OK;
-
 	assert(msgqueue != NULL);
-	assert(msgqueue->buf == NULL);
+	assert(memextent != NULL);
 
-	if ((msgqueue->queue_depth == 0U) || (msgqueue->max_msg_size == 0U)) {
+	if (msgqueue->shm_me != NULL) {
+		object_put_memextent(msgqueue->shm_me);
+	}
+
+	msgqueue->shm_me = object_get_memextent_additional(memextent);
+
+	return OK;
+}
+
+static error_t
+msgqueue_activate_shm(msgqueue_t *msgqueue)
+{
+	error_t	     ret;
+	partition_t *partition = msgqueue->header.partition;
+
+	if (!msgqueue->shared || (msgqueue->shm_me == NULL)) {
 		ret = ERROR_OBJECT_CONFIG;
 		goto out;
 	}
 
+	size_t slots_size = msgqueue->max_msg_size * msgqueue->queue_depth;
+	if ((msgqueue->shm_me->size < MSGQUEUE_SHM_DATA_OFFSET) ||
+	    ((msgqueue->shm_me->size - MSGQUEUE_SHM_DATA_OFFSET) <
+	     slots_size)) {
+		ret = ERROR_ARGUMENT_SIZE;
+		goto out;
+	}
+
+	// Only the header is mapped in the hypervisor; the messages are never
+	// accessed by it.
+	size_t header_size = util_balign_up(sizeof(msgqueue_shm_header_t),
+					    PGTABLE_HYP_PAGE_SIZE);
+
+	virt_range_result_t range = hyp_aspace_allocate(header_size);
+	if (range.e != OK) {
+		ret = range.e;
+		goto out;
+	}
+
+	ret = memextent_attach(partition, msgqueue->shm_me, range.r.base,
+			       header_size);
+	if (ret != OK) {
+		hyp_aspace_deallocate(partition, range.r);
+		goto out;
+	}
+
+	msgqueue->shm = (msgqueue_shm_header_t *)range.r.base;
+	(void)memset_s(msgqueue->shm, sizeof(*msgqueue->shm), 0,
+		       sizeof(*msgqueue->shm));
+
+out:
+	return ret;
+}
+
+static error_t
+msgqueue_alloc_buf(msgqueue_t *msgqueue)
+{
+	error_t ret = OK;
+
 	// Message queue size consists of the message maximum size, a field to
 	// know the exact size of the message and how many messages can the
 	// queue contain.
@@ -202,11 +278,40 @@ msgqueue_handle_object_activate_msgqueue(msgqueue_t *msgqueue)
 		goto out;
 	}
 
-	msgqueue->buf	       = (uint8_t *)res.r;
+	msgqueue->buf	     = (uint8_t *)res.r;
+	msgqueue->queue_size = queue_size;
+
+out:
+	return ret;
+}
+
+error_t
+msgqueue_handle_object_activate_msgqueue(msgqueue_t *msgqueue)
+{
+	error_t ret = OK;
+
+	assert(msgqueue != NULL);
+	assert(msgqueue->buf == NULL);
+
+	if ((msgqueue->queue_depth == 0U) || (msgqueue->max_msg_size == 0U)) {
+		ret = ERROR_OBJECT_CONFIG;
+		goto out;
+	}
+
+	if (msgqueue->shared || (msgqueue->shm_me != NULL)) {
+		ret = msgqueue_activate_shm(msgqueue);
+	} else {
+		ret = msgqueue_alloc_buf(msgqueue);
+	}
+	if (ret != OK) {
+		goto out;
+	}
+
 	msgqueue->count	       = 0U;
-	msgqueue->queue_size   = queue_size;
 	msgqueue->head	       = 0U;
 	msgqueue->tail	       = 0U;
+	atomic_init(&msgqueue->spsc_head, 0U);
+	atomic_init(&msgqueue->spsc_tail, 0U);
 	msgqueue->notfull_thd  = msgqueue->queue_depth - 1U;
 	msgqueue->notempty_thd = 1U;
 
@@ -235,3 +340,30 @@ msgqueue_handle_object_deactivate_msgqueue(msgqueue_t *msgqueue)
 	vic_unbind(&msgqueue->send_source);
 	vic_unbind(&msgqueue->rcv_source);
 }
+
+void
+msgqueue_handle_object_cleanup_msgqueue(msgqueue_t *msgqueue)
+{
+	assert(msgqueue != NULL);
+
+	partition_t *partition = msgqueue->header.partition;
+
+	if (msgqueue->shm != NULL) {
+		memextent_detach(partition, msgqueue->shm_me);
+
+		virt_range_t range = {
+			.base = (uintptr_t)msgqueue->shm,
+			.size = util_balign_up(sizeof(msgqueue_shm_header_t),
+					       PGTABLE_HYP_PAGE_SIZE),
+		};
+
+		hyp_aspace_deallocate(partition, range);
+
+		msgqueue->shm = NULL;
+	}
+
+	if (msgqueue->shm_me != NULL) {
+		object_put_memextent(msgqueue->shm_me);
+		msgqueue->shm_me = NULL;
+	}
+}
@@ -28,6 +28,12 @@ msgqueue_send_msg(msgqueue_t *msgqueue, size_t size, kernel_or_gvaddr_t msg,
 
 	assert(msgqueue != NULL);
 
+	if (msgqueue->spsc) {
+		ret = msgqueue_spsc_send_msg(msgqueue, size, msg, push,
+					     from_kernel);
+		goto out_unlocked;
+	}
+
 	spinlock_acquire(&msgqueue->lock);
 
 	if (msgqueue->count == msgqueue->queue_depth) {
@@ -79,7 +85,7 @@ msgqueue_send_msg(msgqueue_t *msgqueue, size_t size, kernel_or_gvaddr_t msg,
 
 out:
 	spinlock_release(&msgqueue->lock);
-
+out_unlocked:
 	return ret;
 }
 
@@ -95,7 +101,13 @@ msgqueue_receive_msg(msgqueue_t *msgqueue, kernel_or_gvaddr_t buffer,
 	ret.r.notempty = true;
 
 	assert(msgqueue != NULL);
-	assert(msgqueue->buf != NULL);
+	assert((msgqueue->buf != NULL) || msgqueue->shared);
+
+	if (msgqueue->spsc) {
+		ret = msgqueue_spsc_receive_msg(msgqueue, buffer, max_size,
+						to_kernel);
+		goto out_unlocked;
+	}
 
 	spinlock_acquire(&msgqueue->lock);
 
@@ -153,7 +165,167 @@ msgqueue_receive_msg(msgqueue_t *msgqueue, kernel_or_gvaddr_t buffer,
 
 out:
 	spinlock_release(&msgqueue->lock);
+out_unlocked:
+	return ret;
+}
+
+msgqueue_batch_info_result_t
+msgqueue_send_batch(msgqueue_t *msgqueue, const msgqueue_batch_entry_t *entries,
+		    count_t num_entries, bool push, bool from_kernel)
+{
+	msgqueue_batch_info_result_t ret = { 0 };
+
+	ret.e	    = OK;
+	ret.r.count = 0U;
+	ret.r.more  = true;
+
+	assert(msgqueue != NULL);
+	assert(entries != NULL);
+	assert(num_entries <= MSGQUEUE_MAX_BATCH);
+
+	if (msgqueue->spsc) {
+		ret = msgqueue_spsc_send_batch(msgqueue, entries, num_entries,
+					       push, from_kernel);
+		goto out_unlocked;
+	}
+
+	spinlock_acquire(&msgqueue->lock);
+
+	count_t old_count = msgqueue->count;
+
+	for (index_t i = 0U; i < num_entries; i++) {
+		if (msgqueue->count == msgqueue->queue_depth) {
+			ret.e = (ret.r.count == 0U) ? ERROR_MSGQUEUE_FULL : OK;
+			break;
+		}
+
+		// Enqueue message at the tail of the queue
+		uint8_t *slot = msgqueue->buf + msgqueue->tail;
+		size_t	 size = entries[i].size;
+
+		if (from_kernel) {
+			if (size > msgqueue->max_msg_size) {
+				ret.e = ERROR_ARGUMENT_SIZE;
+				break;
+			}
+
+			(void)memcpy(slot + sizeof(size_t),
+				     (const void *)entries[i].data, size);
+		} else {
+			size_result_t ret_val = useraccess_copy_from_guest_va(
+				slot + sizeof(size_t), msgqueue->max_msg_size,
+				(gvaddr_t)entries[i].data, size);
+			if (ret_val.e != OK) {
+				ret.e = ret_val.e;
+				break;
+			}
+		}
+
+		(void)memcpy(slot, (uint8_t *)&size, sizeof(size_t));
+		msgqueue->count++;
+		ret.r.count++;
+
+		// Update tail value
+		msgqueue->tail +=
+			(count_t)(msgqueue->max_msg_size + sizeof(size_t));
+		if (msgqueue->tail == msgqueue->queue_size) {
+			msgqueue->tail = 0U;
+		}
+	}
+
+	// Wake up the receiver once for the whole batch, if the batch crossed
+	// the not empty threshold.
+	if ((ret.r.count != 0U) &&
+	    (push || ((old_count < msgqueue->notempty_thd) &&
+		      (msgqueue->count >= msgqueue->notempty_thd)))) {
+		(void)virq_assert(&msgqueue->rcv_source, false);
+	}
+
+	ret.r.more = (msgqueue->count != msgqueue->queue_depth);
+
+	spinlock_release(&msgqueue->lock);
+out_unlocked:
+	return ret;
+}
+
+msgqueue_batch_info_result_t
+msgqueue_receive_batch(msgqueue_t *msgqueue, msgqueue_batch_entry_t *entries,
+		       count_t num_entries, bool to_kernel)
+{
+	msgqueue_batch_info_result_t ret = { 0 };
+
+	ret.e	    = OK;
+	ret.r.count = 0U;
+	ret.r.more  = true;
+
+	assert(msgqueue != NULL);
+	assert((msgqueue->buf != NULL) || msgqueue->shared);
+	assert(entries != NULL);
+	assert(num_entries <= MSGQUEUE_MAX_BATCH);
+
+	if (msgqueue->spsc) {
+		ret = msgqueue_spsc_receive_batch(msgqueue, entries,
+						  num_entries, to_kernel);
+		goto out_unlocked;
+	}
+
+	spinlock_acquire(&msgqueue->lock);
+
+	count_t old_count = msgqueue->count;
+
+	for (index_t i = 0U; i < num_entries; i++) {
+		if (msgqueue->count == 0U) {
+			ret.e = (ret.r.count == 0U) ? ERROR_MSGQUEUE_EMPTY : OK;
+			break;
+		}
+
+		// Dequeue message from the head of the queue
+		uint8_t *slot = msgqueue->buf + msgqueue->head;
+		size_t	 size = 0U;
+
+		(void)memcpy((uint8_t *)&size, slot, sizeof(size_t));
+
+		if (to_kernel) {
+			if (size > entries[i].size) {
+				ret.e = ERROR_ARGUMENT_SIZE;
+				break;
+			}
+
+			(void)memcpy((void *)entries[i].data,
+				     slot + sizeof(size_t), size);
+		} else {
+			size_result_t ret_val = useraccess_copy_to_guest_va(
+				(gvaddr_t)entries[i].data, entries[i].size,
+				slot + sizeof(size_t), size, false);
+			if (ret_val.e != OK) {
+				ret.e = ret_val.e;
+				break;
+			}
+		}
+
+		entries[i].size = size;
+		msgqueue->count--;
+		ret.r.count++;
 
+		// Update head value
+		msgqueue->head +=
+			(count_t)(msgqueue->max_msg_size + sizeof(size_t));
+		if (msgqueue->head == msgqueue->queue_size) {
+			msgqueue->head = 0U;
+		}
+	}
+
+	// Wake up the sender once for the whole batch, if the batch crossed
+	// the not full threshold.
+	if ((ret.r.count != 0U) && (old_count > msgqueue->notfull_thd) &&
+	    (msgqueue->count <= msgqueue->notfull_thd)) {
+		(void)virq_assert(&msgqueue->send_source, false);
+	}
+
+	ret.r.more = (msgqueue->count != 0U);
+
+	spinlock_release(&msgqueue->lock);
+out_unlocked:
 	return ret;
 }
 
@@ -161,7 +333,12 @@ void
 msgqueue_flush_queue(msgqueue_t *msgqueue)
 {
 	assert(msgqueue != NULL);
-	assert(msgqueue->buf != NULL);
+	assert((msgqueue->buf != NULL) || msgqueue->shared);
+
+	if (msgqueue->spsc) {
+		msgqueue_spsc_flush(msgqueue);
+		goto out;
+	}
 
 	spinlock_acquire(&msgqueue->lock);
 
@@ -178,6 +355,15 @@ msgqueue_flush_queue(msgqueue_t *msgqueue)
 	msgqueue->tail	= 0U;
 
 	spinlock_release(&msgqueue->lock);
+out:
+	return;
+}
+
+count_t
+msgqueue_get_count(const msgqueue_t *msgqueue)
+{
+	return msgqueue->spsc ? msgqueue_spsc_get_count(msgqueue)
+			      : msgqueue->count;
 }
 
 error_t
@@ -216,7 +402,7 @@ msgqueue_rx_handle_virq_check_pending(virq_source_t *source, bool reasserted)
 		// msgqueue_send_msg() on another CPU.
 		ret = true;
 	} else {
-		ret = (msgqueue->count >= msgqueue->notempty_thd);
+		ret = (msgqueue_get_count(msgqueue) >= msgqueue->notempty_thd);
 	}
 
 	return ret;
@@ -237,7 +423,7 @@ msgqueue_tx_handle_virq_check_pending(virq_source_t *source, bool reasserted)
 		// msgqueue_receive_msg() on another CPU.
 		ret = true;
 	} else {
-		ret = (msgqueue->count <= msgqueue->notfull_thd);
+		ret = (msgqueue_get_count(msgqueue) <= msgqueue->notfull_thd);
 	}
 
 	return ret;
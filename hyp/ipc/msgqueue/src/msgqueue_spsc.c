@@ -0,0 +1,457 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Single-producer single-consumer message queue mode.
+//
+// The tail index is only written by the sender, and the head index is only
+// written by the receiver. Both are free running, so the number of queued
+// messages is their difference. The sender holds msgqueue->lock and the
+// receiver holds msgqueue->rcv_lock; these only serialise concurrent callers
+// on the same side, and are uncontended for a true SPSC channel.
+//
+// In shared memory mode, the slots are in a memextent mapped by both VMs, and
+// are written and read in place. The hypervisor only records the size of each
+// message, and publishes the head and tail in the msgqueue_shm_header.
+
+#include <assert.h>
+#include <hyptypes.h>
+#include <string.h>
+
+#include <atomic.h>
+#include <spinlock.h>
+#include <util.h>
+#include <virq.h>
+
+#include "msgqueue_common.h"
+#include "useraccess.h"
+
+static uint8_t *
+msgqueue_spsc_get_slot(const msgqueue_t *msgqueue, count_t index)
+{
+	size_t slot	 = (size_t)(index % msgqueue->queue_depth);
+	size_t slot_size = msgqueue->max_msg_size + sizeof(size_t);
+
+	return msgqueue->buf + (slot * slot_size);
+}
+
+// Write a message into the slot for the given index. In shared memory mode
+// the sender has already written the message, and must pass a zero address.
+static error_t
+msgqueue_spsc_write_slot(msgqueue_t *msgqueue, count_t index, size_t size,
+			 kernel_or_gvaddr_t msg, bool from_kernel)
+{
+	error_t err = OK;
+
+	if (msgqueue->shared) {
+		if (from_kernel || (msg.guest_addr != 0U)) {
+			err = ERROR_ARGUMENT_INVALID;
+		} else if ((size == 0U) || (size > msgqueue->max_msg_size)) {
+			err = ERROR_ARGUMENT_SIZE;
+		} else {
+			index_t slot = index % msgqueue->queue_depth;
+			atomic_store_relaxed(&msgqueue->shm->size[slot],
+					     (count_t)size);
+		}
+		goto out;
+	}
+
+	uint8_t *slot	= msgqueue_spsc_get_slot(msgqueue, index);
+	void	*hyp_va = (void *)(slot + sizeof(size_t));
+
+	if (from_kernel) {
+		if (size > msgqueue->max_msg_size) {
+			err = ERROR_ARGUMENT_SIZE;
+			goto out;
+		}
+
+		(void)memcpy(hyp_va, (void *)msg.kernel_addr, size);
+	} else {
+		size_result_t ret_val = useraccess_copy_from_guest_va(
+			hyp_va, msgqueue->max_msg_size, msg.guest_addr, size);
+		if (ret_val.e != OK) {
+			err = ret_val.e;
+			goto out;
+		}
+	}
+
+	(void)memcpy(slot, (uint8_t *)&size, sizeof(size_t));
+
+out:
+	return err;
+}
+
+// Read the message from the slot for the given index, returning its size. In
+// shared memory mode the receiver reads the message in place, and must pass a
+// zero address.
+static size_result_t
+msgqueue_spsc_read_slot(const msgqueue_t *msgqueue, count_t index,
+			kernel_or_gvaddr_t buffer, size_t max_size,
+			bool to_kernel)
+{
+	size_result_t ret  = size_result_ok(0U);
+	size_t	      size = 0U;
+
+	if (msgqueue->shared) {
+		if (to_kernel || (buffer.guest_addr != 0U)) {
+			ret = size_result_error(ERROR_ARGUMENT_INVALID);
+		} else {
+			index_t slot = index % msgqueue->queue_depth;
+
+			// The sizes are in memory shared with the VMs, so a
+			// corrupted size must be clamped to the slot size.
+			size = atomic_load_relaxed(&msgqueue->shm->size[slot]);
+			ret  = size_result_ok(
+				 util_min(size, msgqueue->max_msg_size));
+		}
+		goto out;
+	}
+
+	uint8_t *slot	= msgqueue_spsc_get_slot(msgqueue, index);
+	void	*hyp_va = (void *)(slot + sizeof(size_t));
+
+	(void)memcpy((uint8_t *)&size, slot, sizeof(size_t));
+	assert(size <= msgqueue->max_msg_size);
+
+	if (to_kernel) {
+		if (size > max_size) {
+			ret = size_result_error(ERROR_ARGUMENT_SIZE);
+			goto out;
+		}
+
+		(void)memcpy((void *)buffer.kernel_addr, hyp_va, size);
+	} else {
+		size_result_t ret_val = useraccess_copy_to_guest_va(
+			buffer.guest_addr, max_size, hyp_va, size, false);
+		if (ret_val.e != OK) {
+			ret = ret_val;
+			goto out;
+		}
+	}
+
+	ret = size_result_ok(size);
+out:
+	return ret;
+}
+
+static void
+msgqueue_spsc_publish_tail(msgqueue_t *msgqueue, count_t tail)
+{
+	atomic_store_release(&msgqueue->spsc_tail, tail);
+	if (msgqueue->shared) {
+		atomic_store_release(&msgqueue->shm->tail, tail);
+	}
+}
+
+static void
+msgqueue_spsc_publish_head(msgqueue_t *msgqueue, count_t head)
+{
+	atomic_store_release(&msgqueue->spsc_head, head);
+	if (msgqueue->shared) {
+		atomic_store_release(&msgqueue->shm->head, head);
+	}
+}
+
+count_t
+msgqueue_spsc_get_count(const msgqueue_t *msgqueue)
+{
+	count_t head = atomic_load_relaxed(&msgqueue->spsc_head);
+	count_t tail = atomic_load_relaxed(&msgqueue->spsc_tail);
+
+	return tail - head;
+}
+
+bool_result_t
+msgqueue_spsc_send_msg(msgqueue_t *msgqueue, size_t size,
+		       kernel_or_gvaddr_t msg, bool push, bool from_kernel)
+{
+	bool_result_t ret;
+
+	ret.r = true;
+	ret.e = OK;
+
+	assert(msgqueue != NULL);
+	assert(msgqueue->spsc);
+
+	spinlock_acquire(&msgqueue->lock);
+
+	// Acquire the head to ensure that the receiver has finished reading a
+	// slot before we overwrite it.
+	count_t tail = atomic_load_relaxed(&msgqueue->spsc_tail);
+	count_t head = atomic_load_acquire(&msgqueue->spsc_head);
+
+	if ((count_t)(tail - head) == msgqueue->queue_depth) {
+		ret.e = ERROR_MSGQUEUE_FULL;
+		ret.r = false;
+		goto out;
+	}
+
+	error_t err = msgqueue_spsc_write_slot(msgqueue, tail, size, msg,
+					       from_kernel);
+	if (err != OK) {
+		ret.e = err;
+		ret.r = false;
+		goto out;
+	}
+
+	// Publish the message to the receiver.
+	tail++;
+	msgqueue_spsc_publish_tail(msgqueue, tail);
+
+	// Order the tail update before reloading the head, so that a
+	// concurrent receiver either sees this message or is seen here.
+	atomic_thread_fence(memory_order_seq_cst);
+	count_t count = tail - atomic_load_relaxed(&msgqueue->spsc_head);
+
+	// If buffer was previously below the not empty threshold, we must
+	// wake up the receiver side by asserting the receiver virq source.
+	if (push || (count == msgqueue->notempty_thd)) {
+		(void)virq_assert(&msgqueue->rcv_source, false);
+	}
+
+	if (count == msgqueue->queue_depth) {
+		ret.r = false;
+	}
+
+out:
+	spinlock_release(&msgqueue->lock);
+
+	return ret;
+}
+
+receive_info_result_t
+msgqueue_spsc_receive_msg(msgqueue_t *msgqueue, kernel_or_gvaddr_t buffer,
+			  size_t max_size, bool to_kernel)
+{
+	receive_info_result_t ret = { 0 };
+
+	ret.e	       = OK;
+	ret.r.size     = 0U;
+	ret.r.notempty = true;
+
+	assert(msgqueue != NULL);
+	assert((msgqueue->buf != NULL) || msgqueue->shared);
+	assert(msgqueue->spsc);
+
+	spinlock_acquire(&msgqueue->rcv_lock);
+
+	// Acquire the tail to ensure that we see the sender's writes to the
+	// slot.
+	count_t head = atomic_load_relaxed(&msgqueue->spsc_head);
+	count_t tail = atomic_load_acquire(&msgqueue->spsc_tail);
+
+	if (tail == head) {
+		ret.e	       = ERROR_MSGQUEUE_EMPTY;
+		ret.r.notempty = false;
+		goto out;
+	}
+
+	size_result_t size_ret =
+		msgqueue_spsc_read_slot(msgqueue, head, buffer, max_size,
+					to_kernel);
+	if (size_ret.e != OK) {
+		ret.e = size_ret.e;
+		if (to_kernel) {
+			ret.r.notempty = false;
+		}
+		goto out;
+	}
+
+	ret.r.size = size_ret.r;
+
+	// Release the slot to the sender.
+	head++;
+	msgqueue_spsc_publish_head(msgqueue, head);
+
+	// Order the head update before reloading the tail, so that a
+	// concurrent sender either sees the free slot or is seen here.
+	atomic_thread_fence(memory_order_seq_cst);
+	count_t count = atomic_load_relaxed(&msgqueue->spsc_tail) - head;
+
+	// If buffer was previously above the not full threshold, we must let
+	// the sender side know that it can send more messages.
+	if (count == msgqueue->notfull_thd) {
+		(void)virq_assert(&msgqueue->send_source, false);
+	}
+
+	if (count == 0U) {
+		ret.r.notempty = false;
+	}
+
+out:
+	spinlock_release(&msgqueue->rcv_lock);
+
+	return ret;
+}
+
+msgqueue_batch_info_result_t
+msgqueue_spsc_send_batch(msgqueue_t		    *msgqueue,
+			 const msgqueue_batch_entry_t *entries,
+			 count_t num_entries, bool push, bool from_kernel)
+{
+	msgqueue_batch_info_result_t ret = { 0 };
+
+	ret.e	    = OK;
+	ret.r.count = 0U;
+	ret.r.more  = true;
+
+	assert(msgqueue != NULL);
+	assert(msgqueue->spsc);
+
+	spinlock_acquire(&msgqueue->lock);
+
+	count_t tail = atomic_load_relaxed(&msgqueue->spsc_tail);
+	count_t head = atomic_load_acquire(&msgqueue->spsc_head);
+	count_t free = msgqueue->queue_depth - (count_t)(tail - head);
+
+	for (index_t i = 0U; i < num_entries; i++) {
+		if (ret.r.count == free) {
+			ret.e = (ret.r.count == 0U) ? ERROR_MSGQUEUE_FULL : OK;
+			break;
+		}
+
+		kernel_or_gvaddr_t msg;
+		if (from_kernel) {
+			msg.kernel_addr = (uintptr_t)entries[i].data;
+		} else {
+			msg.guest_addr = (gvaddr_t)entries[i].data;
+		}
+
+		error_t err = msgqueue_spsc_write_slot(
+			msgqueue, tail + ret.r.count, entries[i].size, msg,
+			from_kernel);
+		if (err != OK) {
+			ret.e = err;
+			break;
+		}
+
+		ret.r.count++;
+	}
+
+	if (ret.r.count == 0U) {
+		ret.r.more = (free != 0U);
+		goto out;
+	}
+
+	// Publish the whole batch to the receiver.
+	tail += ret.r.count;
+	msgqueue_spsc_publish_tail(msgqueue, tail);
+
+	atomic_thread_fence(memory_order_seq_cst);
+	count_t count = tail - atomic_load_relaxed(&msgqueue->spsc_head);
+
+	// Wake up the receiver once for the whole batch, if the batch crossed
+	// the not empty threshold. The receiver may have already taken some
+	// of the batch, in which case the count before the batch is unknown
+	// but was certainly below the threshold.
+	if (push || ((count >= msgqueue->notempty_thd) &&
+		     ((count < ret.r.count) ||
+		      ((count - ret.r.count) < msgqueue->notempty_thd)))) {
+		(void)virq_assert(&msgqueue->rcv_source, false);
+	}
+
+	ret.r.more = (count != msgqueue->queue_depth);
+
+out:
+	spinlock_release(&msgqueue->lock);
+
+	return ret;
+}
+
+msgqueue_batch_info_result_t
+msgqueue_spsc_receive_batch(msgqueue_t		   *msgqueue,
+			    msgqueue_batch_entry_t *entries,
+			    count_t num_entries, bool to_kernel)
+{
+	msgqueue_batch_info_result_t ret = { 0 };
+
+	ret.e	    = OK;
+	ret.r.count = 0U;
+	ret.r.more  = true;
+
+	assert(msgqueue != NULL);
+	assert((msgqueue->buf != NULL) || msgqueue->shared);
+	assert(msgqueue->spsc);
+
+	spinlock_acquire(&msgqueue->rcv_lock);
+
+	count_t head  = atomic_load_relaxed(&msgqueue->spsc_head);
+	count_t tail  = atomic_load_acquire(&msgqueue->spsc_tail);
+	count_t avail = tail - head;
+
+	for (index_t i = 0U; i < num_entries; i++) {
+		if (ret.r.count == avail) {
+			ret.e = (ret.r.count == 0U) ? ERROR_MSGQUEUE_EMPTY : OK;
+			break;
+		}
+
+		kernel_or_gvaddr_t buffer;
+		if (to_kernel) {
+			buffer.kernel_addr = (uintptr_t)entries[i].data;
+		} else {
+			buffer.guest_addr = (gvaddr_t)entries[i].data;
+		}
+
+		size_result_t size_ret = msgqueue_spsc_read_slot(
+			msgqueue, head + ret.r.count, buffer, entries[i].size,
+			to_kernel);
+		if (size_ret.e != OK) {
+			ret.e = size_ret.e;
+			break;
+		}
+
+		entries[i].size = size_ret.r;
+		ret.r.count++;
+	}
+
+	if (ret.r.count == 0U) {
+		ret.r.more = (avail != 0U);
+		goto out;
+	}
+
+	// Release the whole batch of slots to the sender.
+	head += ret.r.count;
+	msgqueue_spsc_publish_head(msgqueue, head);
+
+	atomic_thread_fence(memory_order_seq_cst);
+	count_t count = atomic_load_relaxed(&msgqueue->spsc_tail) - head;
+
+	// Wake up the sender once for the whole batch, if the batch crossed
+	// the not full threshold. The sender only adds messages, so the count
+	// before the batch was at least this much larger.
+	if ((count <= msgqueue->notfull_thd) &&
+	    ((count + ret.r.count) > msgqueue->notfull_thd)) {
+		(void)virq_assert(&msgqueue->send_source, false);
+	}
+
+	ret.r.more = (count != 0U);
+
+out:
+	spinlock_release(&msgqueue->rcv_lock);
+
+	return ret;
+}
+
+void
+msgqueue_spsc_flush(msgqueue_t *msgqueue)
+{
+	assert(msgqueue != NULL);
+	assert((msgqueue->buf != NULL) || msgqueue->shared);
+	assert(msgqueue->spsc);
+
+	spinlock_acquire(&msgqueue->rcv_lock);
+
+	// Discard the messages by consuming them. The buffer is not cleared,
+	// as the sender may be concurrently writing the next free slot.
+	count_t head = atomic_load_relaxed(&msgqueue->spsc_head);
+	count_t tail = atomic_load_acquire(&msgqueue->spsc_tail);
+
+	// If there is a pending bound interrupt, it will be de-asserted
+	if (tail != head) {
+		msgqueue_spsc_publish_head(msgqueue, tail);
+		(void)virq_assert(&msgqueue->send_source, false);
+		(void)virq_clear(&msgqueue->rcv_source);
+	}
+
+	spinlock_release(&msgqueue->rcv_lock);
+}
@@ -0,0 +1,568 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#if defined(UNIT_TESTS)
+
+#include <assert.h>
+#include <hyptypes.h>
+
+#include <atomic.h>
+#include <cpulocal.h>
+#include <log.h>
+#include <memdb.h>
+#include <memextent.h>
+#include <object.h>
+#include <panic.h>
+#include <partition.h>
+#include <partition_alloc.h>
+#include <pgtable.h>
+#include <spinlock.h>
+#include <trace.h>
+#include <util.h>
+
+#include <asm/barrier.h>
+#include <asm/event.h>
+
+#include "event_handlers.h"
+#include "msgqueue_common.h"
+
+#define MSGQUEUE_TEST_DEPTH	 8U
+#define MSGQUEUE_TEST_MSG_SIZE	 16U
+#define MSGQUEUE_TEST_ITERATIONS 10000U
+#define MSGQUEUE_TEST_SHM_SIZE	 (2U * PGTABLE_VM_PAGE_SIZE)
+
+static_assert(MSGQUEUE_TEST_SHM_SIZE >=
+		      (MSGQUEUE_SHM_DATA_OFFSET +
+		       (MSGQUEUE_TEST_DEPTH * MSGQUEUE_TEST_MSG_SIZE)),
+	      "Msgqueue test memextent is too small");
+
+static msgqueue_t     *test_msgqueue_locked;
+static msgqueue_t     *test_msgqueue_spsc;
+static _Atomic count_t test_msgqueue_sync_count;
+
+static msgqueue_t *
+tests_msgqueue_allocate(partition_t *partition)
+{
+	msgqueue_create_t     params = { NULL };
+	msgqueue_ptr_result_t ret =
+		partition_allocate_msgqueue(partition, params);
+	if (ret.e != OK) {
+		panic("Failed msgqueue creation");
+	}
+
+	return ret.r;
+}
+
+static error_t
+tests_msgqueue_configure(msgqueue_t *msgqueue, count_t depth, bool spsc,
+			 bool shared)
+{
+	spinlock_acquire(&msgqueue->header.lock);
+	error_t err = msgqueue_configure(msgqueue, MSGQUEUE_TEST_MSG_SIZE,
+					 depth, spsc, shared);
+	spinlock_release(&msgqueue->header.lock);
+
+	return err;
+}
+
+static msgqueue_t *
+tests_msgqueue_create(count_t depth, bool spsc)
+{
+	msgqueue_t *msgqueue = tests_msgqueue_allocate(partition_get_private());
+
+	if (tests_msgqueue_configure(msgqueue, depth, spsc, false) != OK) {
+		panic("Failed msgqueue configuration");
+	}
+
+	if (object_activate_msgqueue(msgqueue) != OK) {
+		panic("Failed msgqueue activation");
+	}
+
+	return msgqueue;
+}
+
+void
+tests_msgqueue_init(void)
+{
+	test_msgqueue_locked =
+		tests_msgqueue_create(MSGQUEUE_TEST_DEPTH, false);
+	test_msgqueue_spsc = tests_msgqueue_create(MSGQUEUE_TEST_DEPTH, true);
+
+	atomic_init(&test_msgqueue_sync_count, 0U);
+}
+
+// Wait until all CPUs have reached the given phase.
+static void
+tests_msgqueue_sync(count_t phase)
+{
+	(void)atomic_fetch_add_explicit(&test_msgqueue_sync_count, 1U,
+					memory_order_release);
+	while (asm_event_load_before_wait(&test_msgqueue_sync_count) <
+	       (phase * PLATFORM_MAX_CORES)) {
+		asm_event_wait(&test_msgqueue_sync_count);
+	}
+}
+
+static bool_result_t
+tests_msgqueue_send(msgqueue_t *msgqueue, count_t seq)
+{
+	kernel_or_gvaddr_t msg;
+	msg.kernel_addr = (uintptr_t)&seq;
+
+	return msgqueue_send_msg(msgqueue, sizeof(seq), msg, false, true);
+}
+
+static receive_info_result_t
+tests_msgqueue_receive(msgqueue_t *msgqueue, count_t *seq)
+{
+	kernel_or_gvaddr_t buffer;
+	buffer.kernel_addr = (uintptr_t)seq;
+
+	return msgqueue_receive_msg(msgqueue, buffer, sizeof(*seq), true);
+}
+
+// Fill the queue until it is full, then drain it until it is empty, checking
+// the not full and not empty results and the order of the messages.
+static void
+tests_msgqueue_fill_drain(msgqueue_t *msgqueue, count_t base)
+{
+	count_t depth = msgqueue->queue_depth;
+
+	for (count_t i = 0U; i < depth; i++) {
+		bool_result_t ret = tests_msgqueue_send(msgqueue, base + i);
+		if ((ret.e != OK) || (ret.r != (i != (depth - 1U)))) {
+			panic("Msgqueue send failed");
+		}
+	}
+
+	bool_result_t full = tests_msgqueue_send(msgqueue, base + depth);
+	if ((full.e != ERROR_MSGQUEUE_FULL) ||
+	    (msgqueue_get_count(msgqueue) != depth)) {
+		panic("Msgqueue send to a full queue did not fail");
+	}
+
+	for (count_t i = 0U; i < depth; i++) {
+		count_t		      seq = 0U;
+		receive_info_result_t ret = tests_msgqueue_receive(msgqueue,
+								   &seq);
+		if ((ret.e != OK) || (ret.r.size != sizeof(seq)) ||
+		    (ret.r.notempty != (i != (depth - 1U))) ||
+		    (seq != (base + i))) {
+			panic("Msgqueue receive failed");
+		}
+	}
+
+	count_t		      seq   = 0U;
+	receive_info_result_t empty = tests_msgqueue_receive(msgqueue, &seq);
+	if ((empty.e != ERROR_MSGQUEUE_EMPTY) ||
+	    (msgqueue_get_count(msgqueue) != 0U)) {
+		panic("Msgqueue receive from an empty queue did not fail");
+	}
+}
+
+// Check the slots are reused in order when the queue is never full or
+// empty, so the ring wraps around repeatedly with messages in flight.
+static void
+tests_msgqueue_wraparound(msgqueue_t *msgqueue)
+{
+	count_t half = msgqueue->queue_depth / 2U;
+	count_t sent = 0U;
+
+	for (count_t i = 0U; i < half; i++) {
+		(void)tests_msgqueue_send(msgqueue, sent);
+		sent++;
+	}
+
+	for (count_t i = 0U; i < (3U * msgqueue->queue_depth); i++) {
+		count_t seq = 0U;
+
+		bool_result_t send_ret = tests_msgqueue_send(msgqueue, sent);
+		receive_info_result_t recv_ret =
+			tests_msgqueue_receive(msgqueue, &seq);
+		if ((send_ret.e != OK) || (recv_ret.e != OK) ||
+		    (seq != (sent - half))) {
+			panic("Msgqueue wraparound failed");
+		}
+		sent++;
+	}
+
+	msgqueue_flush_queue(msgqueue);
+	if (msgqueue_get_count(msgqueue) != 0U) {
+		panic("Msgqueue flush failed");
+	}
+}
+
+static void
+tests_msgqueue_batch_init(msgqueue_batch_entry_t *entries, count_t *seqs,
+			  count_t base)
+{
+	for (index_t i = 0U; i < MSGQUEUE_MAX_BATCH; i++) {
+		seqs[i]		= base + i;
+		entries[i].data = (user_ptr_t)&seqs[i];
+		entries[i].size = sizeof(seqs[i]);
+	}
+}
+
+static void
+tests_msgqueue_batch_check(const msgqueue_batch_entry_t *entries,
+			   const count_t *seqs, count_t count, count_t base)
+{
+	for (index_t i = 0U; i < count; i++) {
+		if ((entries[i].size != sizeof(seqs[i])) ||
+		    (seqs[i] != (base + i))) {
+			panic("Msgqueue batch received a bad message");
+		}
+	}
+}
+
+// Send and receive batches that only partly fit, and batches with a bad
+// entry, checking the counts, the more results and the errors.
+static void
+tests_msgqueue_batch(msgqueue_t *msgqueue)
+{
+	msgqueue_batch_entry_t	     entries[MSGQUEUE_MAX_BATCH];
+	count_t			     seqs[MSGQUEUE_MAX_BATCH];
+	msgqueue_batch_info_result_t ret;
+
+	count_t depth = msgqueue->queue_depth;
+	count_t first = 3U;
+
+	static_assert(MSGQUEUE_TEST_DEPTH < MSGQUEUE_MAX_BATCH,
+		      "Msgqueue batch tests must overfill the queue");
+
+	tests_msgqueue_batch_init(entries, seqs, 0U);
+	ret = msgqueue_send_batch(msgqueue, entries, MSGQUEUE_MAX_BATCH, false,
+				  true);
+	if ((ret.e != OK) || (ret.r.count != depth) || ret.r.more) {
+		panic("Msgqueue batch send did not stop when full");
+	}
+
+	ret = msgqueue_send_batch(msgqueue, entries, 1U, false, true);
+	if ((ret.e != ERROR_MSGQUEUE_FULL) || (ret.r.count != 0U) ||
+	    ret.r.more) {
+		panic("Msgqueue batch send to a full queue did not fail");
+	}
+
+	tests_msgqueue_batch_init(entries, seqs, ~(count_t)0U);
+	ret = msgqueue_receive_batch(msgqueue, entries, first, true);
+	if ((ret.e != OK) || (ret.r.count != first) || !ret.r.more) {
+		panic("Msgqueue batch receive failed");
+	}
+	tests_msgqueue_batch_check(entries, seqs, first, 0U);
+
+	tests_msgqueue_batch_init(entries, seqs, ~(count_t)0U);
+	ret = msgqueue_receive_batch(msgqueue, entries, MSGQUEUE_MAX_BATCH,
+				     true);
+	if ((ret.e != OK) || (ret.r.count != (depth - first)) || ret.r.more) {
+		panic("Msgqueue batch receive did not stop when empty");
+	}
+	tests_msgqueue_batch_check(entries, seqs, depth - first, first);
+
+	ret = msgqueue_receive_batch(msgqueue, entries, 1U, true);
+	if ((ret.e != ERROR_MSGQUEUE_EMPTY) || (ret.r.count != 0U) ||
+	    ret.r.more) {
+		panic("Msgqueue batch receive from empty queue did not fail");
+	}
+
+	// An oversized message stops the batch, after the messages before it
+	// have been sent.
+	tests_msgqueue_batch_init(entries, seqs, 0U);
+	entries[2].size = MSGQUEUE_TEST_MSG_SIZE + 1U;
+	ret = msgqueue_send_batch(msgqueue, entries, 4U, false, true);
+	if ((ret.e != ERROR_ARGUMENT_SIZE) || (ret.r.count != 2U) ||
+	    (msgqueue_get_count(msgqueue) != 2U)) {
+		panic("Msgqueue batch send did not stop at a bad entry");
+	}
+
+	// A buffer that is too small stops the batch, leaving its message in
+	// the queue.
+	tests_msgqueue_batch_init(entries, seqs, ~(count_t)0U);
+	entries[1].size = 1U;
+	ret = msgqueue_receive_batch(msgqueue, entries, 2U, true);
+	if ((ret.e != ERROR_ARGUMENT_SIZE) || (ret.r.count != 1U) ||
+	    (msgqueue_get_count(msgqueue) != 1U)) {
+		panic("Msgqueue batch receive did not stop at a bad entry");
+	}
+	tests_msgqueue_batch_check(entries, seqs, 1U, 0U);
+
+	msgqueue_flush_queue(msgqueue);
+}
+
+static error_t
+tests_msgqueue_free_range(paddr_t base, size_t size, void *arg)
+{
+	paddr_t *phys_base = (paddr_t *)arg;
+
+	if ((*phys_base == ~(paddr_t)0U) && (size >= MSGQUEUE_TEST_SHM_SIZE) &&
+	    util_is_baligned(base, PGTABLE_VM_PAGE_SIZE)) {
+		*phys_base = base;
+	}
+
+	return OK;
+}
+
+static memextent_t *
+tests_msgqueue_create_memextent(void)
+{
+	paddr_t phys_base = ~(paddr_t)0U;
+
+	error_t err = memdb_walk((uintptr_t)partition_get_root(),
+				 MEMDB_TYPE_PARTITION,
+				 tests_msgqueue_free_range, &phys_base);
+	if ((err != OK) || (phys_base == ~(paddr_t)0U)) {
+		panic("No free range for msgqueue shared memory tests");
+	}
+
+	memextent_create_t     params = { 0 };
+	memextent_ptr_result_t me_ret =
+		partition_allocate_memextent(partition_get_root(), params);
+	if (me_ret.e != OK) {
+		panic("Failed creation of new mem extent");
+	}
+	memextent_t *me = me_ret.r;
+
+	spinlock_acquire(&me->header.lock);
+	memextent_attrs_t attrs = memextent_attrs_default();
+	memextent_attrs_set_access(&attrs, PGTABLE_ACCESS_RW);
+	memextent_attrs_set_memtype(&attrs, MEMEXTENT_MEMTYPE_ANY);
+	err = memextent_configure(me, phys_base, MSGQUEUE_TEST_SHM_SIZE, attrs);
+	spinlock_release(&me->header.lock);
+	if (err != OK) {
+		panic("Failed configuration of new mem extent");
+	}
+
+	if (object_activate_memextent(me) != OK) {
+		panic("Failed activation of new mem extent");
+	}
+
+	return me;
+}
+
+static bool_result_t
+tests_msgqueue_shm_send(msgqueue_t *msgqueue, size_t size)
+{
+	kernel_or_gvaddr_t msg;
+	msg.guest_addr = 0U;
+
+	return msgqueue_send_msg(msgqueue, size, msg, false, false);
+}
+
+static receive_info_result_t
+tests_msgqueue_shm_receive(msgqueue_t *msgqueue)
+{
+	kernel_or_gvaddr_t buffer;
+	buffer.guest_addr = 0U;
+
+	return msgqueue_receive_msg(msgqueue, buffer, MSGQUEUE_TEST_MSG_SIZE,
+				    false);
+}
+
+// Check that a shared memory queue publishes its indices and sizes in the
+// shared header, and that it does not trust the sizes read back from it.
+static void
+tests_msgqueue_shm(void)
+{
+	memextent_t *me	      = tests_msgqueue_create_memextent();
+	msgqueue_t  *msgqueue = tests_msgqueue_allocate(partition_get_root());
+
+	if (tests_msgqueue_configure(msgqueue, MSGQUEUE_TEST_DEPTH, true,
+				     true) != OK) {
+		panic("Failed shared msgqueue configuration");
+	}
+
+	spinlock_acquire(&msgqueue->header.lock);
+	error_t err = msgqueue_configure_shm(msgqueue, me);
+	spinlock_release(&msgqueue->header.lock);
+	if ((err != OK) || (object_activate_msgqueue(msgqueue) != OK)) {
+		panic("Failed shared msgqueue activation");
+	}
+
+	msgqueue_shm_header_t *shm = msgqueue->shm;
+
+	// Messages are written in place, so a buffer must not be given.
+	kernel_or_gvaddr_t msg;
+	msg.kernel_addr	  = (uintptr_t)&err;
+	bool_result_t ret = msgqueue_send_msg(msgqueue, sizeof(err), msg,
+					      false, true);
+	if (ret.e != ERROR_ARGUMENT_INVALID) {
+		panic("Shared msgqueue accepted a kernel buffer");
+	}
+
+	ret = tests_msgqueue_shm_send(msgqueue, 0U);
+	if (ret.e != ERROR_ARGUMENT_SIZE) {
+		panic("Shared msgqueue accepted an empty message");
+	}
+
+	for (count_t i = 0U; i < MSGQUEUE_TEST_DEPTH; i++) {
+		ret = tests_msgqueue_shm_send(msgqueue, i + 1U);
+		if ((ret.e != OK) ||
+		    (atomic_load_relaxed(&shm->tail) != (i + 1U)) ||
+		    (atomic_load_relaxed(&shm->size[i]) != (i + 1U))) {
+			panic("Shared msgqueue send failed");
+		}
+	}
+
+	receive_info_result_t recv_ret = tests_msgqueue_shm_receive(msgqueue);
+	if ((recv_ret.e != OK) || (recv_ret.r.size != 1U) ||
+	    (atomic_load_relaxed(&shm->head) != 1U)) {
+		panic("Shared msgqueue receive failed");
+	}
+
+	// A corrupted size is clamped to the slot size.
+	atomic_store_relaxed(&shm->size[1], ~(count_t)0U);
+	recv_ret = tests_msgqueue_shm_receive(msgqueue);
+	if ((recv_ret.e != OK) ||
+	    (recv_ret.r.size != MSGQUEUE_TEST_MSG_SIZE)) {
+		panic("Shared msgqueue did not clamp a corrupted size");
+	}
+
+	// Batches are written and read in place too.
+	msgqueue_batch_entry_t entries[MSGQUEUE_TEST_DEPTH] = { 0 };
+	for (index_t i = 0U; i < MSGQUEUE_TEST_DEPTH; i++) {
+		entries[i].size = MSGQUEUE_TEST_MSG_SIZE;
+	}
+
+	msgqueue_batch_info_result_t batch_ret = msgqueue_receive_batch(
+		msgqueue, entries, MSGQUEUE_TEST_DEPTH, false);
+	if ((batch_ret.e != OK) ||
+	    (batch_ret.r.count != (MSGQUEUE_TEST_DEPTH - 2U)) ||
+	    (entries[0].size != 3U) ||
+	    (atomic_load_relaxed(&shm->head) != MSGQUEUE_TEST_DEPTH)) {
+		panic("Shared msgqueue batch receive failed");
+	}
+
+	batch_ret = msgqueue_send_batch(msgqueue, entries, 2U, false, false);
+	if ((batch_ret.e != OK) || (batch_ret.r.count != 2U) ||
+	    (atomic_load_relaxed(&shm->tail) != (MSGQUEUE_TEST_DEPTH + 2U))) {
+		panic("Shared msgqueue batch send failed");
+	}
+
+	msgqueue_flush_queue(msgqueue);
+	if ((msgqueue_get_count(msgqueue) != 0U) ||
+	    (atomic_load_relaxed(&shm->head) != (MSGQUEUE_TEST_DEPTH + 2U))) {
+		panic("Shared msgqueue flush failed");
+	}
+
+	object_put_msgqueue(msgqueue);
+	object_put_memextent(me);
+}
+
+static void
+tests_msgqueue_serial(void)
+{
+	msgqueue_t *msgqueue;
+
+	// Messages that are too large for the slots must be rejected.
+	uint8_t		   big[MSGQUEUE_TEST_MSG_SIZE + 1U] = { 0 };
+	kernel_or_gvaddr_t msg;
+	msg.kernel_addr = (uintptr_t)big;
+
+	bool_result_t ret = msgqueue_send_msg(test_msgqueue_spsc, sizeof(big),
+					      msg, false, true);
+	if ((ret.e != ERROR_ARGUMENT_SIZE) ||
+	    (msgqueue_get_count(test_msgqueue_spsc) != 0U)) {
+		panic("Msgqueue accepted an oversized message");
+	}
+
+	// SPSC depths must be a power of two.
+	msgqueue = tests_msgqueue_allocate(partition_get_private());
+	if (tests_msgqueue_configure(msgqueue, MSGQUEUE_TEST_DEPTH - 1U, true,
+				     false) != ERROR_ARGUMENT_INVALID) {
+		panic("Msgqueue accepted a non power of 2 SPSC depth");
+	}
+	object_put_msgqueue(msgqueue);
+
+	tests_msgqueue_fill_drain(test_msgqueue_locked, 0U);
+	tests_msgqueue_wraparound(test_msgqueue_locked);
+	tests_msgqueue_fill_drain(test_msgqueue_locked, 100U);
+
+	tests_msgqueue_batch(test_msgqueue_locked);
+
+	tests_msgqueue_fill_drain(test_msgqueue_spsc, 0U);
+	tests_msgqueue_wraparound(test_msgqueue_spsc);
+	tests_msgqueue_batch(test_msgqueue_spsc);
+
+	// Move the free running SPSC indices to just before they overflow,
+	// and check that the messages stay in order as they wrap.
+	msgqueue = test_msgqueue_spsc;
+	atomic_store_relaxed(&msgqueue->spsc_head, (count_t)-3);
+	atomic_store_relaxed(&msgqueue->spsc_tail, (count_t)-3);
+	tests_msgqueue_fill_drain(msgqueue, 200U);
+	tests_msgqueue_wraparound(msgqueue);
+
+	tests_msgqueue_shm();
+}
+
+// Stream messages from one CPU to another through the SPSC queue, checking
+// that none are lost, duplicated or reordered.
+static void
+tests_msgqueue_stream(cpu_index_t cpu)
+{
+	msgqueue_t *msgqueue = test_msgqueue_spsc;
+
+	if (cpu == 0U) {
+		for (count_t i = 0U; i < MSGQUEUE_TEST_ITERATIONS; i++) {
+			bool_result_t ret = tests_msgqueue_send(msgqueue, i);
+			while (ret.e == ERROR_MSGQUEUE_FULL) {
+				asm_yield();
+				ret = tests_msgqueue_send(msgqueue, i);
+			}
+			if (ret.e != OK) {
+				panic("Msgqueue stream send failed");
+			}
+		}
+	} else if (cpu == 1U) {
+		for (count_t i = 0U; i < MSGQUEUE_TEST_ITERATIONS; i++) {
+			count_t		      seq = 0U;
+			receive_info_result_t ret =
+				tests_msgqueue_receive(msgqueue, &seq);
+			while (ret.e == ERROR_MSGQUEUE_EMPTY) {
+				asm_yield();
+				ret = tests_msgqueue_receive(msgqueue, &seq);
+			}
+			if ((ret.e != OK) || (seq != i)) {
+				panic("Msgqueue stream receive failed");
+			}
+		}
+	} else {
+		// Nothing to do.
+	}
+}
+
+bool
+tests_msgqueue_start(void)
+{
+	cpu_index_t cpu = cpulocal_get_index();
+
+	if (cpu == 0U) {
+		LOG(DEBUG, INFO, "Msgqueue tests start");
+		tests_msgqueue_serial();
+	}
+
+	tests_msgqueue_sync(1U);
+
+	if (PLATFORM_MAX_CORES > 1U) {
+		tests_msgqueue_stream(cpu);
+	}
+
+	tests_msgqueue_sync(2U);
+
+	if (cpu == 0U) {
+		if (msgqueue_get_count(test_msgqueue_spsc) != 0U) {
+			panic("Msgqueue stream left messages behind");
+		}
+
+		object_put_msgqueue(test_msgqueue_locked);
+		object_put_msgqueue(test_msgqueue_spsc);
+
+		LOG(DEBUG, INFO, "Msgqueue tests finished");
+	}
+
+	return false;
+}
+#else
+
+extern char unused;
+
+#endif
@@ -5,6 +5,40 @@
 #include <assert.h>
 #include <hyptypes.h>
 
+#include <atomic.h>
+#include <util.h>
+
+#include "addrspace_vmmio.h"
+
+static_assert(util_is_p2(ADDRSPACE_VMMIO_RING_ENTRIES),
+	      "VMMIO ring size must be a power of two");
+
+bool
+addrspace_vmmio_ring_append(addrspace_vmmio_ring_t *ring, count_t *tail,
+			    vmaddr_t ipa, size_t access_size, register_t value)
+{
+	bool ret = false;
+
+	// The head is written by the VMM, so it is not trusted; a bad value
+	// can only make the ring appear full. The tail is never read back.
+	count_t head = atomic_load_acquire(&ring->head);
+
+	if ((count_t)(*tail - head) < ADDRSPACE_VMMIO_RING_ENTRIES) {
+		addrspace_vmmio_ring_entry_t *entry =
+			&ring->entries[*tail % ADDRSPACE_VMMIO_RING_ENTRIES];
+
+		entry->ipa   = ipa;
+		entry->value = value;
+		entry->size  = access_size;
+
+		(*tail)++;
+		atomic_store_release(&ring->tail, *tail);
+		ret = true;
+	}
+
+	return ret;
+}
+
 #if defined(INTERFACE_VCPU_RUN)
 #include <gpt.h>
 #include <rcu.h>
@@ -15,6 +49,36 @@
 
 #include "event_handlers.h"
 
+bool
+addrspace_handle_gpt_values_equal(gpt_value_t x, gpt_value_t y)
+{
+	return x.vmmio_range_base == y.vmmio_range_base;
+}
+
+// Append a write to the address space's VMMIO ring. Returns false if there is
+// no ring or it is full, in which case the write must be forwarded to the VMM
+// directly.
+//
+// The VMM must consume the ring before handling any forwarded access, so
+// writes are seen by it in order.
+static bool
+addrspace_vmmio_ring_write(addrspace_t *addrspace, vmaddr_t ipa,
+			   size_t access_size, register_t value)
+{
+	bool			ret  = false;
+	addrspace_vmmio_ring_t *ring = addrspace->vmmio_ring;
+
+	if (ring != NULL) {
+		spinlock_acquire_nopreempt(&addrspace->vmmio_ring_lock);
+		ret = addrspace_vmmio_ring_append(ring,
+						  &addrspace->vmmio_ring_tail,
+						  ipa, access_size, value);
+		spinlock_release_nopreempt(&addrspace->vmmio_ring_lock);
+	}
+
+	return ret;
+}
+
 vcpu_trap_result_t
 addrspace_handle_vdevice_access_fixed_addr(vmaddr_t ipa, size_t access_size,
 					   register_t *value, bool is_write)
@@ -36,8 +100,15 @@ addrspace_handle_vdevice_access_fixed_addr(vmaddr_t ipa, size_t access_size,
 			gpt_lookup(&addrspace->vmmio_ranges, ipa, access_size);
 		rcu_read_finish();
 
-		if ((result.size == access_size) &&
-		    (result.entry.type == GPT_TYPE_VMMIO_RANGE)) {
+		if ((result.size == access_size) && is_write &&
+		    (result.entry.type == GPT_TYPE_VMMIO_RANGE_COALESCED) &&
+		    addrspace_vmmio_ring_write(addrspace, ipa, access_size,
+					       *value)) {
+			ret = VCPU_TRAP_RESULT_EMULATED;
+		} else if ((result.size == access_size) &&
+			   ((result.entry.type == GPT_TYPE_VMMIO_RANGE) ||
+			    (result.entry.type ==
+			     GPT_TYPE_VMMIO_RANGE_COALESCED))) {
 			current->addrspace_vmmio_access_ipa  = ipa;
 			current->addrspace_vmmio_access_size = access_size;
 			current->addrspace_vmmio_access_value =
@@ -0,0 +1,19 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Check the entries of an addrspace_map_batch or addrspace_unmap_batch call,
+// after they have been copied from the caller. If an entry is invalid, its
+// index is returned in count.
+error_t
+addrspace_batch_check(const addrspace_map_batch_entry_t *batch,
+		      count_t num_entries, bool map, count_t *count);
+
+// Apply checked batch entries in order, looking up their memory extents in the
+// given cspace. This stops at the first entry that fails, or after any entry if
+// the caller has a pending wakeup, in which case ERROR_RETRY is returned. The
+// number of entries that were completed is returned in count.
+error_t
+addrspace_batch_apply(cspace_t *cspace, addrspace_t *addrspace,
+		      const addrspace_map_batch_entry_t *batch,
+		      count_t num_entries, bool map, count_t *count);
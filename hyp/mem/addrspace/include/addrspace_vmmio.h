@@ -0,0 +1,10 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Append a write to a VMMIO ring, given the hypervisor's copy of its tail,
+// which is updated. Returns false if the ring is full. The caller must
+// serialise appends to the ring.
+bool
+addrspace_vmmio_ring_append(addrspace_vmmio_ring_t *ring, count_t *tail,
+			    vmaddr_t ipa, size_t access_size, register_t value);
@@ -241,10 +241,17 @@ addrspace_handle_object_create_addrspace(addrspace_create_t params)
 	gpt_config_set_max_bits(&gpt_config, GPT_MAX_SIZE_BITS);
 	gpt_config_set_rcu_read(&gpt_config, true);
 	ret = gpt_init(&addrspace->vmmio_ranges, addrspace->header.partition,
-		       gpt_config, util_bit(GPT_TYPE_VMMIO_RANGE));
+		       gpt_config,
+		       util_bit(GPT_TYPE_VMMIO_RANGE) |
+			       util_bit(GPT_TYPE_VMMIO_RANGE_COALESCED));
 	if (ret != OK) {
 		goto out;
 	}
+
+	spinlock_init(&addrspace->vmmio_ring_lock);
+	addrspace->vmmio_ring_me   = NULL;
+	addrspace->vmmio_ring	   = NULL;
+	addrspace->vmmio_ring_tail = 0U;
 #endif
 
 	addrspace->info_area.ipa = VMADDR_INVALID;
@@ -283,6 +290,26 @@ addrspace_handle_object_cleanup_addrspace(addrspace_t *addrspace)
 
 #if defined(INTERFACE_VCPU_RUN)
 	gpt_destroy(&addrspace->vmmio_ranges);
+
+	partition_t *partition = addrspace->header.partition;
+
+	if (addrspace->vmmio_ring != NULL) {
+		memextent_detach(partition, addrspace->vmmio_ring_me);
+
+		virt_range_t range = {
+			.base = (uintptr_t)addrspace->vmmio_ring,
+			.size = util_balign_up(sizeof(*addrspace->vmmio_ring),
+					       PGTABLE_HYP_PAGE_SIZE),
+		};
+		hyp_aspace_deallocate(partition, range);
+
+		addrspace->vmmio_ring = NULL;
+	}
+
+	if (addrspace->vmmio_ring_me != NULL) {
+		object_put_memextent(addrspace->vmmio_ring_me);
+		addrspace->vmmio_ring_me = NULL;
+	}
 #endif
 
 	if (addrspace->hyp_va_range.size != 0U) {
@@ -359,6 +386,73 @@ out:
 	return ret;
 }
 
+error_t
+addrspace_configure_vmmio_ring(addrspace_t *addrspace, memextent_t *ring_me)
+{
+	error_t ret;
+
+	assert(addrspace != NULL);
+	assert(ring_me != NULL);
+
+#if defined(INTERFACE_VCPU_RUN)
+	if (ring_me->size < sizeof(addrspace_vmmio_ring_t)) {
+		ret = ERROR_ARGUMENT_SIZE;
+		goto out;
+	}
+
+	if ((ring_me->type != MEMEXTENT_TYPE_BASIC) ||
+	    (!pgtable_access_check(ring_me->access, PGTABLE_ACCESS_RW)) ||
+	    (ring_me->memtype != MEMEXTENT_MEMTYPE_ANY)) {
+		ret = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	if (addrspace->vmmio_ring_me != NULL) {
+		object_put_memextent(addrspace->vmmio_ring_me);
+	}
+	addrspace->vmmio_ring_me = object_get_memextent_additional(ring_me);
+	ret			 = OK;
+out:
+#else // !INTERFACE_VCPU_RUN
+	(void)addrspace;
+	(void)ring_me;
+	ret = ERROR_UNIMPLEMENTED;
+#endif
+	return ret;
+}
+
+#if defined(INTERFACE_VCPU_RUN)
+static error_t
+addrspace_activate_vmmio_ring(addrspace_t *addrspace)
+{
+	error_t	     ret;
+	partition_t *partition = addrspace->header.partition;
+
+	size_t size = util_balign_up(sizeof(*addrspace->vmmio_ring),
+				     PGTABLE_HYP_PAGE_SIZE);
+
+	virt_range_result_t range = hyp_aspace_allocate(size);
+	if (range.e != OK) {
+		ret = range.e;
+		goto out;
+	}
+
+	ret = memextent_attach(partition, addrspace->vmmio_ring_me,
+			       range.r.base, sizeof(*addrspace->vmmio_ring));
+	if (ret != OK) {
+		hyp_aspace_deallocate(partition, range.r);
+		goto out;
+	}
+
+	addrspace->vmmio_ring = (addrspace_vmmio_ring_t *)range.r.base;
+	(void)memset_s(addrspace->vmmio_ring, sizeof(*addrspace->vmmio_ring),
+		       0, sizeof(*addrspace->vmmio_ring));
+
+out:
+	return ret;
+}
+#endif
+
 error_t
 addrspace_handle_object_activate_addrspace(addrspace_t *addrspace)
 {
@@ -381,6 +475,16 @@ addrspace_handle_object_activate_addrspace(addrspace_t *addrspace)
 		goto out_vmid_dealloc;
 	}
 
+#if defined(INTERFACE_VCPU_RUN)
+	if (addrspace->vmmio_ring_me != NULL) {
+		// If this fails, the ring is released by the cleanup handler.
+		ret = addrspace_activate_vmmio_ring(addrspace);
+		if (ret != OK) {
+			goto out_vmid_dealloc;
+		}
+	}
+#endif
+
 	if (addrspace->info_area.me != NULL) {
 		vmaddr_t  ipa  = addrspace->info_area.ipa;
 		uintptr_t va   = (uintptr_t)addrspace->info_area.hyp_va;
@@ -603,7 +707,8 @@ out:
 }
 
 error_t
-addrspace_add_vmmio_range(addrspace_t *addrspace, vmaddr_t base, size_t size)
+addrspace_add_vmmio_range(addrspace_t *addrspace, vmaddr_t base, size_t size,
+			  bool coalesce)
 {
 	error_t ret;
 
@@ -626,7 +731,8 @@ addrspace_add_vmmio_range(addrspace_t *addrspace, vmaddr_t base, size_t size)
 	}
 
 	gpt_entry_t entry = (gpt_entry_t){
-		.type			= GPT_TYPE_VMMIO_RANGE,
+		.type = coalesce ? GPT_TYPE_VMMIO_RANGE_COALESCED
+				 : GPT_TYPE_VMMIO_RANGE,
 		.value.vmmio_range_base = base,
 	};
 
@@ -643,13 +749,15 @@ out:
 	(void)addrspace;
 	(void)base;
 	(void)size;
+	(void)coalesce;
 	ret = ERROR_UNIMPLEMENTED;
 #endif
 	return ret;
 }
 
 error_t
-addrspace_remove_vmmio_range(addrspace_t *addrspace, vmaddr_t base, size_t size)
+addrspace_remove_vmmio_range(addrspace_t *addrspace, vmaddr_t base, size_t size,
+			     bool coalesce)
 {
 	error_t ret;
 
@@ -667,7 +775,8 @@ addrspace_remove_vmmio_range(addrspace_t *addrspace, vmaddr_t base, size_t size)
 	spinlock_acquire(&addrspace->vmmio_range_lock);
 
 	gpt_entry_t entry = (gpt_entry_t){
-		.type			= GPT_TYPE_VMMIO_RANGE,
+		.type = coalesce ? GPT_TYPE_VMMIO_RANGE_COALESCED
+				 : GPT_TYPE_VMMIO_RANGE,
 		.value.vmmio_range_base = base,
 	};
 
@@ -684,6 +793,7 @@ out:
 	(void)addrspace;
 	(void)base;
 	(void)size;
+	(void)coalesce;
 	ret = ERROR_UNIMPLEMENTED;
 #endif
 	return ret;
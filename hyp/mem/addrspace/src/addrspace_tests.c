@@ -0,0 +1,332 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#if defined(UNIT_TESTS)
+
+#include <assert.h>
+#include <hyptypes.h>
+#include <string.h>
+
+#include <addrspace.h>
+#include <atomic.h>
+#include <cpulocal.h>
+#include <cspace.h>
+#include <log.h>
+#include <memdb.h>
+#include <memextent.h>
+#include <object.h>
+#include <panic.h>
+#include <partition.h>
+#include <partition_alloc.h>
+#include <pgtable.h>
+#include <rcu.h>
+#include <spinlock.h>
+#include <trace.h>
+#include <util.h>
+
+#include "addrspace_batch.h"
+#if defined(ARCH_ARM)
+#include "addrspace_vmmio.h"
+#endif
+#include "event_handlers.h"
+
+#define TEST_BATCH_EXTENTS 2U
+#define TEST_BATCH_SIZE	   PGTABLE_VM_PAGE_SIZE
+
+static addrspace_t *test_addrspace;
+static cspace_t	   *test_cspace;
+
+void
+tests_addrspace_init(void)
+{
+	error_t err;
+
+	addrspace_create_t     as_params = { NULL };
+	addrspace_ptr_result_t as_ret =
+		partition_allocate_addrspace(partition_get_root(), as_params);
+	if (as_ret.e != OK) {
+		panic("Failed address space creation");
+	}
+	test_addrspace = as_ret.r;
+
+	spinlock_acquire(&test_addrspace->header.lock);
+	// Dummy vmid
+	err = addrspace_configure(test_addrspace, 67U);
+	spinlock_release(&test_addrspace->header.lock);
+	if (err != OK) {
+		panic("Failed addrspace configuration");
+	}
+
+	if (object_activate_addrspace(test_addrspace) != OK) {
+		panic("Failed addrspace activation");
+	}
+
+	cspace_create_t	    cs_params = { NULL };
+	cspace_ptr_result_t cs_ret =
+		partition_allocate_cspace(partition_get_private(), cs_params);
+	if (cs_ret.e != OK) {
+		panic("Failed cspace creation");
+	}
+	test_cspace = cs_ret.r;
+
+	spinlock_acquire(&test_cspace->header.lock);
+	err = cspace_configure(test_cspace, TEST_BATCH_EXTENTS);
+	spinlock_release(&test_cspace->header.lock);
+	if (err != OK) {
+		panic("Failed cspace configuration");
+	}
+
+	if (object_activate_cspace(test_cspace) != OK) {
+		panic("Failed cspace activation");
+	}
+}
+
+static error_t
+tests_addrspace_free_range(paddr_t base, size_t size, void *arg)
+{
+	paddr_t *phys_base = (paddr_t *)arg;
+
+	if ((*phys_base == ~(paddr_t)0U) &&
+	    (size >= (TEST_BATCH_EXTENTS * TEST_BATCH_SIZE))) {
+		*phys_base = base;
+	}
+
+	return OK;
+}
+
+static cap_id_t
+tests_addrspace_create_memextent(paddr_t phys_base)
+{
+	memextent_create_t     params = { 0 };
+	memextent_ptr_result_t me_ret =
+		partition_allocate_memextent(partition_get_root(), params);
+	if (me_ret.e != OK) {
+		panic("Failed creation of new mem extent");
+	}
+	memextent_t *me = me_ret.r;
+
+	spinlock_acquire(&me->header.lock);
+	memextent_attrs_t attrs = memextent_attrs_default();
+	memextent_attrs_set_access(&attrs, PGTABLE_ACCESS_RW);
+	memextent_attrs_set_memtype(&attrs, MEMEXTENT_MEMTYPE_ANY);
+	me_ret.e = memextent_configure(me, phys_base, TEST_BATCH_SIZE, attrs);
+	spinlock_release(&me->header.lock);
+	if (me_ret.e != OK) {
+		panic("Failed configuration of new mem extent");
+	}
+
+	if (object_activate_memextent(me) != OK) {
+		panic("Failed activation of new mem extent");
+	}
+
+	object_ptr_t	obj	= { .memextent = me };
+	cap_id_result_t cap_ret = cspace_create_master_cap(
+		test_cspace, obj, OBJECT_TYPE_MEMEXTENT);
+	if (cap_ret.e != OK) {
+		panic("Failed creation of mem extent cap");
+	}
+
+	return cap_ret.r;
+}
+
+// Map and unmap a batch whose last entry fails. The entries before the
+// failure must be applied, and counted, and not rolled back.
+static void
+tests_addrspace_batch(paddr_t phys_base)
+{
+	error_t err;
+	count_t count;
+
+	addrspace_map_batch_entry_t batch[TEST_BATCH_EXTENTS + 1U] = { 0 };
+
+	memextent_mapping_attrs_t map_attrs = memextent_mapping_attrs_default();
+	memextent_mapping_attrs_set_user_access(&map_attrs, PGTABLE_ACCESS_RW);
+	memextent_mapping_attrs_set_kernel_access(&map_attrs,
+						  PGTABLE_ACCESS_RW);
+	memextent_mapping_attrs_set_memtype(&map_attrs,
+					    PGTABLE_VM_MEMTYPE_DEVICE_NGNRNE);
+
+	for (index_t i = 0U; i < TEST_BATCH_EXTENTS; i++) {
+		paddr_t phys = phys_base + ((paddr_t)i * TEST_BATCH_SIZE);
+
+		batch[i].memextent = tests_addrspace_create_memextent(phys);
+		batch[i].vbase	   = phys;
+		batch[i].map_attrs = map_attrs;
+	}
+	batch[TEST_BATCH_EXTENTS].memextent = CSPACE_CAP_INVALID;
+	batch[TEST_BATCH_EXTENTS].vbase =
+		phys_base + (TEST_BATCH_EXTENTS * TEST_BATCH_SIZE);
+	batch[TEST_BATCH_EXTENTS].map_attrs = map_attrs;
+
+	// An invalid flag in any entry rejects the whole batch.
+	addrspace_map_flags_set_no_sync(&batch[1].map_flags, true);
+	count = 0U;
+	err   = addrspace_batch_check(batch, util_array_size(batch), true,
+				      &count);
+	if ((err != ERROR_ARGUMENT_INVALID) || (count != 1U)) {
+		panic("Batch check accepted an invalid entry");
+	}
+	addrspace_map_flags_set_no_sync(&batch[1].map_flags, false);
+
+	err = addrspace_batch_check(batch, util_array_size(batch), true,
+				    &count);
+	if (err != OK) {
+		panic("Batch check rejected a valid batch");
+	}
+
+	// The bad cap fails the last entry, after the others are mapped.
+	err = addrspace_batch_apply(test_cspace, test_addrspace, batch,
+				    util_array_size(batch), true, &count);
+	if ((err == OK) || (count != TEST_BATCH_EXTENTS)) {
+		panic("Batch map did not stop at the failed entry");
+	}
+	rcu_sync();
+
+	for (index_t i = 0U; i < TEST_BATCH_EXTENTS; i++) {
+		addrspace_lookup_result_t lookup = addrspace_lookup(
+			test_addrspace, batch[i].vbase, TEST_BATCH_SIZE);
+		if ((lookup.e != OK) || (lookup.r.phys != batch[i].vbase)) {
+			panic("Batch map entry was not applied");
+		}
+	}
+
+	for (index_t i = 0U; i < util_array_size(batch); i++) {
+		batch[i].map_attrs = memextent_mapping_attrs_cast(0U);
+	}
+
+	err = addrspace_batch_apply(test_cspace, test_addrspace, batch,
+				    TEST_BATCH_EXTENTS, false, &count);
+	if ((err != OK) || (count != TEST_BATCH_EXTENTS)) {
+		panic("Batch unmap failed");
+	}
+	rcu_sync();
+
+	for (index_t i = 0U; i < TEST_BATCH_EXTENTS; i++) {
+		addrspace_lookup_result_t lookup = addrspace_lookup(
+			test_addrspace, batch[i].vbase, TEST_BATCH_SIZE);
+		if (lookup.e == OK) {
+			panic("Batch unmap entry was not applied");
+		}
+
+		err = cspace_delete_cap(test_cspace, batch[i].memextent);
+		if (err != OK) {
+			panic("Failed deletion of mem extent cap");
+		}
+	}
+}
+
+#if defined(ARCH_ARM)
+static void
+tests_addrspace_vmmio_ring_append(addrspace_vmmio_ring_t *ring,
+				  count_t *tail, count_t index, bool expected)
+{
+	bool appended = addrspace_vmmio_ring_append(
+		ring, tail, (vmaddr_t)index * sizeof(uint64_t),
+		sizeof(uint64_t), index);
+	if (appended != expected) {
+		panic("VMMIO ring append did not match the ring state");
+	}
+	if (atomic_load_relaxed(&ring->tail) != *tail) {
+		panic("VMMIO ring tail was not published");
+	}
+}
+
+static void
+tests_addrspace_vmmio_ring_check(const addrspace_vmmio_ring_t *ring,
+				 count_t index)
+{
+	const addrspace_vmmio_ring_entry_t *entry =
+		&ring->entries[index % ADDRSPACE_VMMIO_RING_ENTRIES];
+
+	if ((entry->ipa != ((vmaddr_t)index * sizeof(uint64_t))) ||
+	    (entry->size != sizeof(uint64_t)) || (entry->value != index)) {
+		panic("VMMIO ring entry is wrong");
+	}
+}
+
+// Fill a VMMIO ring, then let the VMM consume half of it so the next writes
+// wrap around to the start of the ring. This is repeated with the indices
+// about to overflow. A head written by the VMM that is ahead of the tail must
+// only make the ring appear full.
+static void
+tests_addrspace_vmmio_ring(void)
+{
+	static addrspace_vmmio_ring_t ring;
+
+	const count_t entries  = ADDRSPACE_VMMIO_RING_ENTRIES;
+	const count_t half     = entries / 2U;
+	const count_t starts[] = { 0U, half, ~(count_t)0U - half };
+
+	for (index_t s = 0U; s < util_array_size(starts); s++) {
+		count_t start = starts[s];
+		count_t tail  = start;
+
+		(void)memset_s(&ring, sizeof(ring), 0, sizeof(ring));
+		atomic_init(&ring.head, start);
+		atomic_init(&ring.tail, start);
+
+		for (count_t i = start; i != (start + entries); i++) {
+			tests_addrspace_vmmio_ring_append(&ring, &tail, i,
+							  true);
+		}
+		tests_addrspace_vmmio_ring_append(&ring, &tail, 0U, false);
+		if (tail != (start + entries)) {
+			panic("VMMIO ring tail moved when full");
+		}
+
+		for (count_t i = start; i != (start + half); i++) {
+			tests_addrspace_vmmio_ring_check(&ring, i);
+		}
+		atomic_store_release(&ring.head, start + half);
+
+		for (count_t i = start + entries; i != (start + entries + half);
+		     i++) {
+			tests_addrspace_vmmio_ring_append(&ring, &tail, i,
+							  true);
+		}
+		tests_addrspace_vmmio_ring_append(&ring, &tail, 0U, false);
+
+		for (count_t i = start + half; i != (start + entries + half);
+		     i++) {
+			tests_addrspace_vmmio_ring_check(&ring, i);
+		}
+
+		atomic_store_release(&ring.head, tail + 1U);
+		tests_addrspace_vmmio_ring_append(&ring, &tail, 0U, false);
+	}
+}
+#endif
+
+bool
+tests_addrspace_start(void)
+{
+	if (cpulocal_get_index() != 0U) {
+		goto out;
+	}
+
+	LOG(DEBUG, INFO, "Addrspace batch tests start");
+
+	paddr_t phys_base = ~(paddr_t)0U;
+
+	error_t err = memdb_walk((uintptr_t)partition_get_root(),
+				 MEMDB_TYPE_PARTITION,
+				 tests_addrspace_free_range, &phys_base);
+	if ((err != OK) || (phys_base == ~(paddr_t)0U)) {
+		panic("No free range for addrspace batch tests");
+	}
+
+	tests_addrspace_batch(phys_base);
+#if defined(ARCH_ARM)
+	tests_addrspace_vmmio_ring();
+#endif
+
+	LOG(DEBUG, INFO, "Addrspace batch tests finished");
+out:
+	return false;
+}
+#else
+
+extern char unused;
+
+#endif
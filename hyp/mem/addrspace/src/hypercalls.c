@@ -20,7 +20,9 @@
 #include <spinlock.h>
 
 #include "addrspace.h"
+#include "addrspace_batch.h"
 #include "events/addrspace.h"
+#include "useraccess.h"
 
 error_t
 hypercall_addrspace_attach_thread(cap_id_t addrspace_cap, cap_id_t thread_cap)
@@ -115,25 +117,76 @@ out:
 	return err;
 }
 
-error_t
+// Arguments of a preemptible range operation on a mapping.
+typedef struct {
+	memextent_t		 *memextent;
+	addrspace_t		 *addrspace;
+	vmaddr_t		  vbase;
+	size_t			  offset;
+	memextent_mapping_attrs_t map_attrs;
+	memextent_access_attrs_t  access_attrs;
+} hypercall_addrspace_range_t;
+
+static error_t
+hypercall_addrspace_map_piece(size_t offset, size_t size, void *arg)
+{
+	hypercall_addrspace_range_t *range = (hypercall_addrspace_range_t *)arg;
+
+	return memextent_map_partial(range->memextent, range->addrspace,
+				     range->vbase + offset,
+				     range->offset + offset, size,
+				     range->map_attrs);
+}
+
+static error_t
+hypercall_addrspace_unmap_piece(size_t offset, size_t size, void *arg)
+{
+	hypercall_addrspace_range_t *range = (hypercall_addrspace_range_t *)arg;
+
+	return memextent_unmap_partial(range->memextent, range->addrspace,
+				       range->vbase + offset,
+				       range->offset + offset, size);
+}
+
+static error_t
+hypercall_addrspace_update_access_piece(size_t offset, size_t size, void *arg)
+{
+	hypercall_addrspace_range_t *range = (hypercall_addrspace_range_t *)arg;
+
+	return memextent_update_access_partial(
+		range->memextent, range->addrspace, range->vbase + offset,
+		range->offset + offset, size, range->access_attrs);
+}
+
+static bool
+hypercall_addrspace_map_flags_valid(addrspace_map_flags_t map_flags)
+{
+	// Preemptible operations are only supported for partial ranges. The
+	// memextent rejects partial ranges if its type doesn't support them.
+	return (addrspace_map_flags_get_res0_0(&map_flags) == 0U) &&
+	       (addrspace_map_flags_get_partial(&map_flags) ||
+		!addrspace_map_flags_get_preemptible(&map_flags));
+}
+
+hypercall_addrspace_map_result_t
 hypercall_addrspace_map(cap_id_t addrspace_cap, cap_id_t memextent_cap,
 			vmaddr_t vbase, memextent_mapping_attrs_t map_attrs,
 			addrspace_map_flags_t map_flags, size_t offset,
 			size_t size)
 {
-	error_t	  ret;
-	cspace_t *cspace = cspace_get_self();
+	hypercall_addrspace_map_result_t ret	= { .error = OK };
+	cspace_t			*cspace = cspace_get_self();
 
 	if ((memextent_mapping_attrs_get_res_0(&map_attrs) != 0U) ||
-	    (addrspace_map_flags_get_res0_0(&map_flags) != 0U)) {
-		ret = ERROR_ARGUMENT_INVALID;
+	    !hypercall_addrspace_map_flags_valid(map_flags)) {
+		ret.error = ERROR_ARGUMENT_INVALID;
 		goto out;
 	}
 
 	addrspace_ptr_result_t c = cspace_lookup_addrspace(
 		cspace, addrspace_cap, CAP_RIGHTS_ADDRSPACE_MAP);
 	if (compiler_unexpected(c.e != OK)) {
-		ret = c.e;
+		ret.error = c.e;
 		goto out;
 	}
 
@@ -142,20 +195,35 @@ hypercall_addrspace_map(cap_id_t addrspace_cap, cap_id_t memextent_cap,
 	memextent_ptr_result_t m = cspace_lookup_memextent(
 		cspace, memextent_cap, CAP_RIGHTS_MEMEXTENT_MAP);
 	if (compiler_unexpected(m.e != OK)) {
-		ret = m.e;
+		ret.error = m.e;
 		goto out_addrspace_release;
 	}
 
 	memextent_t *memextent = m.r;
 
-	if (addrspace_map_flags_get_partial(&map_flags)) {
-		ret = memextent_map_partial(memextent, addrspace, vbase, offset,
-					    size, map_attrs);
+	if (addrspace_map_flags_get_preemptible(&map_flags)) {
+		hypercall_addrspace_range_t range = {
+			.memextent = memextent,
+			.addrspace = addrspace,
+			.vbase	   = vbase,
+			.offset	   = offset,
+			.map_attrs = map_attrs,
+		};
+		ret.error = memextent_preempt_range(
+			vbase, size, hypercall_addrspace_map_piece, &range,
+			&ret.progress);
+	} else if (addrspace_map_flags_get_partial(&map_flags)) {
+		ret.error = memextent_map_partial(memextent, addrspace, vbase,
+						  offset, size, map_attrs);
 	} else {
-		ret = memextent_map(memextent, addrspace, vbase, map_attrs);
+		ret.error = memextent_map(memextent, addrspace, vbase,
+					  map_attrs);
 	}
 
-	if ((ret == OK) && !addrspace_map_flags_get_no_sync(&map_flags)) {
+	// A preemptible operation may have made changes before it failed or
+	// was interrupted, so it is synchronised if it made any progress.
+	if (((ret.error == OK) || (ret.progress != 0U)) &&
+	    !addrspace_map_flags_get_no_sync(&map_flags)) {
 		// Wait for completion of EL2 operations using manual lookups
 		rcu_sync();
 	}
@@ -167,23 +235,23 @@ out:
 	return ret;
 }
 
-error_t
+hypercall_addrspace_unmap_result_t
 hypercall_addrspace_unmap(cap_id_t addrspace_cap, cap_id_t memextent_cap,
 			  vmaddr_t vbase, addrspace_map_flags_t map_flags,
 			  size_t offset, size_t size)
 {
-	error_t	  ret;
-	cspace_t *cspace = cspace_get_self();
+	hypercall_addrspace_unmap_result_t ret	  = { .error = OK };
+	cspace_t			  *cspace = cspace_get_self();
 
-	if (addrspace_map_flags_get_res0_0(&map_flags) != 0U) {
-		ret = ERROR_ARGUMENT_INVALID;
+	if (!hypercall_addrspace_map_flags_valid(map_flags)) {
+		ret.error = ERROR_ARGUMENT_INVALID;
 		goto out;
 	}
 
 	addrspace_ptr_result_t c = cspace_lookup_addrspace(
 		cspace, addrspace_cap, CAP_RIGHTS_ADDRSPACE_MAP);
 	if (compiler_unexpected(c.e != OK)) {
-		ret = c.e;
+		ret.error = c.e;
 		goto out;
 	}
 
@@ -192,20 +260,33 @@ hypercall_addrspace_unmap(cap_id_t addrspace_cap, cap_id_t memextent_cap,
 	memextent_ptr_result_t m = cspace_lookup_memextent(
 		cspace, memextent_cap, CAP_RIGHTS_MEMEXTENT_MAP);
 	if (compiler_unexpected(m.e != OK)) {
-		ret = m.e;
+		ret.error = m.e;
 		goto out_addrspace_release;
 	}
 
 	memextent_t *memextent = m.r;
 
-	if (addrspace_map_flags_get_partial(&map_flags)) {
-		ret = memextent_unmap_partial(memextent, addrspace, vbase,
-					      offset, size);
+	if (addrspace_map_flags_get_preemptible(&map_flags)) {
+		hypercall_addrspace_range_t range = {
+			.memextent = memextent,
+			.addrspace = addrspace,
+			.vbase	   = vbase,
+			.offset	   = offset,
+		};
+		ret.error = memextent_preempt_range(
+			vbase, size, hypercall_addrspace_unmap_piece, &range,
+			&ret.progress);
+	} else if (addrspace_map_flags_get_partial(&map_flags)) {
+		ret.error = memextent_unmap_partial(memextent, addrspace, vbase,
+						    offset, size);
 	} else {
-		ret = memextent_unmap(memextent, addrspace, vbase);
+		ret.error = memextent_unmap(memextent, addrspace, vbase);
 	}
 
-	if ((ret == OK) && !addrspace_map_flags_get_no_sync(&map_flags)) {
+	// A preemptible operation may have made changes before it failed or
+	// was interrupted, so it is synchronised if it made any progress.
+	if (((ret.error == OK) || (ret.progress != 0U)) &&
+	    !addrspace_map_flags_get_no_sync(&map_flags)) {
 		// Wait for completion of EL2 operations using manual lookups
 		rcu_sync();
 	}
@@ -217,26 +298,26 @@ out:
 	return ret;
 }
 
-error_t
+hypercall_addrspace_update_access_result_t
 hypercall_addrspace_update_access(cap_id_t addrspace_cap,
 				  cap_id_t memextent_cap, vmaddr_t vbase,
 				  memextent_access_attrs_t access_attrs,
 				  addrspace_map_flags_t	   map_flags,
 				  size_t offset, size_t size)
 {
-	error_t	  ret;
-	cspace_t *cspace = cspace_get_self();
+	hypercall_addrspace_update_access_result_t ret	  = { .error = OK };
+	cspace_t				  *cspace = cspace_get_self();
 
 	if ((memextent_access_attrs_get_res_0(&access_attrs) != 0U) ||
-	    (addrspace_map_flags_get_res0_0(&map_flags) != 0U)) {
-		ret = ERROR_ARGUMENT_INVALID;
+	    !hypercall_addrspace_map_flags_valid(map_flags)) {
+		ret.error = ERROR_ARGUMENT_INVALID;
 		goto out;
 	}
 
 	addrspace_ptr_result_t c = cspace_lookup_addrspace(
 		cspace, addrspace_cap, CAP_RIGHTS_ADDRSPACE_MAP);
 	if (compiler_unexpected(c.e != OK)) {
-		ret = c.e;
+		ret.error = c.e;
 		goto out;
 	}
 
@@ -245,22 +326,36 @@ hypercall_addrspace_update_access(cap_id_t addrspace_cap,
 	memextent_ptr_result_t m = cspace_lookup_memextent(
 		cspace, memextent_cap, CAP_RIGHTS_MEMEXTENT_MAP);
 	if (compiler_unexpected(m.e != OK)) {
-		ret = m.e;
+		ret.error = m.e;
 		goto out_addrspace_release;
 	}
 
 	memextent_t *memextent = m.r;
 
-	if (addrspace_map_flags_get_partial(&map_flags)) {
-		ret = memextent_update_access_partial(memextent, addrspace,
-						      vbase, offset, size,
-						      access_attrs);
+	if (addrspace_map_flags_get_preemptible(&map_flags)) {
+		hypercall_addrspace_range_t range = {
+			.memextent    = memextent,
+			.addrspace    = addrspace,
+			.vbase	      = vbase,
+			.offset	      = offset,
+			.access_attrs = access_attrs,
+		};
+		ret.error = memextent_preempt_range(
+			vbase, size, hypercall_addrspace_update_access_piece,
+			&range, &ret.progress);
+	} else if (addrspace_map_flags_get_partial(&map_flags)) {
+		ret.error = memextent_update_access_partial(
+			memextent, addrspace, vbase, offset, size,
+			access_attrs);
 	} else {
-		ret = memextent_update_access(memextent, addrspace, vbase,
-					      access_attrs);
+		ret.error = memextent_update_access(memextent, addrspace, vbase,
+						    access_attrs);
 	}
 
-	if ((ret == OK) && !addrspace_map_flags_get_no_sync(&map_flags)) {
+	// A preemptible operation may have made changes before it failed or
+	// was interrupted, so it is synchronised if it made any progress.
+	if (((ret.error == OK) || (ret.progress != 0U)) &&
+	    !addrspace_map_flags_get_no_sync(&map_flags)) {
 		// Wait for completion of EL2 operations using manual lookups
 		rcu_sync();
 	}
@@ -272,6 +367,192 @@ out:
 	return ret;
 }
 
+// Read and check the entries of an addrspace_map_batch or addrspace_unmap_batch
+// call. Only NoSync may be set for the whole batch; Partial is set separately
+// for each entry. If an entry is invalid, its index is returned in count.
+static error_t
+hypercall_addrspace_batch_read(addrspace_map_batch_entry_t *batch,
+			       user_ptr_t entries, count_t num_entries,
+			       addrspace_map_flags_t map_flags, bool map,
+			       count_t *count)
+{
+	error_t err;
+
+	if ((num_entries == 0U) || (num_entries > ADDRSPACE_MAX_MAP_BATCH) ||
+	    (addrspace_map_flags_get_res0_0(&map_flags) != 0U) ||
+	    addrspace_map_flags_get_partial(&map_flags) ||
+	    addrspace_map_flags_get_preemptible(&map_flags)) {
+		err = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	size_result_t copy_ret = useraccess_copy_from_guest_va(
+		batch, ADDRSPACE_MAX_MAP_BATCH * sizeof(batch[0]),
+		(gvaddr_t)entries, num_entries * sizeof(batch[0]));
+	err = copy_ret.e;
+	if (err != OK) {
+		goto out;
+	}
+
+	err = addrspace_batch_check(batch, num_entries, map, count);
+
+out:
+	return err;
+}
+
+error_t
+addrspace_batch_check(const addrspace_map_batch_entry_t *batch,
+		      count_t num_entries, bool map, count_t *count)
+{
+	error_t err = OK;
+
+	// Check all of the entries before making any changes.
+	for (index_t i = 0U; i < num_entries; i++) {
+		addrspace_map_flags_t	  flags = batch[i].map_flags;
+		memextent_mapping_attrs_t attrs = batch[i].map_attrs;
+
+		bool attrs_valid =
+			map ? (memextent_mapping_attrs_get_res_0(&attrs) == 0U)
+			    : (memextent_mapping_attrs_raw(attrs) == 0U);
+
+		if (!attrs_valid ||
+		    (addrspace_map_flags_get_res0_0(&flags) != 0U) ||
+		    addrspace_map_flags_get_preemptible(&flags) ||
+		    addrspace_map_flags_get_no_sync(&flags)) {
+			*count = i;
+			err    = ERROR_ARGUMENT_INVALID;
+			break;
+		}
+	}
+
+	return err;
+}
+
+static error_t
+hypercall_addrspace_batch_entry(cspace_t *cspace, addrspace_t *addrspace,
+				const addrspace_map_batch_entry_t *entry,
+				bool				   map)
+{
+	error_t err;
+
+	memextent_ptr_result_t m = cspace_lookup_memextent(
+		cspace, entry->memextent, CAP_RIGHTS_MEMEXTENT_MAP);
+	if (compiler_unexpected(m.e != OK)) {
+		err = m.e;
+		goto out;
+	}
+
+	memextent_t *memextent = m.r;
+	bool	     partial   = addrspace_map_flags_get_partial(
+		      &entry->map_flags);
+
+	if (map && partial) {
+		err = memextent_map_partial(memextent, addrspace, entry->vbase,
+					    entry->offset, entry->size,
+					    entry->map_attrs);
+	} else if (map) {
+		err = memextent_map(memextent, addrspace, entry->vbase,
+				    entry->map_attrs);
+	} else if (partial) {
+		err = memextent_unmap_partial(memextent, addrspace,
+					      entry->vbase, entry->offset,
+					      entry->size);
+	} else {
+		err = memextent_unmap(memextent, addrspace, entry->vbase);
+	}
+
+	object_put_memextent(memextent);
+out:
+	return err;
+}
+
+error_t
+addrspace_batch_apply(cspace_t *cspace, addrspace_t *addrspace,
+		      const addrspace_map_batch_entry_t *batch,
+		      count_t num_entries, bool map, count_t *count)
+{
+	error_t err = OK;
+
+	*count = 0U;
+	while (*count < num_entries) {
+		err = hypercall_addrspace_batch_entry(cspace, addrspace,
+						      &batch[*count], map);
+		if (err != OK) {
+			break;
+		}
+		(*count)++;
+
+		if ((*count < num_entries) && memextent_preempt_check()) {
+			err = ERROR_RETRY;
+			break;
+		}
+	}
+
+	return err;
+}
+
+// Apply the entries of a batch in order. The completed entries are not rolled
+// back, so a single synchronisation is done for all of them.
+static hypercall_addrspace_map_batch_result_t
+hypercall_addrspace_batch(cap_id_t addrspace_cap, user_ptr_t entries,
+			  count_t num_entries, addrspace_map_flags_t map_flags,
+			  bool map)
+{
+	hypercall_addrspace_map_batch_result_t ret    = { .error = OK };
+	cspace_t			      *cspace = cspace_get_self();
+	addrspace_map_batch_entry_t	       batch[ADDRSPACE_MAX_MAP_BATCH];
+
+	ret.error = hypercall_addrspace_batch_read(
+		batch, entries, num_entries, map_flags, map, &ret.count);
+	if (ret.error != OK) {
+		goto out;
+	}
+
+	addrspace_ptr_result_t c = cspace_lookup_addrspace(
+		cspace, addrspace_cap, CAP_RIGHTS_ADDRSPACE_MAP);
+	if (compiler_unexpected(c.e != OK)) {
+		ret.error = c.e;
+		goto out;
+	}
+
+	addrspace_t *addrspace = c.r;
+
+	ret.error = addrspace_batch_apply(cspace, addrspace, batch,
+					  num_entries, map, &ret.count);
+
+	if ((ret.count != 0U) && !addrspace_map_flags_get_no_sync(&map_flags)) {
+		// Wait for completion of EL2 operations using manual lookups
+		rcu_sync();
+	}
+
+	object_put_addrspace(addrspace);
+out:
+	return ret;
+}
+
+hypercall_addrspace_map_batch_result_t
+hypercall_addrspace_map_batch(cap_id_t addrspace_cap, user_ptr_t entries,
+			      count_t num_entries,
+			      addrspace_map_flags_t map_flags)
+{
+	return hypercall_addrspace_batch(addrspace_cap, entries, num_entries,
+					 map_flags, true);
+}
+
+hypercall_addrspace_unmap_batch_result_t
+hypercall_addrspace_unmap_batch(cap_id_t addrspace_cap, user_ptr_t entries,
+				count_t num_entries,
+				addrspace_map_flags_t map_flags)
+{
+	hypercall_addrspace_map_batch_result_t ret = hypercall_addrspace_batch(
+		addrspace_cap, entries, num_entries, map_flags, false);
+
+	return (hypercall_addrspace_unmap_batch_result_t){
+		.error = ret.error,
+		.count = ret.count,
+	};
+}
+
 error_t
 hypercall_addrspace_configure(cap_id_t addrspace_cap, vmid_t vmid)
 {
@@ -420,6 +701,51 @@ out_bad_cap:
 	return err;
 }
 
+error_t
+hypercall_addrspace_configure_vmmio_ring(cap_id_t addrspace_cap,
+					 cap_id_t ring_me_cap)
+{
+	error_t	      err;
+	cspace_t     *cspace = cspace_get_self();
+	object_type_t type;
+
+	object_ptr_result_t o = cspace_lookup_object_any(
+		cspace, addrspace_cap, CAP_RIGHTS_GENERIC_OBJECT_ACTIVATE,
+		&type);
+	if (compiler_unexpected(o.e != OK)) {
+		err = o.e;
+		goto out_bad_cap;
+	}
+	if (type != OBJECT_TYPE_ADDRSPACE) {
+		err = ERROR_CSPACE_WRONG_OBJECT_TYPE;
+		goto out_addrspace_release;
+	}
+	addrspace_t *target_as = o.r.addrspace;
+
+	memextent_ptr_result_t m = cspace_lookup_memextent(
+		cspace, ring_me_cap, CAP_RIGHTS_MEMEXTENT_ATTACH);
+	if (compiler_unexpected(m.e != OK)) {
+		err = m.e;
+		goto out_addrspace_release;
+	}
+	memextent_t *ring_me = m.r;
+
+	spinlock_acquire(&target_as->header.lock);
+	if (atomic_load_relaxed(&target_as->header.state) ==
+	    OBJECT_STATE_INIT) {
+		err = addrspace_configure_vmmio_ring(target_as, ring_me);
+	} else {
+		err = ERROR_OBJECT_STATE;
+	}
+	spinlock_release(&target_as->header.lock);
+
+	object_put_memextent(ring_me);
+out_addrspace_release:
+	object_put(type, o.r);
+out_bad_cap:
+	return err;
+}
+
 error_t
 hypercall_addrspace_configure_vmmio(cap_id_t addrspace_cap, vmaddr_t vbase,
 				    size_t			   size,
@@ -445,10 +771,18 @@ hypercall_addrspace_configure_vmmio(cap_id_t addrspace_cap, vmaddr_t vbase,
 
 	switch (op) {
 	case ADDRSPACE_VMMIO_CONFIGURE_OP_ADD:
-		err = addrspace_add_vmmio_range(target_as, vbase, size);
+		err = addrspace_add_vmmio_range(target_as, vbase, size, false);
 		break;
 	case ADDRSPACE_VMMIO_CONFIGURE_OP_REMOVE:
-		err = addrspace_remove_vmmio_range(target_as, vbase, size);
+		err = addrspace_remove_vmmio_range(target_as, vbase, size,
+						   false);
+		break;
+	case ADDRSPACE_VMMIO_CONFIGURE_OP_ADD_COALESCED:
+		err = addrspace_add_vmmio_range(target_as, vbase, size, true);
+		break;
+	case ADDRSPACE_VMMIO_CONFIGURE_OP_REMOVE_COALESCED:
+		err = addrspace_remove_vmmio_range(target_as, vbase, size,
+						   true);
 		break;
 	default:
 		err = ERROR_UNIMPLEMENTED;
@@ -0,0 +1,14 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Allocate from the address-ordered freelist. The allocator lock must be held.
+void_ptr_result_t
+freelist_allocate(allocator_t *allocator, size_t size, size_t min_alignment)
+	REQUIRE_SPINLOCK(allocator->lock);
+
+// Return memory to the address-ordered freelist, coalescing it with any
+// adjacent free blocks. The allocator lock must be held.
+void
+freelist_deallocate(allocator_t *allocator, void *object, size_t size)
+	REQUIRE_SPINLOCK(allocator->lock);
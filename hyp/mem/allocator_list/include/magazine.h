@@ -0,0 +1,20 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Get the sizes of all first-class object types.
+//
+// This is generated from the first-class object list, and is used to select
+// the size classes that are cached in the per-CPU magazines. Up to max_sizes
+// entries are written to the sizes array; the number written is returned.
+count_t
+allocator_list_get_object_sizes(size_t *sizes, count_t max_sizes);
+
+// Return the cached objects of every CPU to the freelist, so they can be
+// coalesced with their neighbours or removed from the heap. This is called
+// when the freelist can't satisfy an allocation, so it is slow, but rare.
+//
+// Each CPU's cache lock is taken in turn, followed by the allocator lock, so
+// the caller must not hold either of them.
+void
+magazine_reclaim(allocator_t *allocator) REQUIRE_PREEMPT_DISABLED;
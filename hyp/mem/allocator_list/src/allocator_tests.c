@@ -0,0 +1,129 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#if defined(UNIT_TESTS)
+
+#include <assert.h>
+#include <hyptypes.h>
+
+#include <allocator.h>
+#include <atomic.h>
+#include <cpulocal.h>
+#include <panic.h>
+
+#include <asm/event.h>
+
+#include "event_handlers.h"
+
+// The object size is the smallest generic size class.
+#define TEST_HEAP_SIZE	 8192U
+#define TEST_OBJECT_SIZE 64U
+
+static uint8_t alignas(TEST_OBJECT_SIZE) test_allocator_heap[TEST_HEAP_SIZE];
+static allocator_t     test_allocator;
+static _Atomic count_t test_allocator_wait_count;
+
+void
+tests_allocator_list_init(void)
+{
+	if (allocator_init(&test_allocator) != OK) {
+		panic("Failed test allocator init");
+	}
+
+	if (allocator_heap_add_memory(&test_allocator,
+				      (uintptr_t)test_allocator_heap,
+				      sizeof(test_allocator_heap)) != OK) {
+		panic("Failed test allocator heap add");
+	}
+
+	atomic_init(&test_allocator_wait_count, 0U);
+}
+
+// Wait until every core has reached the given step.
+static void
+tests_allocator_sync(count_t step)
+{
+	(void)atomic_fetch_add_explicit(&test_allocator_wait_count, 1U,
+					memory_order_acq_rel);
+	while (asm_event_load_before_wait(&test_allocator_wait_count) <
+	       (step * PLATFORM_MAX_CORES)) {
+		asm_event_wait(&test_allocator_wait_count);
+	}
+}
+
+bool
+tests_allocator_list_start(void)
+{
+	void_ptr_result_t ret;
+	error_t		  err;
+
+	tests_allocator_sync(1U);
+
+	// The first allocation refills this core's magazine with a batch of
+	// objects. Freeing an object and allocating again must hit the
+	// magazine, returning the same object.
+	ret = allocator_allocate_object(&test_allocator, TEST_OBJECT_SIZE,
+					alignof(size_t));
+	if (ret.e != OK) {
+		panic("Failed test object allocation");
+	}
+	void *object = ret.r;
+
+	err = allocator_deallocate_object(&test_allocator, object,
+					  TEST_OBJECT_SIZE);
+	assert(err == OK);
+
+	ret = allocator_allocate_object(&test_allocator, TEST_OBJECT_SIZE,
+					alignof(size_t));
+	if ((ret.e != OK) || (ret.r != object)) {
+		panic("Test object allocation missed the magazine");
+	}
+
+	err = allocator_deallocate_object(&test_allocator, object,
+					  TEST_OBJECT_SIZE);
+	assert(err == OK);
+
+	// The magazine now holds the freed object and the rest of the batch
+	// taken by the first allocation's refill.
+	cpu_index_t cpu = cpulocal_get_index();
+	if (test_allocator.cpu_cache[cpu].cached_size !=
+	    (ALLOCATOR_MAGAZINE_BATCH * TEST_OBJECT_SIZE)) {
+		panic("Magazine cached size is wrong");
+	}
+
+	tests_allocator_sync(2U);
+
+	if (cpu == 0U) {
+		// Everything is free, but parts of the heap are cached in the
+		// magazines of every core. Removing the whole heap only
+		// succeeds if they are all reclaimed and coalesced.
+		err = allocator_heap_remove_memory(&test_allocator,
+						   test_allocator_heap,
+						   TEST_HEAP_SIZE);
+		if (err != OK) {
+			panic("Magazines were not reclaimed");
+		}
+
+		if ((test_allocator.total_size != 0U) ||
+		    (test_allocator.alloc_size != 0U)) {
+			panic("Test allocator sizes are wrong");
+		}
+
+		ret = allocator_allocate_object(&test_allocator,
+						TEST_OBJECT_SIZE,
+						alignof(size_t));
+		if (ret.e != ERROR_NOMEM) {
+			panic("Allocation from an empty heap succeeded");
+		}
+	}
+
+	tests_allocator_sync(3U);
+
+	return false;
+}
+#else
+
+extern char unused;
+
+#endif
@@ -88,10 +88,13 @@
 
 #include <allocator.h>
 #include <attributes.h>
+#include <preempt.h>
 #include <spinlock.h>
 #include <util.h>
 
 #include "event_handlers.h"
+#include "freelist.h"
+#include "magazine.h"
 
 // Maximum supported heap allocation size or alignment size. We filter out
 // really large allocations so we can avoid having to think about corner-cases
@@ -252,7 +255,7 @@ out:
 	return ret;
 }
 
-static error_t NOINLINE
+error_t NOINLINE
 allocator_heap_add_memory(allocator_t *allocator, uintptr_t addr, size_t size)
 {
 	allocator_node_t *block;
@@ -443,14 +446,13 @@ out:
 }
 
 void_ptr_result_t
-allocator_allocate_object(allocator_t *allocator, size_t size,
-			  size_t min_alignment)
+freelist_allocate(allocator_t *allocator, size_t size, size_t min_alignment)
 {
 	void_ptr_result_t ret;
 
 	size_t alignment = util_max(min_alignment, alignof(size_t));
 
-	spinlock_acquire(&allocator->lock);
+	assert_spinlock_held(&allocator->lock);
 
 	if (allocator->heap == NULL) {
 		ret = void_ptr_result_error(ERROR_NOMEM);
@@ -518,7 +520,6 @@ allocator_allocate_object(allocator_t *allocator, size_t size,
 #endif
 
 error:
-	spinlock_release(&allocator->lock);
 	return ret;
 }
 
@@ -536,18 +537,15 @@ list_remove(allocator_node_t **head, allocator_node_t *remove,
 	}
 }
 
-// TODO: Exported only for test code currently
-error_t
-allocator_heap_remove_memory(allocator_t *allocator, void *obj, size_t size);
-
-// Returns -1 if addresses are still being used and therefore cannot be freed.
-error_t NOINLINE
-allocator_heap_remove_memory(allocator_t *allocator, void *obj, size_t size)
+// Returns ERROR_ALLOCATOR_MEM_INUSE if addresses are still being used and
+// therefore cannot be freed.
+static error_t NOINLINE
+freelist_remove_memory(allocator_t *allocator, void *obj, size_t size)
+	REQUIRE_SPINLOCK(allocator->lock)
 {
 	error_t ret = ERROR_ALLOCATOR_MEM_INUSE;
 
 	assert(obj != NULL);
-	assert(allocator->heap != NULL);
 
 	allocator_node_t *previous = NULL;
 	allocator_node_t *current  = allocator->heap;
@@ -556,8 +554,6 @@ allocator_heap_remove_memory(allocator_t *allocator, void *obj, size_t size)
 	uint64_t	  previous_location;
 	uint64_t	  aligned_alloc_end;
 
-	spinlock_acquire(&allocator->lock);
-
 	size = util_balign_up(size, HEAP_MIN_ALLOC);
 
 	while (((uint64_t)obj > (uint64_t)current) && (current != NULL)) {
@@ -622,7 +618,26 @@ allocator_heap_remove_memory(allocator_t *allocator, void *obj, size_t size)
 	allocator->total_size -= size;
 
 out:
-	spinlock_release(&allocator->lock);
+	return ret;
+}
+
+error_t
+allocator_heap_remove_memory(allocator_t *allocator, void *obj, size_t size)
+{
+	error_t ret;
+
+	preempt_disable();
+
+	// Objects cached in the magazines are still counted as allocated, so
+	// return them to the freelist before looking for the range.
+	magazine_reclaim(allocator);
+
+	spinlock_acquire_nopreempt(&allocator->lock);
+	ret = freelist_remove_memory(allocator, obj, size);
+	spinlock_release_nopreempt(&allocator->lock);
+
+	preempt_enable();
+
 	return ret;
 }
 
@@ -717,13 +732,13 @@ out:
 	return;
 }
 
-error_t
-allocator_deallocate_object(allocator_t *allocator, void *object, size_t size)
+void
+freelist_deallocate(allocator_t *allocator, void *object, size_t size)
 {
 	assert(object != NULL);
 	assert(size > 0UL);
 
-	spinlock_acquire(&allocator->lock);
+	assert_spinlock_held(&allocator->lock);
 
 #if defined(DEBUG_PRINT)
 	if (allocator->heap != NULL) {
@@ -751,10 +766,6 @@ allocator_deallocate_object(allocator_t *allocator, void *object, size_t size)
 	CHECK_HEAP(allocator->heap);
 
 	allocator->alloc_size -= size;
-
-	spinlock_release(&allocator->lock);
-
-	return OK;
 }
 
 error_t
@@ -764,7 +775,60 @@ allocator_init(allocator_t *allocator)
 
 	allocator->total_size = 0UL;
 	allocator->alloc_size = 0UL;
+	(void)memset_s(allocator->cpu_cache, sizeof(allocator->cpu_cache), 0,
+		       sizeof(allocator->cpu_cache));
+	for (cpu_index_t cpu = 0U; cpu < PLATFORM_MAX_CORES; cpu++) {
+		spinlock_init(&allocator->cpu_cache[cpu].lock);
+	}
 
 	spinlock_init(&allocator->lock);
 	return OK;
 }
+
+#if defined(UNIT_TESTS)
+void *
+allocator_test_replace_heap(allocator_t *allocator, void *block, size_t size)
+{
+	allocator_node_t *node = (allocator_node_t *)block;
+
+	assert(util_is_baligned((uintptr_t)block, HEAP_MIN_ALIGN));
+	assert(util_is_baligned(size, HEAP_MIN_ALLOC));
+
+	preempt_disable();
+
+	// Return cached objects to the real heap, so everything allocated or
+	// freed until the heap is restored belongs to the replacement block.
+	magazine_reclaim(allocator);
+
+	spinlock_acquire_nopreempt(&allocator->lock);
+	void *saved	= allocator->heap;
+	*node		= (allocator_node_t){ .size = size, .next = NULL };
+	allocator->heap = node;
+	spinlock_release_nopreempt(&allocator->lock);
+
+	preempt_enable();
+
+	return saved;
+}
+
+bool
+allocator_test_restore_heap(allocator_t *allocator, void *saved, void *block,
+			    size_t size)
+{
+	preempt_disable();
+
+	// Objects cached since the heap was replaced came from the block.
+	magazine_reclaim(allocator);
+
+	spinlock_acquire_nopreempt(&allocator->lock);
+	allocator_node_t *node = allocator->heap;
+	bool intact = (node == block) && (node->size == size) &&
+		      (node->next == NULL);
+	allocator->heap = (allocator_node_t *)saved;
+	spinlock_release_nopreempt(&allocator->lock);
+
+	preempt_enable();
+
+	return intact;
+}
+#endif
@@ -0,0 +1,345 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Per-CPU magazine caches for the list allocator.
+//
+// Allocations whose size exactly matches one of a small set of size classes
+// are served from a per-CPU, per-class magazine of recently freed objects,
+// which is protected by an uncontended per-CPU lock. The freelist lock is
+// taken only to refill an empty magazine or to flush a full one, and each of
+// those operations moves a batch of objects. If the freelist runs out of
+// memory, the magazines of every CPU are flushed and the allocation retried.
+//
+// The size classes are the sizes of the first-class object types, plus a few
+// small power-of-two sizes for internal allocations. A class is only selected
+// by an exact match of the rounded allocation size, so objects allocated
+// before the class table is built can be safely freed to a magazine.
+
+#include <assert.h>
+#include <hyptypes.h>
+#include <string.h>
+
+#include <allocator.h>
+#include <compiler.h>
+#include <cpulocal.h>
+#include <preempt.h>
+#include <spinlock.h>
+#include <trace.h>
+#include <util.h>
+
+#include "event_handlers.h"
+#include "freelist.h"
+#include "magazine.h"
+
+// Sizes of the cached classes, sorted in increasing order. This is written
+// during cold boot and is read-only afterwards.
+static size_t  magazine_class_sizes[ALLOCATOR_MAX_CLASSES];
+static count_t magazine_num_classes;
+
+static void
+magazine_add_class(size_t size)
+{
+	if ((size == 0U) || (size > ALLOCATOR_MAGAZINE_MAX_SIZE)) {
+		goto out;
+	}
+
+	size_t	class_size = util_balign_up(size, sizeof(allocator_node_t));
+	index_t i	   = 0U;
+
+	while ((i < magazine_num_classes) &&
+	       (magazine_class_sizes[i] < class_size)) {
+		i++;
+	}
+
+	if ((i < magazine_num_classes) &&
+	    (magazine_class_sizes[i] == class_size)) {
+		// Already have a class of this size.
+		goto out;
+	}
+
+	// ALLOCATOR_MAX_CLASSES has room for every class we add.
+	assert(magazine_num_classes < ALLOCATOR_MAX_CLASSES);
+
+	for (index_t j = magazine_num_classes; j > i; j--) {
+		magazine_class_sizes[j] = magazine_class_sizes[j - 1U];
+	}
+	magazine_class_sizes[i] = class_size;
+	magazine_num_classes++;
+
+out:
+	return;
+}
+
+void
+allocator_list_handle_boot_cold_init(void)
+{
+	size_t	object_sizes[ALLOCATOR_MAX_CLASSES];
+	count_t num_objects = allocator_list_get_object_sizes(
+		object_sizes, (count_t)util_array_size(object_sizes));
+
+	// Object sizes take precedence over the generic classes.
+	for (index_t i = 0U; i < num_objects; i++) {
+		magazine_add_class(object_sizes[i]);
+	}
+
+	for (index_t i = 0U; i < ALLOCATOR_GENERIC_CLASSES; i++) {
+		magazine_add_class(ALLOCATOR_GENERIC_MIN_SIZE << i);
+	}
+}
+
+static bool
+magazine_get_class(size_t size, index_t *class_index)
+{
+	bool found = false;
+
+	if (size > ALLOCATOR_MAGAZINE_MAX_SIZE) {
+		goto out;
+	}
+
+	size_t	key = util_balign_up(size, sizeof(allocator_node_t));
+	index_t lo  = 0U;
+	index_t hi  = magazine_num_classes;
+
+	while (lo < hi) {
+		index_t mid = lo + ((hi - lo) / 2U);
+		if (magazine_class_sizes[mid] < key) {
+			lo = mid + 1U;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if ((lo < magazine_num_classes) && (magazine_class_sizes[lo] == key)) {
+		*class_index = lo;
+		found	     = true;
+	}
+
+out:
+	return found;
+}
+
+static allocator_cpu_cache_t *
+magazine_get_local_cache(allocator_t *allocator) REQUIRE_PREEMPT_DISABLED
+{
+	return &allocator->cpu_cache[cpulocal_get_index()];
+}
+
+static void
+magazine_push(allocator_cpu_cache_t *cache, index_t class_index,
+	      void *object) REQUIRE_SPINLOCK(cache->lock)
+{
+	allocator_magazine_t *mag  = &cache->magazines[class_index];
+	allocator_node_t     *node = (allocator_node_t *)object;
+
+	assert(mag->count < ALLOCATOR_MAGAZINE_SIZE);
+
+	node->next = mag->head;
+	mag->head  = node;
+	mag->count++;
+	cache->cached_size += magazine_class_sizes[class_index];
+}
+
+static allocator_node_t *
+magazine_pop(allocator_cpu_cache_t *cache, index_t class_index)
+	REQUIRE_SPINLOCK(cache->lock)
+{
+	allocator_magazine_t *mag  = &cache->magazines[class_index];
+	allocator_node_t     *node = mag->head;
+
+	assert(node != NULL);
+
+	mag->head = node->next;
+	mag->count--;
+	cache->cached_size -= magazine_class_sizes[class_index];
+
+	return node;
+}
+
+static void
+magazine_flush(allocator_t *allocator, allocator_cpu_cache_t *cache,
+	       index_t class_index, count_t count)
+	REQUIRE_SPINLOCK(cache->lock) REQUIRE_SPINLOCK(allocator->lock)
+{
+	allocator_magazine_t *mag	= &cache->magazines[class_index];
+	count_t		      remaining = count;
+
+	while ((remaining > 0U) && (mag->head != NULL)) {
+		allocator_node_t *node = magazine_pop(cache, class_index);
+
+		remaining--;
+		freelist_deallocate(allocator, node,
+				    magazine_class_sizes[class_index]);
+	}
+}
+
+void
+magazine_reclaim(allocator_t *allocator)
+{
+	for (cpu_index_t cpu = 0U; cpu < PLATFORM_MAX_CORES; cpu++) {
+		allocator_cpu_cache_t *cache = &allocator->cpu_cache[cpu];
+
+		spinlock_acquire_nopreempt(&cache->lock);
+		spinlock_acquire_nopreempt(&allocator->lock);
+		for (index_t i = 0U; i < magazine_num_classes; i++) {
+			magazine_flush(allocator, cache, i,
+				       cache->magazines[i].count);
+		}
+		assert(cache->cached_size == 0U);
+		spinlock_release_nopreempt(&allocator->lock);
+		spinlock_release_nopreempt(&cache->lock);
+	}
+}
+
+static void_ptr_result_t
+magazine_freelist_allocate(allocator_t *allocator, size_t size,
+			   size_t alignment) REQUIRE_PREEMPT_DISABLED
+{
+	spinlock_acquire_nopreempt(&allocator->lock);
+	void_ptr_result_t ret = freelist_allocate(allocator, size, alignment);
+	spinlock_release_nopreempt(&allocator->lock);
+
+	return ret;
+}
+
+static void_ptr_result_t
+magazine_refill(allocator_t *allocator, allocator_cpu_cache_t *cache,
+		index_t class_index, size_t alignment)
+	REQUIRE_SPINLOCK(cache->lock)
+{
+	allocator_magazine_t *mag	 = &cache->magazines[class_index];
+	size_t		      class_size = magazine_class_sizes[class_index];
+
+	spinlock_acquire_nopreempt(&allocator->lock);
+
+	void_ptr_result_t ret =
+		freelist_allocate(allocator, class_size, alignment);
+
+	// Take a batch of additional objects while we hold the lock, so the
+	// next few allocations on this CPU don't need it.
+	for (count_t i = 1U; (ret.e == OK) && (i < ALLOCATOR_MAGAZINE_BATCH) &&
+			     (mag->count < ALLOCATOR_MAGAZINE_SIZE);
+	     i++) {
+		void_ptr_result_t extra =
+			freelist_allocate(allocator, class_size, alignment);
+		if (extra.e != OK) {
+			break;
+		}
+		magazine_push(cache, class_index, extra.r);
+	}
+
+	spinlock_release_nopreempt(&allocator->lock);
+
+	TRACE(ALLOCATOR, INFO,
+	      "allocator {:#x}: refill size {:d}, hits {:d}, misses {:d}",
+	      (uintptr_t)allocator, (register_t)class_size,
+	      (register_t)mag->hits, (register_t)mag->misses);
+
+	return ret;
+}
+
+void_ptr_result_t
+allocator_allocate_object(allocator_t *allocator, size_t size,
+			  size_t min_alignment)
+{
+	void_ptr_result_t ret;
+	index_t		  class_index;
+
+	assert(size > 0UL);
+
+	preempt_disable();
+
+	if (!magazine_get_class(size, &class_index)) {
+		ret = magazine_freelist_allocate(allocator, size,
+						 min_alignment);
+		if (ret.e == ERROR_NOMEM) {
+			magazine_reclaim(allocator);
+			ret = magazine_freelist_allocate(allocator, size,
+							 min_alignment);
+		}
+		goto out;
+	}
+
+	size_t class_size = magazine_class_sizes[class_index];
+	size_t alignment  = util_max(min_alignment, alignof(size_t));
+
+	allocator_cpu_cache_t *cache = magazine_get_local_cache(allocator);
+	spinlock_acquire_nopreempt(&cache->lock);
+
+	allocator_magazine_t *mag  = &cache->magazines[class_index];
+	allocator_node_t     *node = mag->head;
+
+	// Objects of a given size are nearly always allocated with the same
+	// alignment, so a misaligned head is unusual; just treat it as a miss.
+	if (compiler_expected((node != NULL) &&
+			      util_is_baligned((uintptr_t)node, alignment))) {
+		(void)magazine_pop(cache, class_index);
+		mag->hits++;
+#if defined(ALLOCATOR_DEBUG)
+		(void)memset_s(node, class_size, 0xa5, class_size);
+#endif
+		ret = void_ptr_result_ok(node);
+	} else {
+		mag->misses++;
+		ret = magazine_refill(allocator, cache, class_index, alignment);
+	}
+
+	spinlock_release_nopreempt(&cache->lock);
+
+	if (ret.e == ERROR_NOMEM) {
+		// Objects cached on other CPUs may be enough, possibly after
+		// coalescing, to satisfy the allocation.
+		magazine_reclaim(allocator);
+		ret = magazine_freelist_allocate(allocator, class_size,
+						 alignment);
+	}
+
+out:
+	preempt_enable();
+
+	return ret;
+}
+
+error_t
+allocator_deallocate_object(allocator_t *allocator, void *object, size_t size)
+{
+	index_t class_index;
+
+	assert(object != NULL);
+	assert(size > 0UL);
+
+	if (!magazine_get_class(size, &class_index)) {
+		spinlock_acquire(&allocator->lock);
+		freelist_deallocate(allocator, object, size);
+		spinlock_release(&allocator->lock);
+		goto out;
+	}
+
+	size_t class_size = magazine_class_sizes[class_index];
+
+	preempt_disable();
+
+	allocator_cpu_cache_t *cache = magazine_get_local_cache(allocator);
+	spinlock_acquire_nopreempt(&cache->lock);
+
+	allocator_magazine_t *mag = &cache->magazines[class_index];
+
+	if (mag->count == ALLOCATOR_MAGAZINE_SIZE) {
+		spinlock_acquire_nopreempt(&allocator->lock);
+		magazine_flush(allocator, cache, class_index,
+			       ALLOCATOR_MAGAZINE_SIZE -
+				       ALLOCATOR_MAGAZINE_BATCH);
+		spinlock_release_nopreempt(&allocator->lock);
+	}
+
+#if defined(ALLOCATOR_DEBUG)
+	(void)memset_s(object, class_size, 0xe3, class_size);
+#endif
+	magazine_push(cache, class_index, object);
+
+	spinlock_release_nopreempt(&cache->lock);
+	preempt_enable();
+
+out:
+	return OK;
+}
@@ -0,0 +1,126 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#if defined(UNIT_TESTS)
+
+#include <assert.h>
+#include <hyptypes.h>
+
+#include <allocator.h>
+#include <cpulocal.h>
+#include <log.h>
+#include <panic.h>
+#include <trace.h>
+#include <util.h>
+
+#include "event_handlers.h"
+
+#define TEST_HEAP_SIZE	8192U
+#define TEST_HEAP_ALIGN 1024U
+#define TEST_BLOCK_SIZE 256U
+
+static uint8_t alignas(TEST_HEAP_ALIGN) test_allocator_heap[TEST_HEAP_SIZE];
+static allocator_t test_allocator;
+
+void
+tests_allocator_tree_init(void)
+{
+	if (allocator_init(&test_allocator) != OK) {
+		panic("Failed test allocator init");
+	}
+
+	if (allocator_heap_add_memory(&test_allocator,
+				      (uintptr_t)test_allocator_heap,
+				      sizeof(test_allocator_heap)) != OK) {
+		panic("Failed test allocator heap add");
+	}
+}
+
+static void *
+tests_allocator_tree_alloc(size_t size, size_t alignment)
+{
+	void_ptr_result_t ret =
+		allocator_allocate_object(&test_allocator, size, alignment);
+	if (ret.e != OK) {
+		panic("Failed test allocation");
+	}
+
+	return ret.r;
+}
+
+static void
+tests_allocator_tree_free(void *object, size_t size)
+{
+	error_t err = allocator_deallocate_object(&test_allocator, object, size);
+	assert(err == OK);
+}
+
+bool
+tests_allocator_tree_start(void)
+{
+	if (cpulocal_get_index() != 0U) {
+		goto out;
+	}
+
+	LOG(DEBUG, INFO, "Allocator tree tests start");
+
+	uintptr_t base = (uintptr_t)test_allocator_heap;
+
+	// Allocations are taken from the lowest address that fits.
+	void *a = tests_allocator_tree_alloc(TEST_BLOCK_SIZE, alignof(size_t));
+	void *b = tests_allocator_tree_alloc(TEST_BLOCK_SIZE, alignof(size_t));
+	void *c = tests_allocator_tree_alloc(TEST_BLOCK_SIZE, alignof(size_t));
+	if (((uintptr_t)a != base) ||
+	    ((uintptr_t)b != (base + TEST_BLOCK_SIZE)) ||
+	    ((uintptr_t)c != (base + (2U * TEST_BLOCK_SIZE)))) {
+		panic("Allocation was not address-ordered first fit");
+	}
+
+	// A smaller allocation reuses the hole left by b.
+	tests_allocator_tree_free(b, TEST_BLOCK_SIZE);
+	void *d = tests_allocator_tree_alloc(TEST_BLOCK_SIZE / 4U,
+					     alignof(size_t));
+	if (d != b) {
+		panic("Allocation did not reuse the lowest free block");
+	}
+
+	// An over-aligned allocation skips blocks that are big enough but
+	// not aligned.
+	void *e = tests_allocator_tree_alloc(TEST_BLOCK_SIZE, TEST_HEAP_ALIGN);
+	if ((uintptr_t)e != (base + TEST_HEAP_ALIGN)) {
+		panic("Aligned allocation was misplaced");
+	}
+
+	tests_allocator_tree_free(a, TEST_BLOCK_SIZE);
+	tests_allocator_tree_free(c, TEST_BLOCK_SIZE);
+	tests_allocator_tree_free(d, TEST_BLOCK_SIZE / 4U);
+	tests_allocator_tree_free(e, TEST_BLOCK_SIZE);
+
+	// All free blocks must have been coalesced again.
+	void *heap = tests_allocator_tree_alloc(TEST_HEAP_SIZE,
+						alignof(size_t));
+	if ((uintptr_t)heap != base) {
+		panic("Free blocks were not coalesced");
+	}
+
+	void_ptr_result_t ret = allocator_allocate_object(
+		&test_allocator, TEST_BLOCK_SIZE, alignof(size_t));
+	if (ret.e != ERROR_NOMEM) {
+		panic("Allocation from an exhausted heap succeeded");
+	}
+
+	tests_allocator_tree_free(heap, TEST_HEAP_SIZE);
+	if (test_allocator.alloc_size != 0U) {
+		panic("Test allocator leaked memory");
+	}
+
+	LOG(DEBUG, INFO, "Allocator tree tests finished");
+out:
+	return false;
+}
+#else
+
+extern char unused;
+
+#endif
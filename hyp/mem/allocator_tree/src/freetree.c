@@ -0,0 +1,638 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Heap allocator keeping free blocks in an address-ordered AVL tree.
+//
+// Each free block starts with an allocator_tree_node header. Every node
+// records the largest free block in its subtree, so the lowest-addressed
+// block that can satisfy an allocation is found without visiting subtrees
+// that are too small. Neighbours of a freed block are found by address, so
+// coalescing is also logarithmic in the number of free blocks.
+//
+// The tree code is iterative, with an explicit stack of the links traversed
+// from the root, as the depth is bounded by ALLOCATOR_TREE_MAX_DEPTH.
+
+#include <assert.h>
+#include <hyptypes.h>
+#include <string.h>
+
+#include <allocator.h>
+#include <attributes.h>
+#include <spinlock.h>
+#include <util.h>
+
+#include "event_handlers.h"
+
+// Maximum supported heap allocation size or alignment size. We filter out
+// really large allocations so we can avoid having to think about corner-cases
+// causing overflow.
+#define MAX_ALLOC_SIZE	   (256UL * 1024UL * 1024UL)
+#define MAX_ALIGNMENT_SIZE (16UL * 1024UL * 1024UL)
+
+// Largest free block that can be described by a single node.
+#define MAX_NODE_GRANULES ((size_t)UINT32_MAX)
+
+static_assert(sizeof(allocator_tree_node_t) == ALLOCATOR_TREE_GRANULE,
+	      "Allocator granule must be the size of a free block header");
+
+typedef allocator_tree_node_t *tree_link_t;
+
+static uintptr_t
+node_start(const allocator_tree_node_t *node)
+{
+	return (uintptr_t)node;
+}
+
+static uintptr_t
+node_end(const allocator_tree_node_t *node)
+{
+	return (uintptr_t)node +
+	       ((size_t)node->granules * ALLOCATOR_TREE_GRANULE);
+}
+
+static count_t
+node_height(const allocator_tree_node_t *node)
+{
+	return (node != NULL) ? (count_t)node->height : 0U;
+}
+
+static uint32_t
+node_max(const allocator_tree_node_t *node)
+{
+	return (node != NULL) ? node->max_granules : 0U;
+}
+
+// Recalculate a node's height and maximum block size from its children.
+static void
+node_update(allocator_tree_node_t *node)
+{
+	count_t lh = node_height(node->left);
+	count_t rh = node_height(node->right);
+
+	assert(util_max(lh, rh) < ALLOCATOR_TREE_MAX_DEPTH);
+
+	node->height	   = (uint8_t)(util_max(lh, rh) + 1U);
+	node->max_granules = util_max(node->granules,
+				      util_max(node_max(node->left),
+					       node_max(node->right)));
+}
+
+static allocator_tree_node_t *
+node_rotate_left(allocator_tree_node_t *node)
+{
+	allocator_tree_node_t *pivot = node->right;
+
+	node->right = pivot->left;
+	pivot->left = node;
+	node_update(node);
+	node_update(pivot);
+
+	return pivot;
+}
+
+static allocator_tree_node_t *
+node_rotate_right(allocator_tree_node_t *node)
+{
+	allocator_tree_node_t *pivot = node->left;
+
+	node->left   = pivot->right;
+	pivot->right = node;
+	node_update(node);
+	node_update(pivot);
+
+	return pivot;
+}
+
+// Rebalance a subtree whose children are balanced and differ in height by at
+// most two, returning its new root.
+static allocator_tree_node_t *
+node_rebalance(allocator_tree_node_t *node)
+{
+	count_t lh = node_height(node->left);
+	count_t rh = node_height(node->right);
+
+	if (lh > (rh + 1U)) {
+		allocator_tree_node_t *left = node->left;
+		if (node_height(left->left) < node_height(left->right)) {
+			node->left = node_rotate_left(left);
+		}
+		node = node_rotate_right(node);
+	} else if (rh > (lh + 1U)) {
+		allocator_tree_node_t *right = node->right;
+		if (node_height(right->right) < node_height(right->left)) {
+			node->right = node_rotate_right(right);
+		}
+		node = node_rotate_left(node);
+	} else {
+		node_update(node);
+	}
+
+	return node;
+}
+
+// Rebalance each subtree on a path from the root, starting from the bottom.
+//
+// Rotations only change the contents of the links on the path, never the
+// location of links nearer the root, so the path remains valid throughout.
+static void
+tree_rebalance_path(tree_link_t *path[], count_t depth)
+{
+	while (depth > 0U) {
+		depth--;
+		*path[depth] = node_rebalance(*path[depth]);
+	}
+}
+
+static void
+tree_insert(tree_link_t *root, allocator_tree_node_t *node)
+{
+	tree_link_t *path[ALLOCATOR_TREE_MAX_DEPTH];
+	count_t	     depth = 0U;
+	tree_link_t *link  = root;
+
+	while (*link != NULL) {
+		assert(depth < ALLOCATOR_TREE_MAX_DEPTH);
+		assert(node != *link);
+		path[depth] = link;
+		depth++;
+		if (node_start(node) < node_start(*link)) {
+			link = &(*link)->left;
+		} else {
+			link = &(*link)->right;
+		}
+	}
+
+	node->left	   = NULL;
+	node->right	   = NULL;
+	node->height	   = 1U;
+	node->max_granules = node->granules;
+	*link		   = node;
+
+	tree_rebalance_path(path, depth);
+}
+
+static void
+tree_remove(tree_link_t *root, allocator_tree_node_t *node)
+{
+	tree_link_t *path[ALLOCATOR_TREE_MAX_DEPTH];
+	count_t	     depth = 0U;
+	tree_link_t *link  = root;
+
+	while (*link != node) {
+		assert(*link != NULL);
+		assert(depth < ALLOCATOR_TREE_MAX_DEPTH);
+		path[depth] = link;
+		depth++;
+		if (node_start(node) < node_start(*link)) {
+			link = &(*link)->left;
+		} else {
+			link = &(*link)->right;
+		}
+	}
+
+	if (node->left == NULL) {
+		*link = node->right;
+	} else if (node->right == NULL) {
+		*link = node->left;
+	} else {
+		// Replace the node with its successor, which is the leftmost
+		// node of its right subtree.
+		count_t node_depth = depth;
+		path[depth]	   = link;
+		depth++;
+
+		tree_link_t *succ_link = &node->right;
+		while ((*succ_link)->left != NULL) {
+			assert(depth < ALLOCATOR_TREE_MAX_DEPTH);
+			path[depth] = succ_link;
+			depth++;
+			succ_link = &(*succ_link)->left;
+		}
+
+		allocator_tree_node_t *succ = *succ_link;
+
+		*succ_link  = succ->right;
+		succ->left  = node->left;
+		succ->right = node->right;
+		*link	    = succ;
+
+		// The link below the removed node now belongs to the
+		// successor.
+		if (depth > (node_depth + 1U)) {
+			assert(path[node_depth + 1U] == &node->right);
+			path[node_depth + 1U] = &succ->right;
+		}
+	}
+
+	tree_rebalance_path(path, depth);
+}
+
+// Find the free block with the highest address less than or equal to addr.
+static allocator_tree_node_t *
+tree_find_le(allocator_tree_node_t *root, uintptr_t addr)
+{
+	allocator_tree_node_t *node  = root;
+	allocator_tree_node_t *found = NULL;
+
+	while (node != NULL) {
+		if (node_start(node) <= addr) {
+			found = node;
+			node  = node->right;
+		} else {
+			node = node->left;
+		}
+	}
+
+	return found;
+}
+
+// Find the free block with the lowest address greater than addr.
+static allocator_tree_node_t *
+tree_find_gt(allocator_tree_node_t *root, uintptr_t addr)
+{
+	allocator_tree_node_t *node  = root;
+	allocator_tree_node_t *found = NULL;
+
+	while (node != NULL) {
+		if (node_start(node) > addr) {
+			found = node;
+			node  = node->left;
+		} else {
+			node = node->right;
+		}
+	}
+
+	return found;
+}
+
+static uintptr_t
+node_aligned_start(const allocator_tree_node_t *node, size_t alignment)
+{
+	return util_balign_up(node_start(node), alignment);
+}
+
+static bool
+node_fits(const allocator_tree_node_t *node, size_t size, size_t alignment)
+{
+	uintptr_t start = node_aligned_start(node, alignment);
+
+	return (start >= node_start(node)) && (start < node_end(node)) &&
+	       ((node_end(node) - start) >= size);
+}
+
+// Find the lowest-addressed free block that can hold an allocation.
+//
+// This is an in-order walk that skips every subtree with no block large
+// enough. When alignment is no greater than the granule, the first block
+// visited always fits.
+static allocator_tree_node_t *
+tree_find_fit(allocator_tree_node_t *root, size_t size, size_t alignment)
+{
+	allocator_tree_node_t *stack[ALLOCATOR_TREE_MAX_DEPTH];
+	count_t		       depth	= 0U;
+	allocator_tree_node_t *node	= root;
+	allocator_tree_node_t *found	= NULL;
+	size_t		       granules = size / ALLOCATOR_TREE_GRANULE;
+
+	while ((node != NULL) || (depth > 0U)) {
+		while ((node != NULL) && (node->max_granules >= granules)) {
+			assert(depth < ALLOCATOR_TREE_MAX_DEPTH);
+			stack[depth] = node;
+			depth++;
+			node = node->left;
+		}
+		if (depth == 0U) {
+			break;
+		}
+		depth--;
+		node = stack[depth];
+		if ((node->granules >= granules) &&
+		    node_fits(node, size, alignment)) {
+			found = node;
+			break;
+		}
+		node = node->right;
+	}
+
+	return found;
+}
+
+// Remove the range [start, start + size) from a free block, returning any
+// remainder at either end to the tree.
+static void
+tree_carve(tree_link_t *root, allocator_tree_node_t *node, uintptr_t start,
+	   size_t size)
+{
+	uintptr_t block_start = node_start(node);
+	uintptr_t block_end   = node_end(node);
+	uintptr_t end	      = start + size;
+
+	assert((start >= block_start) && (end <= block_end));
+
+	tree_remove(root, node);
+
+	if (start > block_start) {
+		node->granules = (uint32_t)((start - block_start) /
+					    ALLOCATOR_TREE_GRANULE);
+		tree_insert(root, node);
+	}
+	if (end < block_end) {
+		allocator_tree_node_t *tail = (allocator_tree_node_t *)end;
+
+		tail->granules =
+			(uint32_t)((block_end - end) / ALLOCATOR_TREE_GRANULE);
+		tree_insert(root, tail);
+	}
+}
+
+// Add the range [addr, addr + size) to the tree, merging it with adjacent
+// free blocks. Fails if the range overlaps an existing free block.
+static error_t
+tree_free(tree_link_t *root, uintptr_t addr, size_t size)
+{
+	error_t	  ret	   = ERROR_ALLOCATOR_RANGE_OVERLAPPING;
+	uintptr_t end	   = addr + size;
+	size_t	  granules = size / ALLOCATOR_TREE_GRANULE;
+
+	allocator_tree_node_t *prev = tree_find_le(*root, addr);
+	allocator_tree_node_t *next = tree_find_gt(*root, addr);
+	allocator_tree_node_t *node = (allocator_tree_node_t *)addr;
+
+	if ((prev != NULL) && (node_end(prev) > addr)) {
+		goto out;
+	}
+	if ((next != NULL) && (node_start(next) < end)) {
+		goto out;
+	}
+
+	if ((prev != NULL) && (node_end(prev) == addr) &&
+	    (((size_t)prev->granules + granules) <= MAX_NODE_GRANULES)) {
+		tree_remove(root, prev);
+		granules += prev->granules;
+		node = prev;
+	}
+	if ((next != NULL) && (node_start(next) == end) &&
+	    (((size_t)next->granules + granules) <= MAX_NODE_GRANULES)) {
+		tree_remove(root, next);
+		granules += next->granules;
+	}
+
+	node->granules = (uint32_t)granules;
+	tree_insert(root, node);
+
+	ret = OK;
+out:
+	return ret;
+}
+
+#if defined(ALLOCATOR_DEBUG)
+// Checking heap consistency:
+// - Blocks are granule aligned, non-empty, in address order and do not
+//   overlap.
+// - Each node's height and maximum size match its children.
+// - The tree is balanced.
+static void
+check_heap_consistency(allocator_tree_node_t *root)
+{
+	allocator_tree_node_t *stack[ALLOCATOR_TREE_MAX_DEPTH];
+	count_t		       depth = 0U;
+	allocator_tree_node_t *node  = root;
+	uintptr_t	       last  = 0U;
+
+	while ((node != NULL) || (depth > 0U)) {
+		while (node != NULL) {
+			assert(depth < ALLOCATOR_TREE_MAX_DEPTH);
+			stack[depth] = node;
+			depth++;
+			node = node->left;
+		}
+		depth--;
+		node = stack[depth];
+
+		count_t lh = node_height(node->left);
+		count_t rh = node_height(node->right);
+
+		assert(util_is_baligned(node_start(node),
+					ALLOCATOR_TREE_GRANULE));
+		assert(node->granules > 0U);
+		assert(node_start(node) >= last);
+		assert(node->height == (util_max(lh, rh) + 1U));
+		assert((lh <= (rh + 1U)) && (rh <= (lh + 1U)));
+		assert(node->max_granules ==
+		       util_max(node->granules,
+				util_max(node_max(node->left),
+					 node_max(node->right))));
+
+		last = node_end(node);
+		node = node->right;
+	}
+}
+
+#define CHECK_HEAP(x) check_heap_consistency(x)
+#else
+#define CHECK_HEAP(x)
+#endif
+
+error_t NOINLINE
+allocator_heap_add_memory(allocator_t *allocator, uintptr_t addr, size_t size)
+{
+	error_t ret = OK;
+
+	assert(addr != 0U);
+
+	// Check input arguments
+	if (!util_is_baligned(addr, ALLOCATOR_TREE_GRANULE)) {
+		uintptr_t new_addr =
+			util_balign_up(addr, ALLOCATOR_TREE_GRANULE);
+		size -= util_min(size, new_addr - addr);
+		addr = new_addr;
+	}
+	size = util_balign_down(size, ALLOCATOR_TREE_GRANULE);
+
+	if (util_add_overflows(addr, size)) {
+		ret = ERROR_ADDR_OVERFLOW;
+	} else if (size < (2UL * ALLOCATOR_TREE_GRANULE)) {
+		ret = ERROR_ARGUMENT_SIZE;
+	} else if ((size / ALLOCATOR_TREE_GRANULE) > MAX_NODE_GRANULES) {
+		ret = ERROR_ARGUMENT_SIZE;
+	} else {
+		spinlock_acquire(&allocator->lock);
+
+		CHECK_HEAP(allocator->root);
+		ret = tree_free(&allocator->root, addr, size);
+		if (ret == OK) {
+			allocator->total_size += size;
+		}
+		CHECK_HEAP(allocator->root);
+
+		spinlock_release(&allocator->lock);
+	}
+
+	return ret;
+}
+
+error_t
+allocator_tree_handle_allocator_add_ram_range(partition_t *owner,
+					      paddr_t	   phys_base,
+					      uintptr_t virt_base, size_t size)
+{
+	assert(owner != NULL);
+
+	(void)phys_base;
+
+	return allocator_heap_add_memory(&owner->allocator, virt_base, size);
+}
+
+void_ptr_result_t
+allocator_allocate_object(allocator_t *allocator, size_t size,
+			  size_t min_alignment)
+{
+	void_ptr_result_t ret;
+
+	size_t alignment = util_max(min_alignment, ALLOCATOR_TREE_GRANULE);
+
+	assert(size > 0UL);
+	assert(util_is_p2(alignment));
+
+	if ((size > MAX_ALLOC_SIZE) || (alignment > MAX_ALIGNMENT_SIZE)) {
+		ret = void_ptr_result_error(ERROR_ARGUMENT_INVALID);
+		goto out;
+	}
+
+	size = util_balign_up(size, ALLOCATOR_TREE_GRANULE);
+
+	spinlock_acquire(&allocator->lock);
+
+	CHECK_HEAP(allocator->root);
+
+	allocator_tree_node_t *node =
+		tree_find_fit(allocator->root, size, alignment);
+	if (node == NULL) {
+		ret = void_ptr_result_error(ERROR_NOMEM);
+	} else {
+		uintptr_t start = node_aligned_start(node, alignment);
+
+		tree_carve(&allocator->root, node, start, size);
+		allocator->alloc_size += size;
+		ret = void_ptr_result_ok((void *)start);
+	}
+
+	CHECK_HEAP(allocator->root);
+
+	spinlock_release(&allocator->lock);
+
+#if defined(ALLOCATOR_DEBUG)
+	if (ret.e == OK) {
+		(void)memset_s(ret.r, size, 0xa5, size);
+	}
+#endif
+
+out:
+	return ret;
+}
+
+error_t
+allocator_deallocate_object(allocator_t *allocator, void *object, size_t size)
+{
+	error_t ret;
+
+	assert(object != NULL);
+	assert(size > 0UL);
+	assert(util_is_baligned((uintptr_t)object, ALLOCATOR_TREE_GRANULE));
+
+	size = util_balign_up(size, ALLOCATOR_TREE_GRANULE);
+
+#if defined(ALLOCATOR_DEBUG)
+	(void)memset_s(object, size, 0xe3, size);
+#endif
+
+	spinlock_acquire(&allocator->lock);
+
+	CHECK_HEAP(allocator->root);
+	ret = tree_free(&allocator->root, (uintptr_t)object, size);
+	// Overlapping a free block means this is a double free.
+	assert(ret == OK);
+	if (ret == OK) {
+		allocator->alloc_size -= size;
+	}
+	CHECK_HEAP(allocator->root);
+
+	spinlock_release(&allocator->lock);
+
+	return ret;
+}
+
+error_t
+allocator_heap_remove_memory(allocator_t *allocator, void *obj, size_t size)
+{
+	error_t	  ret  = ERROR_ALLOCATOR_MEM_INUSE;
+	uintptr_t addr = (uintptr_t)obj;
+
+	assert(obj != NULL);
+	assert(util_is_baligned(addr, ALLOCATOR_TREE_GRANULE));
+
+	size = util_balign_up(size, ALLOCATOR_TREE_GRANULE);
+	assert(!util_add_overflows(addr, size));
+
+	spinlock_acquire(&allocator->lock);
+
+	allocator_tree_node_t *node = tree_find_le(allocator->root, addr);
+	if ((node == NULL) || (node_end(node) < (addr + size))) {
+		goto out;
+	}
+
+	tree_carve(&allocator->root, node, addr, size);
+	allocator->total_size -= size;
+	CHECK_HEAP(allocator->root);
+
+	ret = OK;
+out:
+	spinlock_release(&allocator->lock);
+	return ret;
+}
+
+error_t
+allocator_init(allocator_t *allocator)
+{
+	assert(allocator->root == NULL);
+
+	allocator->total_size = 0UL;
+	allocator->alloc_size = 0UL;
+
+	spinlock_init(&allocator->lock);
+	return OK;
+}
+
+#if defined(UNIT_TESTS)
+void *
+allocator_test_replace_heap(allocator_t *allocator, void *block, size_t size)
+{
+	assert(util_is_baligned((uintptr_t)block, ALLOCATOR_TREE_GRANULE));
+	assert(util_is_baligned(size, ALLOCATOR_TREE_GRANULE));
+
+	spinlock_acquire(&allocator->lock);
+	void *saved	= allocator->root;
+	allocator->root = NULL;
+	error_t err	= tree_free(&allocator->root, (uintptr_t)block, size);
+	assert(err == OK);
+	spinlock_release(&allocator->lock);
+
+	return saved;
+}
+
+bool
+allocator_test_restore_heap(allocator_t *allocator, void *saved, void *block,
+			    size_t size)
+{
+	spinlock_acquire(&allocator->lock);
+	allocator_tree_node_t *node = allocator->root;
+	bool intact = (node == block) && (node->left == NULL) &&
+		      (node->right == NULL) &&
+		      (node_end(node) == ((uintptr_t)block + size));
+	allocator->root = (allocator_tree_node_t *)saved;
+	spinlock_release(&allocator->lock);
+
+	return intact;
+}
+#endif
@@ -9,6 +9,7 @@
 #include <limits.h>
 #include <string.h>
 
+#include <allocator.h>
 #include <compiler.h>
 #include <cpulocal.h>
 #include <log.h>
@@ -24,11 +25,27 @@
 
 #include "event_handlers.h"
 
+#define DUMMY_HEAP_ALIGN 64U
+
+// Concurrent update test parameters. Each CPU updates its own range. With
+// memdb_bitmap, the ranges are in different root entries, skipping the first
+// one, which covers the real memory.
+#if defined(MEMDB_ROOT_ENTRY_BITS)
+#define TEST13_STRIDE util_bit(MEMDB_ROOT_ENTRY_BITS)
+static_assert((PLATFORM_MAX_CORES + 1U) <= util_bit(MEMDB_ROOT_ENTRIES_BITS),
+	      "Not enough root entries for the concurrent update test");
+#else
+#define TEST13_STRIDE util_bit(48)
+#endif
+#define TEST13_SIZE	  0x200000U
+#define TEST13_ITERATIONS 64U
+
 static count_t test_memdb_count;
 
 static partition_t dummy_partition_1;
 static partition_t dummy_partition_2;
 static allocator_t dummy_allocator;
+static memdb_index_t test_index;
 
 void
 memdb_handle_tests_init(void)
@@ -36,6 +53,14 @@ memdb_handle_tests_init(void)
 	test_memdb_count = 0;
 }
 
+memdb_index_t *
+memdb_handle_test_get_index(uintptr_t object)
+{
+	(void)object;
+
+	return &test_index;
+}
+
 static error_t
 memdb_test_add_free_range(paddr_t base, size_t size, void *arg)
 {
@@ -1303,7 +1328,7 @@ memdb_test9(void)
 	// Check initial present ranges
 	check_ranges_in_memdb(memdb_data);
 
-	// Allocate dummy region we can use to replace the allocator's freelist
+	// Allocate dummy region we can use to replace the allocator's heap
 #if defined(MODULE_MEM_MEMDB_GPT)
 	size_t dummy_size = sizeof(memdb_level_t) * 4;
 #elif defined(MODULE_MEM_MEMDB_BITMAP)
@@ -1311,9 +1336,12 @@ memdb_test9(void)
 #else
 #error Determine free heap size to cause OOM during the below memdb_insert
 #endif
-	allocator_node_t *dummy_heap = NULL;
+	// Both allocators accept a block with this size and alignment.
+	dummy_size = util_balign_up(dummy_size, DUMMY_HEAP_ALIGN);
+
+	void *dummy_heap = NULL;
 	alloc_ret = partition_alloc(hyp_partition, dummy_size,
-				    alignof(allocator_node_t));
+				    DUMMY_HEAP_ALIGN);
 	if (alloc_ret.e != OK) {
 		panic("memdb_test: allocate dummy region failed");
 	}
@@ -1342,11 +1370,8 @@ memdb_test9(void)
 	rcu_sync();
 
 	// Swap the real heap with the dummy one
-	spinlock_acquire(&hyp_partition->allocator.lock);
-	allocator_node_t *saved_heap = hyp_partition->allocator.heap;
-	*dummy_heap = (allocator_node_t){ .size = dummy_size, .next = NULL };
-	hyp_partition->allocator.heap = dummy_heap;
-	spinlock_release(&hyp_partition->allocator.lock);
+	void *saved_heap = allocator_test_replace_heap(
+		&hyp_partition->allocator, dummy_heap, dummy_size);
 
 	// Should run out of memory because this range needs to create several
 	// levels (if they have not been created in previous tests) and there is
@@ -1364,14 +1389,13 @@ memdb_test9(void)
 	// been freed by the time an RCU grace period has expired.
 	rcu_sync();
 	rcu_sync();
-	spinlock_acquire(&hyp_partition->allocator.lock);
-	assert(hyp_partition->allocator.heap == dummy_heap);
-	assert(dummy_heap->size == dummy_size);
 
 	// Swap the heap back and retry inserting the same range. This time it
 	// should succeed.
-	hyp_partition->allocator.heap = saved_heap;
-	spinlock_release(&hyp_partition->allocator.lock);
+	if (!allocator_test_restore_heap(&hyp_partition->allocator, saved_heap,
+					 dummy_heap, dummy_size)) {
+		panic("memdb_test: memory leaked from the dummy heap");
+	}
 	partition_free(hyp_partition, dummy_heap, dummy_size);
 
 	err = memdb_insert(hyp_partition, start_addr, end_addr, obj, type);
@@ -1473,11 +1497,163 @@ memdb_test11(void)
 #endif
 }
 
+static void
+memdb_test12_verify(memdb_data_t *memdb_data, uintptr_t object)
+{
+	memdb_data->ranges_index = 0U;
+
+	error_t err = memdb_walk(object, MEMDB_TYPE_TEST_INDEXED, verify_range,
+				 memdb_data);
+	assert(err == OK);
+	assert(memdb_data->ranges_index == memdb_data->ranges_count);
+}
+
+// Test walks of an object that has a reverse index. Adjacent ranges must be
+// merged and partial updates must split the indexed ranges, so that the walk
+// results match those of a walk of the database.
+static void
+memdb_test12(void)
+{
+	LOG(DEBUG, INFO, " Start TEST 12:");
+
+	error_t	     err;
+	partition_t *hyp_partition = partition_get_private();
+	uintptr_t    object	   = (uintptr_t)&test_index;
+	memdb_data_t memdb_data	   = { 0 };
+
+	memdb_index_init(&test_index, hyp_partition);
+
+	paddr_t base0 = 0x6000a00000000U;
+	size_t	size0 = 0x200000U;
+	paddr_t base1 = base0 + size0;
+	size_t	size1 = 0x1000U;
+	paddr_t base2 = 0x6000b00000000U;
+	size_t	size2 = 0x3000U;
+
+	err = memdb_insert(hyp_partition, base0, base0 + size0 - 1U, object,
+			   MEMDB_TYPE_TEST_INDEXED);
+	assert(err == OK);
+	err = memdb_insert(hyp_partition, base2, base2 + size2 - 1U, object,
+			   MEMDB_TYPE_TEST_INDEXED);
+	assert(err == OK);
+	err = memdb_insert(hyp_partition, base1, base1 + size1 - 1U, object,
+			   MEMDB_TYPE_TEST_INDEXED);
+	assert(err == OK);
+
+	memdb_data.ranges[0].base = base0;
+	memdb_data.ranges[0].size = size0 + size1;
+	memdb_data.ranges[1].base = base2;
+	memdb_data.ranges[1].size = size2;
+	memdb_data.ranges_count	  = 2U;
+	memdb_test12_verify(&memdb_data, object);
+
+	// Move the middle page of the last range to another owner.
+	err = memdb_update(hyp_partition, base2 + 0x1000U, base2 + 0x1fffU,
+			   (uintptr_t)&dummy_partition_1, MEMDB_TYPE_PARTITION,
+			   object, MEMDB_TYPE_TEST_INDEXED);
+	assert(err == OK);
+
+	memdb_data.ranges[1].size = 0x1000U;
+	memdb_data.ranges[2].base = base2 + 0x2000U;
+	memdb_data.ranges[2].size = 0x1000U;
+	memdb_data.ranges_count	  = 3U;
+	memdb_test12_verify(&memdb_data, object);
+
+	// Walk part of the ranges; the results are clipped to the range.
+	memdb_data.ranges[0].base = base1;
+	memdb_data.ranges[0].size = size1;
+	memdb_data.ranges_count	  = 1U;
+	memdb_data.ranges_index	  = 0U;
+
+	err = memdb_range_walk(object, MEMDB_TYPE_TEST_INDEXED, base1,
+			       base2 - 1U, verify_range, &memdb_data);
+	assert(err == OK);
+	assert(memdb_data.ranges_index == memdb_data.ranges_count);
+
+	// Return the middle page, and then move all of the object's ranges
+	// to the other owner, leaving the index empty.
+	err = memdb_update(hyp_partition, base2 + 0x1000U, base2 + 0x1fffU,
+			   object, MEMDB_TYPE_TEST_INDEXED,
+			   (uintptr_t)&dummy_partition_1, MEMDB_TYPE_PARTITION);
+	assert(err == OK);
+	err = memdb_update(hyp_partition, base0, base0 + size0 + size1 - 1U,
+			   (uintptr_t)&dummy_partition_1, MEMDB_TYPE_PARTITION,
+			   object, MEMDB_TYPE_TEST_INDEXED);
+	assert(err == OK);
+	err = memdb_update(hyp_partition, base2, base2 + size2 - 1U,
+			   (uintptr_t)&dummy_partition_1, MEMDB_TYPE_PARTITION,
+			   object, MEMDB_TYPE_TEST_INDEXED);
+	assert(err == OK);
+
+	memdb_data.ranges_count = 0U;
+	memdb_test12_verify(&memdb_data, object);
+
+	memdb_index_destroy(&test_index);
+}
+
+// Update ranges in a different part of the memdb on each CPU concurrently.
+// Sizes and alignments are varied so that levels are created, converted and
+// collapsed while other CPUs are doing the same.
+static void
+memdb_test13(cpu_index_t cpu)
+{
+	error_t	     err;
+	partition_t *hyp_partition = partition_get_private();
+	uintptr_t    owner	   = (uintptr_t)&dummy_partition_1;
+	uintptr_t    allocator	   = (uintptr_t)&dummy_allocator;
+	paddr_t	     base	   = TEST13_STRIDE * ((paddr_t)cpu + 1U);
+	paddr_t	     end	   = base + TEST13_SIZE - 1U;
+
+	err = memdb_insert(hyp_partition, base, end, owner,
+			   MEMDB_TYPE_PARTITION);
+	if (err != OK) {
+		panic("memdb_test13: insert failed");
+	}
+
+	for (index_t i = 0U; i < TEST13_ITERATIONS; i++) {
+		paddr_t start = base + ((paddr_t)i * 0x3000U);
+		paddr_t last  = start + ((paddr_t)0x1000U << (i % 8U)) - 1U;
+
+		err = memdb_update(hyp_partition, start, last, allocator,
+				   MEMDB_TYPE_ALLOCATOR, owner,
+				   MEMDB_TYPE_PARTITION);
+		if (err != OK) {
+			panic("memdb_test13: update failed");
+		}
+
+		rcu_read_start();
+		memdb_obj_type_result_t res = memdb_lookup(last);
+		rcu_read_finish();
+		if ((res.e != OK) || (res.r.type != MEMDB_TYPE_ALLOCATOR) ||
+		    (res.r.object != allocator)) {
+			panic("memdb_test13: lookup of updated range failed");
+		}
+
+		if (!memdb_is_ownership_contiguous(start, last, allocator,
+						   MEMDB_TYPE_ALLOCATOR)) {
+			panic("memdb_test13: updated range not contiguous");
+		}
+
+		err = memdb_update(hyp_partition, start, last, owner,
+				   MEMDB_TYPE_PARTITION, allocator,
+				   MEMDB_TYPE_ALLOCATOR);
+		if (err != OK) {
+			panic("memdb_test13: revert failed");
+		}
+	}
+
+	if (!memdb_is_ownership_contiguous(base, end, owner,
+					   MEMDB_TYPE_PARTITION)) {
+		panic("memdb_test13: range not restored");
+	}
+}
+
 bool
 memdb_handle_tests_start(void)
 {
 	static _Atomic count_t core_start_count;
 	static _Atomic bool    tests_done;
+	static _Atomic count_t concurrent_done_count;
 	cpu_index_t	       this_cpu = cpulocal_get_index();
 
 	(void)atomic_fetch_add(&core_start_count, 1U);
@@ -1525,7 +1701,9 @@ memdb_handle_tests_start(void)
 	// Test conversion of bitmap levels to table levels for memdb_bitmap
 	memdb_test11();
 
-	LOG(DEBUG, INFO, "Memdb tests successfully finished ");
+	// Test walks using a reverse index
+	memdb_test12();
+
 	atomic_store(&tests_done, true);
 
 wait:
@@ -1536,6 +1714,21 @@ wait:
 		scheduler_yield();
 	}
 
+	// Test concurrent updates on all CPUs
+	if (this_cpu == 0U) {
+		LOG(DEBUG, INFO, " Start TEST 13:");
+	}
+	memdb_test13(this_cpu);
+
+	(void)atomic_fetch_add(&concurrent_done_count, 1U);
+	while (atomic_load(&concurrent_done_count) < PLATFORM_MAX_CORES) {
+		scheduler_yield();
+	}
+
+	if (this_cpu == 0U) {
+		LOG(DEBUG, INFO, "Memdb tests successfully finished ");
+	}
+
 	return false;
 }
 #else
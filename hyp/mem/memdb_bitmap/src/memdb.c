@@ -16,6 +16,7 @@
 #include <memdb.h>
 #include <panic.h>
 #include <partition.h>
+#include <preempt.h>
 #include <rcu.h>
 #include <spinlock.h>
 #include <trace.h>
@@ -23,7 +24,28 @@
 
 #include "event_handlers.h"
 
-static spinlock_t memdb_lock;
+// Updates are serialised by a lock for each group of entries of the root
+// table, which protects those entries and all levels below them. An update
+// takes the locks of all root entries that its range overlaps, in ascending
+// order, so updates of unrelated parts of the physical address space can run
+// concurrently. There are at most MEMDB_ROOT_LOCKS groups, which bounds the
+// number of locks held by an update of a large range.
+//
+// Lookups, contiguity checks and walks take no locks. They are RCU readers;
+// levels are only freed after an RCU grace period, and every table entry and
+// bitmap field is updated atomically.
+//
+// The thread safety analysis can't express a lock chosen by address, so the
+// update functions require the opaque memdb_update_lock instead.
+static spinlock_t memdb_root_locks[MEMDB_ROOT_LOCKS];
+
+// Shift from a root entry index to the index of its lock.
+static const index_t memdb_root_lock_shift =
+	(MEMDB_ROOT_ENTRIES_BITS > MEMDB_ROOT_LOCKS_BITS)
+		? (MEMDB_ROOT_ENTRIES_BITS - MEMDB_ROOT_LOCKS_BITS)
+		: 0U;
+
+extern opaque_lock_t memdb_update_lock;
 
 static_assert((uint64_t)MEMDB_TYPE_NOTYPE == 0U,
 	      "Zero-initialised memdb entries must be empty");
@@ -50,7 +72,9 @@ memdb_bitmap_handle_boot_cold_init(void)
 	partition_t *hyp_partition = partition_get_private();
 	assert(hyp_partition != NULL);
 
-	spinlock_init(&memdb_lock);
+	for (index_t i = 0U; i < util_array_size(memdb_root_locks); i++) {
+		spinlock_init(&memdb_root_locks[i]);
+	}
 
 	// Assign the hypervisor's ELF image to the private partition.
 	error_t err = memdb_insert(hyp_partition, (paddr_t)&image_phys_start,
@@ -220,7 +244,8 @@ out:
 }
 
 static memdb_level_table_ptr_result_t
-memdb_convert_bitmap(memdb_level_bitmap_t *bitmap) REQUIRE_LOCK(memdb_lock)
+memdb_convert_bitmap(memdb_level_bitmap_t *bitmap)
+	REQUIRE_LOCK(memdb_update_lock)
 {
 	memdb_level_table_ptr_result_t ret =
 		memdb_create_table(memdb_entry_default());
@@ -245,7 +270,8 @@ out:
 }
 
 static memdb_level_bitmap_ptr_result_t
-memdb_duplicate_bitmap(memdb_level_bitmap_t *bitmap) REQUIRE_LOCK(memdb_lock)
+memdb_duplicate_bitmap(memdb_level_bitmap_t *bitmap)
+	REQUIRE_LOCK(memdb_update_lock)
 {
 	memdb_level_bitmap_ptr_result_t ret;
 	partition_t		       *hyp_partition = partition_get_private();
@@ -342,7 +368,7 @@ out:
 static bool_result_t
 memdb_update_bitmap(paddr_t start, paddr_t end, memdb_entry_t old_entry,
 		    memdb_entry_t new_entry, memdb_level_bitmap_t *bitmap,
-		    index_t entry_bits) REQUIRE_LOCK(memdb_lock)
+		    index_t entry_bits) REQUIRE_LOCK(memdb_update_lock)
 {
 	bool_result_t ret;
 
@@ -448,7 +474,7 @@ static error_t
 memdb_update_table_entry(paddr_t start, paddr_t end, memdb_entry_t old_entry,
 			 memdb_entry_t new_entry, memdb_level_table_t *table,
 			 index_t entry_bits, index_t entry_index)
-	REQUIRE_LOCK(memdb_lock);
+	REQUIRE_LOCK(memdb_update_lock);
 
 static bool
 memdb_update_table_check_contig(index_t start_index, index_t end_index,
@@ -485,7 +511,7 @@ memdb_update_table_check_contig(index_t start_index, index_t end_index,
 static bool_result_t
 memdb_update_table(paddr_t start, paddr_t end, memdb_entry_t old_entry,
 		   memdb_entry_t new_entry, memdb_level_table_t *table,
-		   index_t entry_bits) REQUIRE_LOCK(memdb_lock)
+		   index_t entry_bits) REQUIRE_LOCK(memdb_update_lock)
 {
 	assert((entry_bits <= MEMDB_ROOT_ENTRY_BITS) &&
 	       ((start >> (entry_bits + MEMDB_BITS_PER_LEVEL)) ==
@@ -552,7 +578,8 @@ static error_t
 memdb_update_table_entry_level_table(
 	paddr_t start, paddr_t end, memdb_entry_t old_entry,
 	memdb_entry_t new_entry, memdb_level_table_t *table, index_t entry_bits,
-	memdb_entry_t cur_entry, index_t entry_index) REQUIRE_LOCK(memdb_lock)
+	memdb_entry_t cur_entry, index_t entry_index)
+	REQUIRE_LOCK(memdb_update_lock)
 {
 	uintptr_t	     cur_ptr	= memdb_entry_get_entry_ptr(&cur_entry);
 	memdb_level_table_t *next_table = (memdb_level_table_t *)cur_ptr;
@@ -576,7 +603,8 @@ static error_t
 memdb_update_table_entry_level_bitmap(
 	paddr_t start, paddr_t end, memdb_entry_t old_entry,
 	memdb_entry_t new_entry, memdb_level_table_t *table, index_t entry_bits,
-	memdb_entry_t cur_entry, index_t entry_index) REQUIRE_LOCK(memdb_lock)
+	memdb_entry_t cur_entry, index_t entry_index)
+	REQUIRE_LOCK(memdb_update_lock)
 {
 	uintptr_t	      cur_ptr = memdb_entry_get_entry_ptr(&cur_entry);
 	memdb_level_bitmap_t *next_bitmap   = (memdb_level_bitmap_t *)cur_ptr;
@@ -664,7 +692,7 @@ memdb_update_table_entry_split_bitmap(paddr_t start, paddr_t end,
 				      memdb_entry_t	   new_entry,
 				      memdb_level_table_t *table,
 				      index_t entry_bits, index_t entry_index)
-	REQUIRE_LOCK(memdb_lock)
+	REQUIRE_LOCK(memdb_update_lock)
 {
 	memdb_level_bitmap_ptr_result_t bitmap_ret =
 		memdb_create_bitmap(old_entry);
@@ -700,7 +728,7 @@ memdb_update_table_entry_split_table(paddr_t start, paddr_t end,
 				     memdb_entry_t	  new_entry,
 				     memdb_level_table_t *table,
 				     index_t entry_bits, index_t entry_index)
-	REQUIRE_LOCK(memdb_lock)
+	REQUIRE_LOCK(memdb_update_lock)
 {
 	memdb_level_table_ptr_result_t table_ret =
 		memdb_create_table(old_entry);
@@ -734,7 +762,7 @@ static error_t
 memdb_update_table_entry(paddr_t start, paddr_t end, memdb_entry_t old_entry,
 			 memdb_entry_t new_entry, memdb_level_table_t *table,
 			 index_t entry_bits, index_t entry_index)
-	REQUIRE_LOCK(memdb_lock)
+	REQUIRE_LOCK(memdb_update_lock)
 {
 	error_t err;
 
@@ -789,6 +817,48 @@ memdb_update_table_entry(paddr_t start, paddr_t end, memdb_entry_t old_entry,
 	return err;
 }
 
+static void
+memdb_update_lock_range(paddr_t start, paddr_t end)
+	ACQUIRE_LOCK(memdb_update_lock);
+
+static void
+memdb_update_lock_range(paddr_t start, paddr_t end) LOCK_IMPL
+{
+	const index_t start_index =
+		memdb_entry_index(start, MEMDB_ROOT_ENTRY_BITS) >>
+		memdb_root_lock_shift;
+	const index_t end_index =
+		memdb_entry_index(end, MEMDB_ROOT_ENTRY_BITS) >>
+		memdb_root_lock_shift;
+
+	assert(end_index < util_array_size(memdb_root_locks));
+
+	preempt_disable();
+	for (index_t i = start_index; i <= end_index; i++) {
+		spinlock_acquire_nopreempt(&memdb_root_locks[i]);
+	}
+}
+
+static void
+memdb_update_unlock_range(paddr_t start, paddr_t end)
+	RELEASE_LOCK(memdb_update_lock);
+
+static void
+memdb_update_unlock_range(paddr_t start, paddr_t end) LOCK_IMPL
+{
+	const index_t start_index =
+		memdb_entry_index(start, MEMDB_ROOT_ENTRY_BITS) >>
+		memdb_root_lock_shift;
+	const index_t end_index =
+		memdb_entry_index(end, MEMDB_ROOT_ENTRY_BITS) >>
+		memdb_root_lock_shift;
+
+	for (index_t i = start_index; i <= end_index; i++) {
+		spinlock_release_nopreempt(&memdb_root_locks[i]);
+	}
+	preempt_enable();
+}
+
 error_t
 memdb_insert(partition_t *partition, paddr_t start_addr, paddr_t end_addr,
 	     uintptr_t object, memdb_type_t obj_type)
@@ -816,11 +886,11 @@ memdb_update(partition_t *partition, paddr_t start_addr, paddr_t end_addr,
 		memdb_entry_for_object(object, obj_type);
 	const memdb_entry_t old_entry =
 		memdb_entry_for_object(prev_object, prev_type);
-	spinlock_acquire(&memdb_lock);
+	memdb_update_lock_range(start_addr, end_addr);
 	err = memdb_update_table(start_addr, end_addr, old_entry, new_entry,
 				 &memdb_root, MEMDB_ROOT_ENTRY_BITS)
 		      .e;
-	spinlock_release(&memdb_lock);
+	memdb_update_unlock_range(start_addr, end_addr);
 
 	if (err == OK) {
 		TRACE(MEMDB, INFO,
@@ -1058,6 +1128,19 @@ memdb_is_ownership_contiguous(paddr_t start_addr, paddr_t end_addr,
 	return result;
 }
 
+void
+memdb_index_init(memdb_index_t *index, partition_t *partition)
+{
+	(void)index;
+	(void)partition;
+}
+
+void
+memdb_index_destroy(memdb_index_t *index)
+{
+	(void)index;
+}
+
 error_t
 memdb_walk(uintptr_t object, memdb_type_t type, memdb_fnptr fn, void *arg)
 {
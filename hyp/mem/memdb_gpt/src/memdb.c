@@ -61,16 +61,20 @@
 #include <atomic.h>
 #include <bootmem.h>
 #include <compiler.h>
+#include <gpt.h>
 #include <log.h>
 #include <memdb.h>
 #include <panic.h>
 #include <partition.h>
+#include <preempt.h>
 #include <rcu.h>
 #include <spinlock.h>
 #include <trace.h>
 #include <trace_helpers.h>
 #include <util.h>
 
+#include <events/memdb.h>
+
 #include "event_handlers.h"
 
 #define MEMDB_BITS_PER_ENTRY_MASK util_mask(MEMDB_BITS_PER_ENTRY)
@@ -103,6 +107,12 @@ typedef struct locked_levels_s {
 	uint8_t		       pad_end_[4];
 } locked_levels_t;
 
+typedef struct memdb_index_walk_s {
+	memdb_fnptr fn;
+	void	   *arg;
+	paddr_t	    resume;
+} memdb_index_walk_t;
+
 static count_t
 lowest_unmatching_bits(paddr_t start_addr, paddr_t end_addr)
 {
@@ -1679,6 +1689,190 @@ error:
 	return ret;
 }
 
+// Reverse indexes:
+//
+// An object may provide an index of the ranges it owns, in the form of a GPT
+// with an entry of type MEMDB_INDEX for each owned range. This allows walks of
+// the object's ranges to take time proportional to the number of ranges it
+// owns, rather than to the size of the database.
+//
+// The index is updated after the database, with the index locks of both the
+// old and new owners held across both updates, so concurrent updates of the
+// same object's ranges are applied to its index in the same order as to the
+// database. If an index update fails, the index is marked invalid and the
+// database is used for all subsequent walks of that object. A walk that was
+// using the index when it became invalid continues in the database from the
+// end of the last range it found in the index.
+
+void
+memdb_index_init(memdb_index_t *index, partition_t *partition)
+{
+	gpt_config_t config = gpt_config_default();
+	gpt_config_set_max_bits(&config, GPT_MAX_SIZE_BITS);
+	gpt_config_set_rcu_read(&config, true);
+
+	spinlock_init(&index->lock);
+
+	error_t err = gpt_init(&index->gpt, partition, config,
+			       util_bit((index_t)GPT_TYPE_MEMDB_INDEX));
+	if (err != OK) {
+		// Walks of the object will use the database instead.
+		TRACE(MEMDB, INFO,
+		      "memdb: index {:#x} init failed with error {:d}",
+		      (uintptr_t)index, (register_t)err);
+	}
+
+	index->initialised = err == OK;
+	atomic_init(&index->valid, err == OK);
+}
+
+void
+memdb_index_destroy(memdb_index_t *index)
+{
+	// The index may never have been initialised, if the object's creation
+	// failed.
+	if (index->initialised) {
+		atomic_store_relaxed(&index->valid, false);
+		gpt_destroy(&index->gpt);
+		index->initialised = false;
+	}
+}
+
+bool
+memdb_gpt_handle_index_values_equal(void)
+{
+	return true;
+}
+
+error_t
+memdb_gpt_handle_index_walk(size_t base, size_t size, gpt_arg_t arg)
+{
+	memdb_index_walk_t *walk = (memdb_index_walk_t *)arg.raw;
+	assert(walk != NULL);
+
+	error_t ret = walk->fn(base, size, walk->arg);
+	if (ret == OK) {
+		walk->resume = base + size;
+	}
+
+	return ret;
+}
+
+// Callback for the database walk that continues a walk of an index that was
+// discarded. Ranges that were already found in the index are skipped.
+static error_t
+memdb_index_resume_walk(paddr_t base, size_t size, void *arg)
+{
+	memdb_index_walk_t *walk = (memdb_index_walk_t *)arg;
+	error_t		    ret	 = OK;
+	paddr_t		    end	 = base + (size - 1U);
+
+	assert(walk != NULL);
+
+	if (end >= walk->resume) {
+		paddr_t start = util_max(base, walk->resume);
+
+		ret = walk->fn(start, (end - start) + 1U, walk->arg);
+	}
+
+	return ret;
+}
+
+static memdb_index_t *
+memdb_index_get(uintptr_t object, memdb_type_t type)
+{
+	memdb_index_t *index = trigger_memdb_get_index_event(type, object);
+
+	return ((index != NULL) && atomic_load_relaxed(&index->valid)) ? index
+								      : NULL;
+}
+
+// Lock the indexes of the new and previous owners of a range, if they have
+// them. The locks are taken in address order to avoid deadlocks.
+static void
+memdb_index_lock(memdb_index_t *index, memdb_index_t *prev_index) LOCK_IMPL
+{
+	bool	       ordered = (uintptr_t)index < (uintptr_t)prev_index;
+	memdb_index_t *first   = ordered ? index : prev_index;
+	memdb_index_t *second  = ordered ? prev_index : index;
+
+	preempt_disable();
+	if (first != NULL) {
+		spinlock_acquire_nopreempt(&first->lock);
+	}
+	if ((second != NULL) && (second != first)) {
+		spinlock_acquire_nopreempt(&second->lock);
+	}
+}
+
+static void
+memdb_index_unlock(memdb_index_t *index, memdb_index_t *prev_index) LOCK_IMPL
+{
+	if (index != NULL) {
+		spinlock_release_nopreempt(&index->lock);
+	}
+	if ((prev_index != NULL) && (prev_index != index)) {
+		spinlock_release_nopreempt(&prev_index->lock);
+	}
+	preempt_enable();
+}
+
+static void
+memdb_index_update(memdb_index_t *index, paddr_t start_addr, paddr_t end_addr,
+		   bool owned)
+{
+	error_t err;
+	size_t	size = (end_addr - start_addr) + 1U;
+
+	if ((index == NULL) || !atomic_load_relaxed(&index->valid)) {
+		goto out;
+	}
+
+	if (owned) {
+		gpt_entry_t entry = {
+			.type  = GPT_TYPE_MEMDB_INDEX,
+			.value = { .raw = 0U },
+		};
+		err = gpt_insert(&index->gpt, start_addr, size, entry, false);
+	} else {
+		err = gpt_clear(&index->gpt, start_addr, size);
+	}
+
+	if (err != OK) {
+		// The index no longer matches the database; stop using it.
+		// The GPT is not destroyed until the object is, because walks
+		// may still be using it.
+		TRACE(MEMDB, INFO,
+		      "memdb: discarding index {:#x} after error {:d}",
+		      (uintptr_t)index, (register_t)err);
+		atomic_store_release(&index->valid, false);
+	}
+
+out:
+	return;
+}
+
+// Walk the ranges in an index that overlap the given range.
+static error_t
+memdb_index_walk(memdb_index_t *index, paddr_t start_addr, paddr_t end_addr,
+		 memdb_index_walk_t *walk) REQUIRE_RCU_READ
+{
+	error_t ret = OK;
+
+	// The index can't contain ranges above GPT_MAX_SIZE; any attempt to
+	// add one would have invalidated it.
+	if (start_addr < GPT_MAX_SIZE) {
+		paddr_t end = util_min(end_addr, GPT_MAX_SIZE - 1U);
+
+		ret = gpt_walk(&index->gpt, start_addr, (end - start_addr) + 1U,
+			       GPT_TYPE_MEMDB_INDEX,
+			       GPT_CALLBACK_MEMDB_INDEX_WALK,
+			       (gpt_arg_t){ .raw = (uintptr_t)walk });
+	}
+
+	return ret;
+}
+
 // Populate the memory database. If any entry from the range already has an
 // owner, return error and do not update the database.
 error_t
@@ -1702,7 +1896,10 @@ memdb_insert(partition_t *partition, paddr_t start_addr, paddr_t end_addr,
 	assert((start_addr != 0U) || (~end_addr != 0U));
 	assert(partition != NULL);
 
-	allocator_t *allocator = &partition->allocator;
+	allocator_t   *allocator = &partition->allocator;
+	memdb_index_t *index	 = memdb_index_get(object, obj_type);
+
+	memdb_index_lock(index, NULL);
 
 	(void)atomic_entry_read(&memdb.root, &guard, &guard_shifts, &root_type,
 				&next);
@@ -1763,6 +1960,8 @@ end_function:
 			ret, MEMDB_OP_INSERT);
 
 	if (ret == OK) {
+		memdb_index_update(index, start_addr, end_addr, true);
+
 		TRACE(MEMDB, INFO,
 		      "memdb_insert: {:#x}..{:#x} - obj({:#x}) - type({:d})",
 		      start_addr, end_addr, object, (register_t)obj_type);
@@ -1785,6 +1984,8 @@ end_function:
 		      (register_t)ret);
 	}
 
+	memdb_index_unlock(index, NULL);
+
 	return ret;
 }
 
@@ -1811,7 +2012,11 @@ memdb_update(partition_t *partition, paddr_t start_addr, paddr_t end_addr,
 	assert((start_addr != 0U) || (~end_addr != 0U));
 	assert(partition != NULL);
 
-	allocator_t *allocator = &partition->allocator;
+	allocator_t   *allocator  = &partition->allocator;
+	memdb_index_t *index	  = memdb_index_get(object, obj_type);
+	memdb_index_t *prev_index = memdb_index_get(prev_object, prev_type);
+
+	memdb_index_lock(index, prev_index);
 
 	ret = find_common_level(start_addr, end_addr, &common_level, &shifts,
 				allocator, object, obj_type, prev_object,
@@ -1822,6 +2027,12 @@ memdb_update(partition_t *partition, paddr_t start_addr, paddr_t end_addr,
 			&locked_levels, ret, MEMDB_OP_UPDATE);
 
 	if (ret == OK) {
+		if (index != prev_index) {
+			memdb_index_update(prev_index, start_addr, end_addr,
+					   false);
+			memdb_index_update(index, start_addr, end_addr, true);
+		}
+
 		TRACE(MEMDB, INFO,
 		      "memdb_update: {:#x}..{:#x} - obj({:#x}) - type({:d})",
 		      start_addr, end_addr, object, (register_t)obj_type);
@@ -1844,6 +2055,8 @@ memdb_update(partition_t *partition, paddr_t start_addr, paddr_t end_addr,
 		      (register_t)ret);
 	}
 
+	memdb_index_unlock(index, prev_index);
+
 	return ret;
 }
 
@@ -2147,6 +2360,23 @@ memdb_range_walk(uintptr_t object, memdb_type_t type, paddr_t start_addr,
 	assert((start_addr != end_addr) && (start_addr < end_addr));
 	assert((start_addr != 0U) || (~end_addr != 0U));
 
+	memdb_index_t	  *index = memdb_index_get(object, type);
+	memdb_index_walk_t walk	 = { .fn     = fn,
+				     .arg    = arg,
+				     .resume = start_addr };
+	if (index != NULL) {
+		ret = memdb_index_walk(index, start_addr, end_addr, &walk);
+		if ((ret != OK) || atomic_load_acquire(&index->valid)) {
+			goto error;
+		}
+
+		// The index was discarded during the walk, so updates made
+		// since then are missing from it. Walk the rest of the range
+		// in the database.
+		fn  = memdb_index_resume_walk;
+		arg = &walk;
+	}
+
 	ret = find_common_level(start_addr, end_addr, &common_level, &shifts,
 				NULL, object, type, 0, MEMDB_TYPE_LEVEL, NULL,
 				false, false);
@@ -2195,6 +2425,20 @@ memdb_walk(uintptr_t object, memdb_type_t type, memdb_fnptr fn, void *arg)
 
 	assert(next_type == MEMDB_TYPE_LEVEL);
 
+	memdb_index_t	  *index = memdb_index_get(object, type);
+	memdb_index_walk_t walk	 = { .fn = fn, .arg = arg, .resume = 0U };
+	if (index != NULL) {
+		ret = memdb_index_walk(index, 0U, ~(paddr_t)0U, &walk);
+		if ((ret != OK) || atomic_load_acquire(&index->valid)) {
+			goto error;
+		}
+
+		// The index was discarded during the walk; walk the rest of
+		// the database, as in memdb_range_walk().
+		fn  = memdb_index_resume_walk;
+		arg = &walk;
+	}
+
 	memdb_level_t *level = (memdb_level_t *)next;
 
 	if (guard_shifts != ADDR_SIZE) {
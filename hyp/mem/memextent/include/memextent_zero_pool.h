@@ -0,0 +1,45 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Zero and/or cache clean a range of physical memory. This is a memdb walk
+// callback; the argument points to a memextent_clean_flags_t.
+error_t
+memextent_do_clean(paddr_t base, size_t size, void *arg);
+
+#if defined(MEMEXTENT_ZERO_POOL)
+// Zero the memory owned by an extent in the given physical range, skipping any
+// chunks that are known to be zero already.
+error_t
+memextent_zero_pool_zero(memextent_t *me, paddr_t phys, size_t size);
+
+// Queue the memory owned by an extent in the given physical range to be zeroed
+// in the background. Parts of the range that can't be queued are zeroed
+// synchronously.
+error_t
+memextent_zero_pool_defer(memextent_t *me, paddr_t phys, size_t size);
+
+// Discard the zeroing state of a physical range in an extent's tree. This must
+// be called before the range may become writable through a new mapping or a
+// hypervisor attachment. It waits for any background zeroing of the range to
+// stop.
+void
+memextent_zero_pool_invalidate(memextent_t *me, paddr_t phys, size_t size);
+
+// Bracket an operation that may make a physical range in an extent writable
+// through a new mapping or a hypervisor attachment. The range's zeroing state
+// is discarded, and no more of the extent's memory is queued for zeroing
+// until the operation ends.
+void
+memextent_zero_pool_begin_access(memextent_t *me, paddr_t phys, size_t size);
+
+void
+memextent_zero_pool_end_access(memextent_t *me);
+
+// Discard the zeroing state of a physical range that is about to be moved from
+// an extent in the given tree to the receiver, if the receiver has mappings
+// that will cover it. A NULL receiver means the range is leaving the tree.
+void
+memextent_zero_pool_prepare_move(memextent_t *me, memextent_t *receiver,
+				 paddr_t phys, size_t size);
+#endif
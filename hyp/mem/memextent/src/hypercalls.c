@@ -18,55 +18,101 @@
 #include <rcu.h>
 #include <spinlock.h>
 
-error_t
+static error_t
+hypercall_memextent_modify_range(memextent_t *memextent,
+				 memextent_modify_op_t op, size_t offset,
+				 size_t size)
+{
+	error_t err;
+
+	if (op == MEMEXTENT_MODIFY_OP_ZERO_RANGE) {
+		err = memextent_zero_range(memextent, offset, size);
+	} else if (op == MEMEXTENT_MODIFY_OP_ZERO_RANGE_DEFERRED) {
+		err = memextent_zero_range_deferred(memextent, offset, size);
+	} else if (op == MEMEXTENT_MODIFY_OP_CACHE_CLEAN_RANGE) {
+		err = memextent_cache_clean_range(memextent, offset, size);
+	} else if (op == MEMEXTENT_MODIFY_OP_CACHE_FLUSH_RANGE) {
+		err = memextent_cache_flush_range(memextent, offset, size);
+	} else {
+		err = ERROR_ARGUMENT_INVALID;
+	}
+
+	return err;
+}
+
+// Arguments of a preemptible modify operation.
+typedef struct {
+	memextent_t	     *memextent;
+	memextent_modify_op_t op;
+	size_t		      offset;
+} hypercall_memextent_modify_t;
+
+static error_t
+hypercall_memextent_modify_piece(size_t offset, size_t size, void *arg)
+{
+	hypercall_memextent_modify_t *modify =
+		(hypercall_memextent_modify_t *)arg;
+
+	return hypercall_memextent_modify_range(
+		modify->memextent, modify->op, modify->offset + offset, size);
+}
+
+hypercall_memextent_modify_result_t
 hypercall_memextent_modify(cap_id_t		    memextent_cap,
 			   memextent_modify_flags_t flags, size_t offset,
 			   size_t size)
 {
-	error_t	  err	 = OK;
-	cspace_t *cspace = cspace_get_self();
+	hypercall_memextent_modify_result_t ret	   = { .error = OK };
+	cspace_t			   *cspace = cspace_get_self();
 
 	// FIXME:
 	if (memextent_modify_flags_get_res_0(&flags) != 0U) {
-		err = ERROR_ARGUMENT_INVALID;
+		ret.error = ERROR_ARGUMENT_INVALID;
 		goto out;
 	}
 
 	memextent_ptr_result_t m = cspace_lookup_memextent(
 		cspace, memextent_cap, CAP_RIGHTS_MEMEXTENT_MAP);
 	if (compiler_unexpected(m.e != OK)) {
-		err = m.e;
+		ret.error = m.e;
 		goto out;
 	}
 
 	memextent_t *memextent = m.r;
 	bool	     need_sync = !memextent_modify_flags_get_no_sync(&flags);
+	bool preemptible       = memextent_modify_flags_get_preemptible(&flags);
 
 	memextent_modify_op_t op = memextent_modify_flags_get_op(&flags);
-	if (op == MEMEXTENT_MODIFY_OP_UNMAP_ALL) {
+	if ((op == MEMEXTENT_MODIFY_OP_UNMAP_ALL) && !preemptible) {
 		memextent_unmap_all(memextent);
-	} else if ((op == MEMEXTENT_MODIFY_OP_ZERO_RANGE) && !need_sync) {
-		err = memextent_zero_range(memextent, offset, size);
-	} else if ((op == MEMEXTENT_MODIFY_OP_CACHE_CLEAN_RANGE) &&
-		   !need_sync) {
-		err = memextent_cache_clean_range(memextent, offset, size);
-	} else if ((op == MEMEXTENT_MODIFY_OP_CACHE_FLUSH_RANGE) &&
-		   !need_sync) {
-		err = memextent_cache_flush_range(memextent, offset, size);
-	} else if (op == MEMEXTENT_MODIFY_OP_SYNC_ALL) {
-		err = need_sync ? OK : ERROR_ARGUMENT_INVALID;
+	} else if ((op == MEMEXTENT_MODIFY_OP_SYNC_ALL) && !preemptible) {
+		ret.error = need_sync ? OK : ERROR_ARGUMENT_INVALID;
+	} else if (need_sync) {
+		// Range operations don't change mappings, so they must not
+		// request a sync.
+		ret.error = ERROR_ARGUMENT_INVALID;
+	} else if (preemptible) {
+		hypercall_memextent_modify_t modify = {
+			.memextent = memextent,
+			.op	   = op,
+			.offset	   = offset,
+		};
+		ret.error = memextent_preempt_range(
+			offset, size, hypercall_memextent_modify_piece, &modify,
+			&ret.progress);
 	} else {
-		err = ERROR_ARGUMENT_INVALID;
+		ret.error = hypercall_memextent_modify_range(memextent, op,
+							     offset, size);
 	}
 
-	if ((err == OK) && need_sync) {
+	if ((ret.error == OK) && need_sync) {
 		// Wait for completion of EL2 operations using manual lookups
 		rcu_sync();
 	}
 
 	object_put_memextent(memextent);
 out:
-	return err;
+	return ret;
 }
 
 error_t
@@ -161,9 +207,65 @@ out:
 	return err;
 }
 
+// Arguments of a donation. The range is donated between a child and its
+// parent if to is NULL, or between siblings otherwise.
+typedef struct {
+	memextent_t *me;
+	memextent_t *to;
+	size_t	     offset;
+	bool	     reverse;
+} hypercall_memextent_donate_t;
+
+static error_t
+hypercall_memextent_donate_piece(size_t offset, size_t size, void *arg)
+{
+	hypercall_memextent_donate_t *donate =
+		(hypercall_memextent_donate_t *)arg;
+
+	error_t err;
+
+	if (donate->to == NULL) {
+		err = memextent_donate_child(donate->me, donate->offset + offset,
+					     size, donate->reverse);
+	} else {
+		err = memextent_donate_sibling(donate->me, donate->to,
+					       donate->offset + offset, size);
+	}
+
+	return err;
+}
+
+// If the donation is preemptible, it is done in pieces, and the size of the
+// completed part of the range is returned in progress.
+static error_t
+hypercall_memextent_donate_range(memextent_t *me, memextent_t *to,
+				 size_t offset, size_t size, bool reverse,
+				 bool preemptible, size_t *progress)
+{
+	error_t err;
+
+	hypercall_memextent_donate_t donate = {
+		.me	 = me,
+		.to	 = to,
+		.offset	 = offset,
+		.reverse = reverse,
+	};
+
+	if (preemptible) {
+		err = memextent_preempt_range(offset, size,
+					      hypercall_memextent_donate_piece,
+					      &donate, progress);
+	} else {
+		err = hypercall_memextent_donate_piece(0U, size, &donate);
+	}
+
+	return err;
+}
+
 static error_t
 hypercall_memextent_donate_child(cap_id_t parent_cap, cap_id_t child_cap,
-				 size_t offset, size_t size, bool reverse)
+				 size_t offset, size_t size, bool reverse,
+				 bool preemptible, size_t *progress)
 {
 	error_t	  err	 = OK;
 	cspace_t *cspace = cspace_get_self();
@@ -207,7 +309,9 @@ hypercall_memextent_donate_child(cap_id_t parent_cap, cap_id_t child_cap,
 	}
 
 	if (err == OK) {
-		err = memextent_donate_child(child.r, offset, size, reverse);
+		err = hypercall_memextent_donate_range(child.r, NULL, offset,
+						       size, reverse,
+						       preemptible, progress);
 	}
 
 out_child_release:
@@ -218,7 +322,8 @@ out:
 
 static error_t
 hypercall_memextent_donate_sibling(cap_id_t from, cap_id_t to, size_t offset,
-				   size_t size)
+				   size_t size, bool preemptible,
+				   size_t *progress)
 {
 	error_t	  err;
 	cspace_t *cspace = cspace_get_self();
@@ -237,7 +342,8 @@ hypercall_memextent_donate_sibling(cap_id_t from, cap_id_t to, size_t offset,
 		goto out_m1_release;
 	}
 
-	err = memextent_donate_sibling(m1.r, m2.r, offset, size);
+	err = hypercall_memextent_donate_range(m1.r, m2.r, offset, size, false,
+					       preemptible, progress);
 
 	object_put_memextent(m2.r);
 out_m1_release:
@@ -246,40 +352,46 @@ out:
 	return err;
 }
 
-error_t
+hypercall_memextent_donate_result_t
 hypercall_memextent_donate(memextent_donate_options_t options, cap_id_t from,
 			   cap_id_t to, size_t offset, size_t size)
 {
-	error_t err;
+	hypercall_memextent_donate_result_t ret = { .error = OK };
 
 	if (memextent_donate_options_get_res_0(&options) != 0U) {
-		err = ERROR_ARGUMENT_INVALID;
+		ret.error = ERROR_ARGUMENT_INVALID;
 		goto out;
 	}
 
+	bool preemptible = memextent_donate_options_get_preemptible(&options);
+
 	memextent_donate_type_t type =
 		memextent_donate_options_get_type(&options);
 	if (type == MEMEXTENT_DONATE_TYPE_TO_CHILD) {
-		err = hypercall_memextent_donate_child(from, to, offset, size,
-						       false);
+		ret.error = hypercall_memextent_donate_child(
+			from, to, offset, size, false, preemptible,
+			&ret.progress);
 	} else if (type == MEMEXTENT_DONATE_TYPE_TO_PARENT) {
-		err = hypercall_memextent_donate_child(to, from, offset, size,
-						       true);
+		ret.error = hypercall_memextent_donate_child(
+			to, from, offset, size, true, preemptible,
+			&ret.progress);
 	} else if (type == MEMEXTENT_DONATE_TYPE_TO_SIBLING) {
-		err = hypercall_memextent_donate_sibling(from, to, offset,
-							 size);
+		ret.error = hypercall_memextent_donate_sibling(
+			from, to, offset, size, preemptible, &ret.progress);
 	} else {
-		err = ERROR_ARGUMENT_INVALID;
+		ret.error = ERROR_ARGUMENT_INVALID;
 	}
 
-	if ((err == OK) && !memextent_donate_options_get_no_sync(&options)) {
-		// The donation may have caused addrspace mappings to change.
+	if (((ret.error == OK) || (ret.progress != 0U)) &&
+	    !memextent_donate_options_get_no_sync(&options)) {
+		// The donation may have caused addrspace mappings to change,
+		// even if a preemptible donation did not complete.
 		// Wait for completion of EL2 operations using manual lookups.
 		rcu_sync();
 	}
 
 out:
-	return err;
+	return ret;
 }
 
 #else
@@ -16,10 +16,16 @@
 #include <partition.h>
 #include <partition_alloc.h>
 #include <pgtable.h>
+#include <preempt.h>
 #include <rcu.h>
 #include <spinlock.h>
 #include <util.h>
 
+#if defined(INTERFACE_VCPU)
+#include <thread.h>
+#include <vcpu.h>
+#endif
+
 #include <events/memextent.h>
 #include <events/object.h>
 
@@ -27,6 +33,7 @@
 #include <asm/cpu.h>
 
 #include "event_handlers.h"
+#include "memextent_zero_pool.h"
 
 error_t
 memextent_handle_object_create_memextent(memextent_create_t params)
@@ -38,6 +45,10 @@ memextent_handle_object_create_memextent(memextent_create_t params)
 
 	memextent->device_mem = params.memextent_device_mem;
 
+	// The extent doesn't own any memory until it is activated.
+	memdb_index_init(&memextent->memdb_index,
+			 memextent->header.partition);
+
 	return OK;
 }
 
@@ -321,6 +332,11 @@ memextent_donate_child(memextent_t *me, size_t offset, size_t size,
 		goto out;
 	}
 
+#if defined(MEMEXTENT_ZERO_POOL)
+	memextent_zero_pool_prepare_move(me, reverse ? me->parent : me, phys,
+					 size);
+#endif
+
 	ret = trigger_memextent_donate_child_event(me->type, me, phys, size,
 						   reverse);
 
@@ -364,6 +380,10 @@ memextent_donate_sibling(memextent_t *from, memextent_t *to, size_t offset,
 		goto out;
 	}
 
+#if defined(MEMEXTENT_ZERO_POOL)
+	memextent_zero_pool_prepare_move(from, to, phys, size);
+#endif
+
 	ret = trigger_memextent_donate_sibling_event(from->type, from, to, phys,
 						     size);
 
@@ -406,8 +426,15 @@ memextent_map(memextent_t *extent, addrspace_t *addrspace, vmaddr_t vm_base,
 	if (addrspace->read_only) {
 		ret = ERROR_DENIED;
 	} else {
+#if defined(MEMEXTENT_ZERO_POOL)
+		memextent_zero_pool_begin_access(extent, extent->phys_base,
+						 extent->size);
+#endif
 		ret = trigger_memextent_map_event(
 			extent->type, extent, addrspace, vm_base, map_attrs);
+#if defined(MEMEXTENT_ZERO_POOL)
+		memextent_zero_pool_end_access(extent);
+#endif
 	}
 
 out:
@@ -447,10 +474,17 @@ memextent_map_partial(memextent_t *extent, addrspace_t *addrspace,
 	if (addrspace->read_only) {
 		ret = ERROR_DENIED;
 	} else {
+#if defined(MEMEXTENT_ZERO_POOL)
+		memextent_zero_pool_begin_access(
+			extent, extent->phys_base + offset, size);
+#endif
 		ret = trigger_memextent_map_partial_event(extent->type, extent,
 							  addrspace, vm_base,
 							  offset, size,
 							  map_attrs);
+#if defined(MEMEXTENT_ZERO_POOL)
+		memextent_zero_pool_end_access(extent);
+#endif
 	}
 
 out:
@@ -521,7 +555,7 @@ memextent_unmap_all(memextent_t *extent)
 	}
 }
 
-static error_t
+error_t
 memextent_do_clean(paddr_t base, size_t size, void *arg)
 {
 	memextent_clean_flags_t *flags = (memextent_clean_flags_t *)arg;
@@ -581,6 +615,15 @@ memextent_clean_range(memextent_t *extent, size_t offset, size_t size,
 		goto out;
 	}
 
+#if defined(MEMEXTENT_ZERO_POOL)
+	if (memextent_clean_flags_get_zero(&flags)) {
+		err = memextent_clean_flags_get_deferred(&flags)
+			      ? memextent_zero_pool_defer(extent, phys, size)
+			      : memextent_zero_pool_zero(extent, phys, size);
+		goto out;
+	}
+#endif
+
 	err = memdb_range_walk((uintptr_t)extent, MEMDB_TYPE_EXTENT, phys,
 			       phys + size - 1U, memextent_do_clean, &flags);
 
@@ -597,6 +640,16 @@ memextent_zero_range(memextent_t *extent, size_t offset, size_t size)
 	return memextent_clean_range(extent, offset, size, flags);
 }
 
+error_t
+memextent_zero_range_deferred(memextent_t *extent, size_t offset, size_t size)
+{
+	memextent_clean_flags_t flags = memextent_clean_flags_default();
+	memextent_clean_flags_set_zero(&flags, true);
+	memextent_clean_flags_set_deferred(&flags, true);
+
+	return memextent_clean_range(extent, offset, size, flags);
+}
+
 error_t
 memextent_cache_clean_range(memextent_t *me, size_t offset, size_t size)
 {
@@ -613,6 +666,51 @@ memextent_cache_flush_range(memextent_t *me, size_t offset, size_t size)
 	return memextent_clean_range(me, offset, size, flags);
 }
 
+error_t
+memextent_preempt_range(size_t base, size_t size, memextent_preempt_fnptr fn,
+			void *arg, size_t *progress)
+{
+	error_t err = OK;
+
+	// The first piece is always attempted, so an empty range is passed to
+	// fn to be validated.
+	*progress = 0U;
+	do {
+		size_t curr  = base + *progress;
+		size_t piece = MEMEXTENT_PREEMPT_PIECE -
+			       (curr & (MEMEXTENT_PREEMPT_PIECE - 1U));
+		piece	     = util_min(piece, size - *progress);
+
+		err = fn(*progress, piece, arg);
+		if (err == OK) {
+			*progress += piece;
+		}
+	} while ((err == OK) && (*progress < size) &&
+		 !memextent_preempt_check());
+
+	if ((err == OK) && (*progress < size)) {
+		err = ERROR_RETRY;
+	}
+
+	return err;
+}
+
+bool
+memextent_preempt_check(void)
+{
+	bool ret = false;
+
+#if defined(INTERFACE_VCPU)
+	preempt_disable();
+	if (thread_get_self()->kind == THREAD_KIND_VCPU) {
+		ret = vcpu_pending_wakeup();
+	}
+	preempt_enable();
+#endif
+
+	return ret;
+}
+
 static bool
 memextent_check_access_attrs(memextent_t	     *extent,
 			     memextent_access_attrs_t access_attrs)
@@ -645,8 +743,15 @@ memextent_update_access(memextent_t *extent, addrspace_t *addrspace,
 	if (addrspace->read_only) {
 		ret = ERROR_DENIED;
 	} else {
+#if defined(MEMEXTENT_ZERO_POOL)
+		memextent_zero_pool_begin_access(extent, extent->phys_base,
+						 extent->size);
+#endif
 		ret = trigger_memextent_update_access_event(
 			extent->type, extent, addrspace, vm_base, access_attrs);
+#if defined(MEMEXTENT_ZERO_POOL)
+		memextent_zero_pool_end_access(extent);
+#endif
 	}
 
 out:
@@ -686,9 +791,16 @@ memextent_update_access_partial(memextent_t *extent, addrspace_t *addrspace,
 	if (addrspace->read_only) {
 		ret = ERROR_DENIED;
 	} else {
+#if defined(MEMEXTENT_ZERO_POOL)
+		memextent_zero_pool_begin_access(
+			extent, extent->phys_base + offset, size);
+#endif
 		ret = trigger_memextent_update_access_partial_event(
 			extent->type, extent, addrspace, vm_base, offset, size,
 			access_attrs);
+#if defined(MEMEXTENT_ZERO_POOL)
+		memextent_zero_pool_end_access(extent);
+#endif
 	}
 
 out:
@@ -708,6 +820,16 @@ memextent_is_mapped(memextent_t *me, addrspace_t *addrspace, bool exclusive)
 void
 memextent_handle_object_deactivate_memextent(memextent_t *memextent)
 {
+#if defined(MEMEXTENT_ZERO_POOL)
+	// The memory returns to the parent, or to the partition for a root
+	// extent, in which case it has no zeroing state left.
+	if (memextent->parent != NULL) {
+		memextent_zero_pool_prepare_move(memextent, memextent->parent,
+						 memextent->phys_base,
+						 memextent->size);
+	}
+#endif
+
 	if (!trigger_memextent_deactivate_event(memextent->type, memextent)) {
 		panic("Invalid memory extent deactivate!");
 	}
@@ -724,6 +846,17 @@ memextent_handle_object_cleanup_memextent(memextent_t *memextent)
 		object_put_memextent(memextent->parent);
 		memextent->parent = NULL;
 	}
+
+	memdb_index_destroy(&memextent->memdb_index);
+}
+
+memdb_index_t *
+memextent_handle_memdb_get_index(uintptr_t object)
+{
+	memextent_t *memextent = (memextent_t *)object;
+	assert(memextent != NULL);
+
+	return &memextent->memdb_index;
 }
 
 size_result_t
@@ -904,8 +1037,15 @@ memextent_attach(partition_t *owner, memextent_t *me, uintptr_t hyp_va,
 		goto out;
 	}
 
+#if defined(MEMEXTENT_ZERO_POOL)
+	memextent_zero_pool_begin_access(me, me->phys_base, size);
+#endif
+
 	ret = trigger_memextent_attach_event(me->type, me, hyp_va, size,
 					     memtype);
+#if defined(MEMEXTENT_ZERO_POOL)
+	memextent_zero_pool_end_access(me);
+#endif
 out:
 	return ret;
 }
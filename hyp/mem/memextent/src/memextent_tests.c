@@ -23,6 +23,7 @@
 #include <pgtable.h>
 #include <spinlock.h>
 #include <trace.h>
+#include <util.h>
 
 #include <events/object.h>
 
@@ -530,6 +531,129 @@ tests_memextent_test2(paddr_t phys_base)
 	return ret;
 }
 
+#if defined(MEMEXTENT_ZERO_POOL)
+static bool
+tests_find_free_chunk(paddr_t *chunk_base)
+{
+	test_free_range_t free_range = { { 0 }, { 0 }, 0, { 0 } };
+
+	error_t err = memdb_walk((uintptr_t)partition, MEMDB_TYPE_PARTITION,
+				 get_free_mem_range, (void *)&free_range);
+	if (err != OK) {
+		panic("Failed mem walk");
+	}
+
+	bool found = false;
+
+	for (index_t i = 0; !found && (i < free_range.count); i++) {
+		paddr_t base = util_balign_up(free_range.phys_base[i],
+					      MEMEXTENT_ZERO_POOL_CHUNK);
+		size_t	skip = base - free_range.phys_base[i];
+
+		if ((base >= free_range.phys_base[i]) &&
+		    (free_range.size[i] >= skip) &&
+		    ((free_range.size[i] - skip) >=
+		     MEMEXTENT_ZERO_POOL_CHUNK)) {
+			*chunk_base = base;
+			found	    = true;
+		}
+	}
+
+	return found;
+}
+
+// Returns true if the chunk at the given address is pending, being zeroed or
+// known to be zero.
+static bool
+tests_zero_pool_chunk_queued(memextent_t *me, paddr_t phys)
+{
+	bool	queued = false;
+	index_t i      = (index_t)((phys - me->phys_base) /
+				   MEMEXTENT_ZERO_POOL_CHUNK);
+
+	spinlock_acquire(&me->zero_pool_lock);
+	if (me->zero_pool_pending != NULL) {
+		queued = bitmap_isset(me->zero_pool_pending, i) ||
+			 bitmap_isset(me->zero_pool_busy, i) ||
+			 bitmap_isset(me->zero_pool_zeroed, i);
+	}
+	spinlock_release(&me->zero_pool_lock);
+
+	return queued;
+}
+
+static void
+tests_memextent_zero_pool(paddr_t phys_base)
+{
+	error_t	 err;
+	size_t	 size	 = MEMEXTENT_ZERO_POOL_CHUNK;
+	vmaddr_t vm_base = phys_base;
+
+	memextent_t *me = create_memextent(phys_base, size,
+					   MEMEXTENT_MEMTYPE_ANY,
+					   PGTABLE_ACCESS_RW);
+
+	memextent_mapping_attrs_t map_attrs;
+
+	memextent_mapping_attrs_set_user_access(&map_attrs, PGTABLE_ACCESS_RW);
+	memextent_mapping_attrs_set_kernel_access(&map_attrs,
+						  PGTABLE_ACCESS_RW);
+	memextent_mapping_attrs_set_memtype(&map_attrs,
+					    PGTABLE_VM_MEMTYPE_NORMAL_WB);
+
+	// An unmapped whole chunk is zeroed in the background.
+	err = memextent_zero_range_deferred(me, 0U, size);
+	if (err != OK) {
+		panic("Failed deferred zeroing of mem extent");
+	}
+	if (!tests_zero_pool_chunk_queued(me, phys_base)) {
+		panic("Unmapped chunk not queued for zeroing");
+	}
+
+	// Mapping the extent discards the chunk's zeroing state.
+	err = memextent_map(me, as, vm_base, map_attrs);
+	if (err != OK) {
+		panic("Failed mapping of mem extent");
+	}
+	if (tests_zero_pool_chunk_queued(me, phys_base)) {
+		panic("Mapped chunk still queued for zeroing");
+	}
+
+	// A mapped chunk is zeroed synchronously instead.
+	err = memextent_zero_range_deferred(me, 0U, size);
+	if (err != OK) {
+		panic("Failed deferred zeroing of mapped mem extent");
+	}
+	if (tests_zero_pool_chunk_queued(me, phys_base)) {
+		panic("Mapped chunk queued for zeroing");
+	}
+
+	err = memextent_unmap(me, as, vm_base);
+	if (err != OK) {
+		panic("Failed unmapping of mem extent");
+	}
+
+	// Synchronous zeroing takes over a chunk that is still pending.
+	err = memextent_zero_range_deferred(me, 0U, size);
+	if (err != OK) {
+		panic("Failed deferred zeroing of mem extent");
+	}
+	err = memextent_zero_range(me, 0U, size);
+	if (err != OK) {
+		panic("Failed zeroing of mem extent");
+	}
+
+	spinlock_acquire(&me->zero_pool_lock);
+	if (bitmap_isset(me->zero_pool_pending, 0U) ||
+	    bitmap_isset(me->zero_pool_busy, 0U)) {
+		panic("Zeroed chunk still pending");
+	}
+	spinlock_release(&me->zero_pool_lock);
+
+	object_put_memextent(me);
+}
+#endif
+
 bool
 tests_memextent(void)
 {
@@ -564,6 +688,14 @@ tests_memextent(void)
 	phys_base = tests_find_free_range();
 
 	tests_memextent_test2(phys_base);
+
+#if defined(MEMEXTENT_ZERO_POOL)
+	if (tests_find_free_chunk(&phys_base)) {
+		tests_memextent_zero_pool(phys_base);
+	} else {
+		LOG(DEBUG, INFO, "Memextent zero pool tests skipped");
+	}
+#endif
 	spinlock_acquire_nopreempt(&test_memextent_spinlock);
 	tests_memextent_count++;
 	spinlock_release_nopreempt(&test_memextent_spinlock);
@@ -0,0 +1,637 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#if defined(MEMEXTENT_ZERO_POOL)
+
+#include <assert.h>
+#include <hyptypes.h>
+#include <string.h>
+
+#include <hypcontainers.h>
+
+#include <bitmap.h>
+#include <compiler.h>
+#include <cpulocal.h>
+#include <hyp_aspace.h>
+#include <list.h>
+#include <memdb.h>
+#include <memextent.h>
+#include <object.h>
+#include <panic.h>
+#include <partition.h>
+#include <partition_alloc.h>
+#include <scheduler.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <util.h>
+
+#include "event_handlers.h"
+#include "memextent_zero_pool.h"
+
+// Background zeroing pool.
+//
+// Memory that is no longer in use can be queued for zeroing with the deferred
+// zero operation. A minimum priority thread on each CPU zeroes the queued
+// memory while the CPU has nothing else to run, and records it as zero. The
+// synchronous zero operation then skips memory that is known to be zero, so
+// most of the cost of zeroing is moved out of VM creation.
+//
+// The state is tracked in naturally aligned chunks, with a set of bitmaps in
+// each root extent that cover all extents derived from it. A chunk may only be
+// recorded as zero while nothing can write to it, so its state is discarded
+// before it becomes accessible through a mapping or a hypervisor attachment,
+// and before it leaves the extent tree.
+
+static spinlock_t memextent_zero_pool_list_lock;
+static list_t	  memextent_zero_pool_list
+	PROTECTED_BY(memextent_zero_pool_list_lock);
+
+static uintptr_t memextent_zero_pool_stack_base;
+
+CPULOCAL_DECLARE_STATIC(thread_t *, memextent_zero_pool_thread);
+
+error_t
+memextent_zero_pool_handle_object_create_memextent(memextent_create_t params)
+{
+	memextent_t *me = params.memextent;
+	assert(me != NULL);
+
+	spinlock_init(&me->zero_pool_lock);
+
+	return OK;
+}
+
+void
+memextent_zero_pool_handle_object_cleanup_memextent(memextent_t *me)
+{
+	assert(me != NULL);
+	assert(!me->zero_pool_queued);
+
+	if (me->zero_pool_pending != NULL) {
+		size_t words = BITMAP_NUM_WORDS(me->zero_pool_chunks);
+
+		(void)partition_free(me->header.partition,
+				     me->zero_pool_pending,
+				     3U * words * sizeof(register_t));
+		me->zero_pool_pending = NULL;
+		me->zero_pool_busy    = NULL;
+		me->zero_pool_zeroed  = NULL;
+	}
+}
+
+static memextent_t *
+memextent_zero_pool_root(memextent_t *me)
+{
+	memextent_t *root = me;
+
+	while (root->parent != NULL) {
+		root = root->parent;
+	}
+
+	return root;
+}
+
+static paddr_t
+memextent_zero_pool_base(const memextent_t *root)
+{
+	return util_balign_down(root->phys_base, MEMEXTENT_ZERO_POOL_CHUNK);
+}
+
+static index_t
+memextent_zero_pool_index(const memextent_t *root, paddr_t phys)
+{
+	assert(phys >= root->phys_base);
+
+	index_t i = (index_t)((phys - memextent_zero_pool_base(root)) /
+			      MEMEXTENT_ZERO_POOL_CHUNK);
+	assert(i < root->zero_pool_chunks);
+
+	return i;
+}
+
+// Returns the size of the part of a range that lies within its first chunk.
+static size_t
+memextent_zero_pool_piece(paddr_t phys, size_t size)
+{
+	paddr_t chunk_end = util_balign_down(phys, MEMEXTENT_ZERO_POOL_CHUNK) +
+			    MEMEXTENT_ZERO_POOL_CHUNK;
+
+	return util_min((size_t)(chunk_end - phys), size);
+}
+
+static error_t
+memextent_zero_pool_alloc(memextent_t *root)
+{
+	error_t err = OK;
+
+	spinlock_acquire(&root->zero_pool_lock);
+	bool allocated = root->zero_pool_pending != NULL;
+	spinlock_release(&root->zero_pool_lock);
+
+	if (allocated) {
+		goto out;
+	}
+
+	paddr_t last = util_balign_down(root->phys_base + (root->size - 1U),
+					MEMEXTENT_ZERO_POOL_CHUNK);
+	count_t chunks =
+		(count_t)(((last - memextent_zero_pool_base(root)) /
+			   MEMEXTENT_ZERO_POOL_CHUNK) +
+			  1U);
+	size_t words	  = BITMAP_NUM_WORDS(chunks);
+	size_t alloc_size = 3U * words * sizeof(register_t);
+
+	void_ptr_result_t alloc_r = partition_alloc(
+		root->header.partition, alloc_size, alignof(register_t));
+	if (alloc_r.e != OK) {
+		err = alloc_r.e;
+		goto out;
+	}
+	(void)memset_s(alloc_r.r, alloc_size, 0, alloc_size);
+
+	register_t *bitmaps = (register_t *)alloc_r.r;
+
+	spinlock_acquire(&root->zero_pool_lock);
+	if (root->zero_pool_pending == NULL) {
+		root->zero_pool_chunks	= chunks;
+		root->zero_pool_pending = bitmaps;
+		root->zero_pool_busy	= &bitmaps[words];
+		root->zero_pool_zeroed	= &bitmaps[2U * words];
+		bitmaps			= NULL;
+	}
+	spinlock_release(&root->zero_pool_lock);
+
+	if (bitmaps != NULL) {
+		// Another thread allocated the bitmaps concurrently.
+		(void)partition_free(root->header.partition, bitmaps,
+				     alloc_size);
+	}
+
+out:
+	return err;
+}
+
+static bool
+memextent_zero_pool_is_mapped(memextent_t *me, paddr_t phys, size_t size)
+	REQUIRE_LOCK(me->lock)
+{
+	bool mapped = false;
+
+	memextent_retain_mappings(me);
+
+	for (index_t i = 0U; !mapped && (i < MEMEXTENT_MAX_MAPS); i++) {
+		paddr_t curr	  = phys;
+		size_t	remaining = size;
+
+		while (!mapped && (remaining > 0U)) {
+			memextent_mapping_t map = memextent_lookup_mapping(
+				me, curr, remaining, i);
+
+			mapped = map.addrspace != NULL;
+			curr += map.size;
+			remaining -= map.size;
+		}
+	}
+
+	memextent_release_mappings(me, false);
+
+	return mapped;
+}
+
+static void
+memextent_zero_pool_wake(void)
+{
+	bool need_schedule = false;
+
+	for (cpu_index_t i = 0U; cpulocal_index_valid(i); i++) {
+		thread_t *thread =
+			CPULOCAL_BY_INDEX(memextent_zero_pool_thread, i);
+
+		scheduler_lock(thread);
+		if (scheduler_unblock(thread, SCHEDULER_BLOCK_MEMEXTENT_ZERO)) {
+			need_schedule = true;
+		}
+		scheduler_unlock(thread);
+	}
+
+	if (need_schedule) {
+		(void)scheduler_schedule();
+	}
+}
+
+static void
+memextent_zero_pool_queue(memextent_t *root)
+{
+	spinlock_acquire(&memextent_zero_pool_list_lock);
+	if (!root->zero_pool_queued) {
+		root->zero_pool_queued = true;
+		(void)object_get_memextent_additional(root);
+		list_insert_at_tail(&memextent_zero_pool_list,
+				    &root->zero_pool_list_node);
+	}
+	spinlock_release(&memextent_zero_pool_list_lock);
+
+	memextent_zero_pool_wake();
+}
+
+static void
+memextent_zero_pool_dequeue(memextent_t *root)
+{
+	bool removed = false;
+
+	spinlock_acquire(&memextent_zero_pool_list_lock);
+	spinlock_acquire_nopreempt(&root->zero_pool_lock);
+	if (root->zero_pool_queued &&
+	    bitmap_empty(root->zero_pool_pending, root->zero_pool_chunks)) {
+		(void)list_delete_node(&memextent_zero_pool_list,
+				       &root->zero_pool_list_node);
+		root->zero_pool_queued = false;
+		removed		       = true;
+	}
+	spinlock_release_nopreempt(&root->zero_pool_lock);
+	spinlock_release(&memextent_zero_pool_list_lock);
+
+	if (removed) {
+		object_put_memextent(root);
+	}
+}
+
+error_t
+memextent_zero_pool_zero(memextent_t *me, paddr_t phys, size_t size)
+{
+	memextent_t	       *root   = memextent_zero_pool_root(me);
+	memextent_clean_flags_t flags  = memextent_clean_flags_default();
+	error_t			err    = OK;
+	size_t			offset = 0U;
+
+	memextent_clean_flags_set_zero(&flags, true);
+
+	while ((err == OK) && (offset < size)) {
+		paddr_t curr  = phys + offset;
+		size_t	piece = memextent_zero_pool_piece(curr, size - offset);
+		bool	zero  = false;
+
+		spinlock_acquire(&root->zero_pool_lock);
+		if (root->zero_pool_pending != NULL) {
+			index_t i = memextent_zero_pool_index(root, curr);
+
+			if (bitmap_isset(root->zero_pool_zeroed, i)) {
+				zero = true;
+			} else if (piece == MEMEXTENT_ZERO_POOL_CHUNK) {
+				// The whole chunk is zeroed below, so the
+				// background thread doesn't need to.
+				bitmap_clear(root->zero_pool_pending, i);
+				bitmap_clear(root->zero_pool_busy, i);
+			} else {
+				// Part of the chunk may still be waiting to
+				// be zeroed in the background.
+			}
+		}
+		spinlock_release(&root->zero_pool_lock);
+
+		if (!zero) {
+			err = memdb_range_walk((uintptr_t)me,
+					       MEMDB_TYPE_EXTENT, curr,
+					       curr + (piece - 1U),
+					       memextent_do_clean, &flags);
+		}
+
+		offset += piece;
+	}
+
+	return err;
+}
+
+// Mark the whole chunks in a range that are owned by the extent as pending.
+// Returns true if any chunk was marked.
+static bool
+memextent_zero_pool_queue_chunks(memextent_t *me, memextent_t *root,
+				 paddr_t phys, size_t size)
+	REQUIRE_LOCK(me->lock)
+{
+	bool   queued = false;
+	size_t offset = 0U;
+
+	spinlock_acquire_nopreempt(&root->zero_pool_lock);
+	while (offset < size) {
+		paddr_t curr  = phys + offset;
+		size_t	piece = memextent_zero_pool_piece(curr, size - offset);
+
+		if ((piece == MEMEXTENT_ZERO_POOL_CHUNK) &&
+		    memdb_is_ownership_contiguous(curr, curr + (piece - 1U),
+						  (uintptr_t)me,
+						  MEMDB_TYPE_EXTENT)) {
+			index_t i = memextent_zero_pool_index(root, curr);
+
+			if (!bitmap_isset(root->zero_pool_zeroed, i) &&
+			    !bitmap_isset(root->zero_pool_busy, i)) {
+				bitmap_set(root->zero_pool_pending, i);
+				queued = true;
+			}
+		}
+
+		offset += piece;
+	}
+	spinlock_release_nopreempt(&root->zero_pool_lock);
+
+	return queued;
+}
+
+error_t
+memextent_zero_pool_defer(memextent_t *me, paddr_t phys, size_t size)
+{
+	memextent_t	       *root   = memextent_zero_pool_root(me);
+	memextent_clean_flags_t flags  = memextent_clean_flags_default();
+	error_t			err    = OK;
+	size_t			offset = 0U;
+	bool			queued = false;
+
+	memextent_clean_flags_set_zero(&flags, true);
+
+	if (memextent_zero_pool_alloc(root) != OK) {
+		err = memextent_zero_pool_zero(me, phys, size);
+		goto out;
+	}
+
+	// Memory that can still be written through a mapping or attachment
+	// can't be zeroed in the background, because the writes might be lost.
+	// The extent's lock is held until the chunks are queued, so an
+	// operation that makes the memory writable either prevents them from
+	// being queued, or invalidates them after they are queued and before
+	// the memory becomes writable.
+	spinlock_acquire(&me->lock);
+	if ((me->attached_size == 0U) && (me->zero_pool_accessors == 0U) &&
+	    !memextent_zero_pool_is_mapped(me, phys, size)) {
+		queued = memextent_zero_pool_queue_chunks(me, root, phys, size);
+	}
+	spinlock_release(&me->lock);
+
+	// Zero anything that was not queued now. A queued chunk may have been
+	// invalidated since it was queued, in which case it is zeroed here.
+	while ((err == OK) && (offset < size)) {
+		paddr_t curr  = phys + offset;
+		size_t	piece = memextent_zero_pool_piece(curr, size - offset);
+		bool	skip  = false;
+
+		if (piece == MEMEXTENT_ZERO_POOL_CHUNK) {
+			index_t i = memextent_zero_pool_index(root, curr);
+
+			spinlock_acquire(&root->zero_pool_lock);
+			skip = bitmap_isset(root->zero_pool_pending, i) ||
+			       bitmap_isset(root->zero_pool_busy, i) ||
+			       bitmap_isset(root->zero_pool_zeroed, i);
+			spinlock_release(&root->zero_pool_lock);
+		}
+
+		if (!skip) {
+			err = memdb_range_walk((uintptr_t)me,
+					       MEMDB_TYPE_EXTENT, curr,
+					       curr + (piece - 1U),
+					       memextent_do_clean, &flags);
+		}
+
+		offset += piece;
+	}
+
+	if (queued) {
+		memextent_zero_pool_queue(root);
+	}
+
+out:
+	return err;
+}
+
+void
+memextent_zero_pool_begin_access(memextent_t *me, paddr_t phys, size_t size)
+{
+	spinlock_acquire(&me->lock);
+	me->zero_pool_accessors++;
+	spinlock_release(&me->lock);
+
+	memextent_zero_pool_invalidate(me, phys, size);
+}
+
+void
+memextent_zero_pool_end_access(memextent_t *me)
+{
+	spinlock_acquire(&me->lock);
+	assert(me->zero_pool_accessors > 0U);
+	me->zero_pool_accessors--;
+	spinlock_release(&me->lock);
+}
+
+void
+memextent_zero_pool_invalidate(memextent_t *me, paddr_t phys, size_t size)
+{
+	memextent_t *root = memextent_zero_pool_root(me);
+
+	// Holding the lock also ensures that the background thread is not
+	// writing to any of the chunks; it checks their busy bits with the
+	// lock held before zeroing each block.
+	spinlock_acquire(&root->zero_pool_lock);
+	if (root->zero_pool_pending != NULL) {
+		index_t first = memextent_zero_pool_index(root, phys);
+		index_t last  = memextent_zero_pool_index(root,
+							  phys + (size - 1U));
+
+		for (index_t i = first; i <= last; i++) {
+			bitmap_clear(root->zero_pool_pending, i);
+			bitmap_clear(root->zero_pool_busy, i);
+			bitmap_clear(root->zero_pool_zeroed, i);
+		}
+	}
+	spinlock_release(&root->zero_pool_lock);
+}
+
+void
+memextent_zero_pool_prepare_move(memextent_t *me, memextent_t *receiver,
+				 paddr_t phys, size_t size)
+{
+	bool invalidate = true;
+
+	if (receiver != NULL) {
+		spinlock_acquire(&receiver->lock);
+		invalidate = memextent_zero_pool_is_mapped(receiver, phys,
+							   size);
+		spinlock_release(&receiver->lock);
+	}
+
+	if (invalidate) {
+		memextent_zero_pool_invalidate(me, phys, size);
+	}
+}
+
+// Claim the first chunk of a root extent that is waiting to be zeroed.
+static bool
+memextent_zero_pool_claim(memextent_t *root, index_t *chunk)
+{
+	spinlock_acquire(&root->zero_pool_lock);
+	bool found = bitmap_ffs(root->zero_pool_pending,
+				root->zero_pool_chunks, chunk);
+	if (found) {
+		bitmap_clear(root->zero_pool_pending, *chunk);
+		bitmap_set(root->zero_pool_busy, *chunk);
+	}
+	spinlock_release(&root->zero_pool_lock);
+
+	return found;
+}
+
+static void
+memextent_zero_pool_zero_chunk(memextent_t *root, index_t chunk)
+{
+	memextent_clean_flags_t flags = memextent_clean_flags_default();
+	paddr_t			base  = memextent_zero_pool_base(root) +
+			 ((paddr_t)chunk * MEMEXTENT_ZERO_POOL_CHUNK);
+	bool busy = true;
+
+	memextent_clean_flags_set_zero(&flags, true);
+
+	// The busy bit is cleared if the chunk is invalidated, in which case
+	// it must not be written again. Each block is zeroed with the lock
+	// held, so the invalidation can't overlap it, and preemption is only
+	// possible between blocks.
+	for (size_t offset = 0U; busy && (offset < MEMEXTENT_ZERO_POOL_CHUNK);
+	     offset += MEMEXTENT_ZERO_POOL_BLOCK) {
+		spinlock_acquire(&root->zero_pool_lock);
+		busy = bitmap_isset(root->zero_pool_busy, chunk);
+		if (busy) {
+			(void)memextent_do_clean(base + offset,
+						 MEMEXTENT_ZERO_POOL_BLOCK,
+						 &flags);
+		}
+		spinlock_release(&root->zero_pool_lock);
+	}
+
+	spinlock_acquire(&root->zero_pool_lock);
+	if (bitmap_isset(root->zero_pool_busy, chunk)) {
+		bitmap_clear(root->zero_pool_busy, chunk);
+		bitmap_set(root->zero_pool_zeroed, chunk);
+	}
+	spinlock_release(&root->zero_pool_lock);
+}
+
+static noreturn void
+memextent_zero_pool_main(uintptr_t unused_params)
+{
+	thread_t *self = thread_get_self();
+
+	(void)unused_params;
+
+	do {
+		memextent_t *root = NULL;
+
+		spinlock_acquire(&memextent_zero_pool_list_lock);
+		list_node_t *node = list_get_head(&memextent_zero_pool_list);
+		if (node != NULL) {
+			root = memextent_container_of_zero_pool_list_node(node);
+			(void)object_get_memextent_additional(root);
+		} else {
+			// Sleep until more work is queued. The block is set
+			// with the list lock held, so a concurrent queue
+			// operation can't miss it.
+			scheduler_lock_nopreempt(self);
+			scheduler_block(self, SCHEDULER_BLOCK_MEMEXTENT_ZERO);
+			scheduler_unlock_nopreempt(self);
+		}
+		spinlock_release(&memextent_zero_pool_list_lock);
+
+		if (root == NULL) {
+			(void)scheduler_schedule();
+		} else {
+			index_t chunk;
+
+			while (memextent_zero_pool_claim(root, &chunk)) {
+				memextent_zero_pool_zero_chunk(root, chunk);
+			}
+
+			memextent_zero_pool_dequeue(root);
+			object_put_memextent(root);
+		}
+	} while (1);
+}
+
+void
+memextent_zero_pool_init(void)
+{
+	spinlock_init(&memextent_zero_pool_list_lock);
+	list_init(&memextent_zero_pool_list);
+
+	size_t aspace_size =
+		THREAD_STACK_MAP_ALIGN * ((size_t)PLATFORM_MAX_CORES + 1U);
+
+	virt_range_result_t stack_range = hyp_aspace_allocate(aspace_size);
+	if (stack_range.e != OK) {
+		panic("Unable to allocate address space for zeroing stacks");
+	}
+
+	// Start the stack range at the next alignment boundary to ensure we
+	// have guard pages before the first mapped stack.
+	memextent_zero_pool_stack_base =
+		util_balign_up(stack_range.r.base + 1U, THREAD_STACK_MAP_ALIGN);
+
+	for (cpu_index_t i = 0U; cpulocal_index_valid(i); i++) {
+		thread_create_t params = {
+			.scheduler_affinity	  = i,
+			.scheduler_affinity_valid = true,
+			.scheduler_priority	  = SCHEDULER_MIN_PRIORITY,
+			.scheduler_priority_valid = true,
+			.kind			  = THREAD_KIND_MEMEXTENT_ZERO,
+		};
+
+		thread_ptr_result_t ret = partition_allocate_thread(
+			partition_get_private(), params);
+		if (ret.e != OK) {
+			panic("Unable to create zeroing thread");
+		}
+
+		if (object_activate_thread(ret.r) != OK) {
+			panic("Error activating zeroing thread");
+		}
+
+		// The thread stays blocked until work is queued. Its reference
+		// is kept for the lifetime of the hypervisor.
+		CPULOCAL_BY_INDEX(memextent_zero_pool_thread, i) = ret.r;
+	}
+}
+
+error_t
+memextent_zero_pool_handle_object_create_thread(thread_create_t thread_create)
+{
+	thread_t *thread = thread_create.thread;
+	assert(thread != NULL);
+
+	if (thread->kind == THREAD_KIND_MEMEXTENT_ZERO) {
+		scheduler_block_init(thread, SCHEDULER_BLOCK_MEMEXTENT_ZERO);
+	}
+
+	return OK;
+}
+
+thread_func_t
+memextent_zero_pool_handle_thread_get_entry_fn(thread_kind_t kind)
+{
+	assert(kind == THREAD_KIND_MEMEXTENT_ZERO);
+
+	return memextent_zero_pool_main;
+}
+
+uintptr_t
+memextent_zero_pool_handle_thread_get_stack_base(thread_kind_t kind,
+						 thread_t     *thread)
+{
+	assert(kind == THREAD_KIND_MEMEXTENT_ZERO);
+	assert(thread != NULL);
+
+	cpu_index_t cpu = thread->scheduler_affinity;
+
+	return memextent_zero_pool_stack_base +
+	       ((uintptr_t)cpu * THREAD_STACK_MAP_ALIGN);
+}
+
+#else
+
+extern char unused;
+
+#endif
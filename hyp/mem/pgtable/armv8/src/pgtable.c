@@ -1559,6 +1559,10 @@ pgtable_maybe_update_access(pgtable_t	*pgt,
 
 	size_t updated_size = cur_phys - margs->phys;
 
+	if (margs->stage != PGTABLE_HYP_STAGE_1) {
+		margs->flush_stage1 = true;
+	}
+
 #if defined(ARCH_ARM_FEAT_TLBIRANGE)
 	if (margs->stage == PGTABLE_HYP_STAGE_1) {
 		dsb_st(false);
@@ -1716,6 +1720,7 @@ pgtable_split_block(pgtable_t *pgt, vmaddr_t virtual_address, size_t size,
 	} else {
 		dsb_st(margs->outer_shareable);
 		vm_tlbi_ipa(entry_virtual_address, margs->outer_shareable);
+		margs->flush_stage1 = true;
 		// The full stage-1 flushing below is really sub-optimal.
 		// FIXME:
 		dsb(margs->outer_shareable);
@@ -1819,6 +1824,7 @@ pgtable_split_block(pgtable_t *pgt, vmaddr_t virtual_address, size_t size,
 	} else {
 		dsb_st(margs->outer_shareable);
 		vm_tlbi_ipa(entry_virtual_address, margs->outer_shareable);
+		margs->flush_stage1 = true;
 	}
 #endif
 
@@ -2038,6 +2044,9 @@ pgtable_maybe_merge_block(pgtable_t *pgt, vmaddr_t virtual_address, size_t size,
 
 	// Flush the TLB entries for the merged pages.
 	vmaddr_t next_level_addr = entry_virtual_address;
+	if (margs->stage != PGTABLE_HYP_STAGE_1) {
+		margs->flush_stage1 = true;
+	}
 #ifdef ARCH_ARM_FEAT_TLBIRANGE
 	if (margs->stage == PGTABLE_HYP_STAGE_1) {
 		dsb_st(false);
@@ -4175,6 +4184,7 @@ pgtable_vm_init(partition_t *partition, pgtable_vm_t *pgtable, vmid_t vmid)
 	pgtable->control.start_level	  = info.level;
 	pgtable->control.start_level_size = info.size;
 	pgtable->issue_dvm_cmd		  = false;
+	pgtable->flush_stage1		  = false;
 
 	// allocate the level 0 page table
 	ret = alloc_level_table(partition, info.size,
@@ -4367,6 +4377,9 @@ pgtable_vm_map(partition_t *partition, pgtable_vm_t *pgtable,
 	if (!walk_ret && (margs.error == OK)) {
 		margs.error = ERROR_FAILURE;
 	}
+	if (margs.flush_stage1) {
+		pgtable->flush_stage1 = true;
+	}
 	if ((margs.error != OK) && (margs.partially_mapped_size != 0U)) {
 		pgtable_vm_unmap(partition, pgtable, virtual_address,
 				 margs.partially_mapped_size);
@@ -4417,6 +4430,8 @@ pgtable_vm_unmap(partition_t *partition, pgtable_vm_t *pgtable,
 	if (!walk_ret) {
 		panic("Error in pgtable_vm_unmap");
 	}
+
+	pgtable->flush_stage1 = true;
 }
 
 void
@@ -4456,6 +4471,8 @@ pgtable_vm_unmap_matching(partition_t *partition, pgtable_vm_t *pgtable,
 	if (!walk_ret) {
 		panic("Error in pgtable_vm_unmap_matching");
 	}
+
+	pgtable->flush_stage1 = true;
 }
 
 void
@@ -4499,10 +4516,14 @@ pgtable_vm_commit(pgtable_vm_t *pgtable) LOCK_IMPL
 #endif
 
 	dsb(pgtable->issue_dvm_cmd);
-	// This is only needed when unmapping. Consider some flags to
-	// track to flush requirements.
-	vm_tlbi_vmalle1(pgtable->issue_dvm_cmd);
-	dsb(pgtable->issue_dvm_cmd);
+	// Stage 1 TLB entries can only be stale if a valid stage 2 entry was
+	// removed or changed; translation faults are never cached, so new
+	// mappings of previously unmapped ranges don't need this flush.
+	if (pgtable->flush_stage1) {
+		vm_tlbi_vmalle1(pgtable->issue_dvm_cmd);
+		dsb(pgtable->issue_dvm_cmd);
+		pgtable->flush_stage1 = false;
+	}
 
 	thread_t *thread = thread_get_self();
 
@@ -1100,7 +1100,6 @@ gpt_is_contiguous(gpt_t *gpt, size_t base, size_t size, gpt_entry_t entry)
 	return ret;
 }
 
-#if defined(UNIT_TESTS)
 error_t
 gpt_walk(gpt_t *gpt, size_t base, size_t size, gpt_type_t type,
 	 gpt_callback_t callback, gpt_arg_t arg)
@@ -1130,7 +1129,6 @@ gpt_walk(gpt_t *gpt, size_t base, size_t size, gpt_type_t type,
 out:
 	return err;
 }
-#endif
 
 void
 gpt_dump_ranges(gpt_t *gpt)
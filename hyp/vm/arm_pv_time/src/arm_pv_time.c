@@ -19,6 +19,18 @@
 #error Unable to determine a unique VCPU index (vgic_gicr_index not present)
 #endif
 
+// The statistics array starts at the end of the info area layout, which must
+// be the end of the PV_TIME_ST array, so each VCPU's statistics are at a
+// fixed distance from its PV_TIME_ST structure.
+#define PV_TIME_STATS_OFFSET (size_t)ADDRSPACE_INFO_AREA_LAYOUT_SIZE
+
+static_assert(sizeof(pv_time_data_t) == 64U,
+	      "pv_time_data_t must match the PV_TIME_ST layout size");
+static_assert(offsetof(addrspace_info_area_layout_t,
+		       pv_time_data[PLATFORM_MAX_CORES]) ==
+		      PV_TIME_STATS_OFFSET,
+	      "pv_time_data must be last in the info area layout");
+
 bool
 smccc_pv_time_features(uint64_t arg1, uint64_t *ret0)
 {
@@ -108,12 +120,34 @@ arm_pv_time_handle_vcpu_activate_thread(thread_t *thread)
 		index_t index = thread->vgic_gicr_index;
 		assert(index < PLATFORM_MAX_CORES);
 		assert(thread->addrspace->info_area.hyp_va != NULL);
-		thread->arm_pv_time.data = &thread->addrspace->info_area.hyp_va
-						    ->pv_time_data[index];
+		addrspace_info_area_layout_t *layout =
+			thread->addrspace->info_area.hyp_va;
+
+		pv_time_data_t *data = &layout->pv_time_data[index];
+		data->revision	     = 0U;
+		data->attributes     = 0U;
+		atomic_init(&data->stolen_ns, 0U);
+		thread->arm_pv_time.data = data;
 
-		thread->arm_pv_time.data->revision   = 0U;
-		thread->arm_pv_time.data->attributes = 0U;
-		atomic_init(&thread->arm_pv_time.data->stolen_ns, 0U);
+		// The statistics are optional, and not published if the info
+		// area only covers the required layout.
+		size_t offset = PV_TIME_STATS_OFFSET +
+				((size_t)index * sizeof(pv_time_stats_t));
+		if ((offset + sizeof(pv_time_stats_t)) <=
+		    thread->addrspace->info_area.me->size) {
+			pv_time_stats_t *stats =
+				(pv_time_stats_t *)((uintptr_t)layout + offset);
+			stats->version = ARM_PV_TIME_STATS_VERSION;
+			stats->res0    = 0U;
+			atomic_init(&stats->wakeup_delay_ns, 0U);
+			atomic_init(&stats->preempt_delay_ns, 0U);
+			atomic_init(&stats->preempt_count, 0U);
+			atomic_init(&stats->switch_count, 0U);
+			atomic_init(&stats->last_delay_ns, 0U);
+			thread->arm_pv_time.stats = stats;
+		} else {
+			thread->arm_pv_time.stats = NULL;
+		}
 	}
 
 	return true;
@@ -136,6 +170,32 @@ arm_pv_time_handle_scheduler_schedule(thread_t *current, thread_t *yielded_from,
 	}
 }
 
+static void
+arm_pv_time_publish(arm_pv_time_t *pv_time, ticks_t delay)
+{
+	pv_time_data_t	*data  = pv_time->data;
+	pv_time_stats_t *stats = pv_time->stats;
+
+	atomic_store_relaxed(
+		&data->stolen_ns,
+		platform_timer_convert_ticks_to_ns(pv_time->stolen_ticks));
+
+	if (stats != NULL) {
+		atomic_store_relaxed(&stats->wakeup_delay_ns,
+				     platform_timer_convert_ticks_to_ns(
+					     pv_time->wakeup_delay_ticks));
+		atomic_store_relaxed(&stats->preempt_delay_ns,
+				     platform_timer_convert_ticks_to_ns(
+					     pv_time->preempt_delay_ticks));
+		atomic_store_relaxed(&stats->preempt_count,
+				     pv_time->preempt_count);
+		atomic_store_relaxed(&stats->switch_count,
+				     pv_time->switch_count);
+		atomic_store_relaxed(&stats->last_delay_ns,
+				     platform_timer_convert_ticks_to_ns(delay));
+	}
+}
+
 void
 arm_pv_time_handle_thread_context_switch_post(ticks_t curticks,
 					      ticks_t prevticks)
@@ -171,13 +231,23 @@ arm_pv_time_handle_thread_context_switch_post(ticks_t curticks,
 	assert((curticks >= adjusted_last_run) &&
 	       (curticks >= last_self_unblock));
 
+	// The switch was voluntary if the thread blocked itself or started a
+	// directed yield since it last ran.
+	ticks_t delay	  = curticks - steal_start;
+	bool	voluntary = (last_self_unblock > adjusted_last_run) ||
+			 (current->arm_pv_time.yield_time != 0U);
+	if (voluntary) {
+		current->arm_pv_time.wakeup_delay_ticks += delay;
+		current->arm_pv_time.switch_count++;
+	} else {
+		current->arm_pv_time.preempt_delay_ticks += delay;
+		current->arm_pv_time.preempt_count++;
+	}
+
 	current->arm_pv_time.yield_time = 0;
-	current->arm_pv_time.stolen_ticks += curticks - steal_start;
+	current->arm_pv_time.stolen_ticks += delay;
 	if (current->arm_pv_time.data != NULL) {
-		uint64_t stolen_ns = platform_timer_convert_ticks_to_ns(
-			current->arm_pv_time.stolen_ticks);
-		atomic_store_relaxed(&current->arm_pv_time.data->stolen_ns,
-				     stolen_ns);
+		arm_pv_time_publish(&current->arm_pv_time, delay);
 	}
 }
 
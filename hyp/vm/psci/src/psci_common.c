@@ -957,6 +957,48 @@ vpm_attach(vpm_group_t *pg, thread_t *thread, index_t index)
 	return err;
 }
 
+thread_ptr_result_t
+vpm_get_sibling_vcpu(const thread_t *vcpu, index_t index)
+{
+	thread_ptr_result_t ret;
+	vpm_group_t	   *pg = vcpu->psci_group;
+
+	assert(vcpu->kind == THREAD_KIND_VCPU);
+
+	if (pg == NULL) {
+		ret = thread_ptr_result_error(ERROR_OBJECT_CONFIG);
+		goto out;
+	}
+
+	if (index >= util_array_size(pg->psci_cpus)) {
+		ret = thread_ptr_result_error(ERROR_ARGUMENT_INVALID);
+		goto out;
+	}
+
+	ret = thread_ptr_result_error(ERROR_ARGUMENT_INVALID);
+
+	rcu_read_start();
+	thread_t *thread = atomic_load_consume(&pg->psci_cpus[index]);
+	if ((thread != NULL) && object_get_thread_safe(thread)) {
+		ret = thread_ptr_result_ok(thread);
+	}
+	rcu_read_finish();
+
+out:
+	return ret;
+}
+
+bool
+vpm_is_balanced_in_cluster(const thread_t *vcpu)
+{
+	const vpm_group_t *pg = vcpu->psci_group;
+
+	assert(vcpu->kind == THREAD_KIND_VCPU);
+
+	return (pg != NULL) && vpm_group_option_flags_get_balance_in_cluster(
+					&pg->options);
+}
+
 error_t
 psci_handle_task_queue_execute(task_queue_entry_t *task_entry)
 {
@@ -0,0 +1,9 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Force the lazily switched EL1 registers to be reloaded from the saved
+// context the next time the VCPU runs. This must be called after modifying
+// them while the VCPU is not running.
+void
+vcpu_el1_invalidate(thread_t *thread);
@@ -0,0 +1,10 @@
+// © 2023 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Adaptive WFI halt polling needs a preemptible hypervisor, and is not used
+// when VCPUs idle in EL1. This header is also included by vcpu_aarch64.tc.
+#if !defined(PREEMPT_NULL) &&                                                  \
+	(!defined(VCPU_IDLE_IN_EL1) || !VCPU_IDLE_IN_EL1)
+#define VCPU_HALT_POLL 1
+#endif
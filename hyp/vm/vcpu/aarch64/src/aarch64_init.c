@@ -24,7 +24,9 @@
 #include <asm/barrier.h>
 #include <asm/sysregs.h>
 
+#include "context_switch.h"
 #include "event_handlers.h"
+#include "vcpu_halt_poll.h"
 
 #if defined(ARCH_ARM_HAVE_SCXT)
 #include <atomic.h>
@@ -102,6 +104,7 @@ arch_vcpu_el1_registers_init(thread_t *vcpu)
 		register_SCTLR_EL1_write(SCTLR_EL1_default());
 	} else {
 		SCTLR_EL1_init(&vcpu->vcpu_regs_el1.sctlr_el1);
+		vcpu_el1_invalidate(vcpu);
 	}
 }
 
@@ -243,11 +246,21 @@ vcpu_arch_handle_object_create_thread(thread_create_t thread_create)
 		// Set up nonzero init values for EL2 registers
 		arch_vcpu_el2_registers_init(&thread->vcpu_regs_el2);
 
+		// The FP and EL1 registers have not been loaded on any CPU
+		// yet.
+		thread->vcpu_regs_fpr_cpu = CPU_INDEX_INVALID;
+		thread->vcpu_regs_el1_cpu = CPU_INDEX_INVALID;
+
 		// Indicate that the VCPU is uniprocessor by default. The vgic
 		// module will override this if the VCPU is attached to a VIC.
 		thread->vcpu_regs_mpidr_el1 = MPIDR_EL1_default();
 		MPIDR_EL1_set_U(&thread->vcpu_regs_mpidr_el1, true);
 
+#if defined(VCPU_HALT_POLL)
+		// Start halt polling with the minimum window.
+		thread->vcpu_halt_poll_window = VCPU_HALT_POLL_NS_MIN;
+#endif
+
 #if defined(ARCH_ARM_HAVE_SCXT)
 		if (!scxt_disabled) {
 			vcpu_runtime_flags_set_scxt_allowed(&thread->vcpu_flags,
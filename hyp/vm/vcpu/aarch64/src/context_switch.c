@@ -7,15 +7,20 @@
 
 #include <hypregisters.h>
 
+#include <atomic.h>
 #include <compiler.h>
 #include <cpulocal.h>
+#include <preempt.h>
+#include <rcu.h>
 #include <scheduler.h>
 #include <thread.h>
 
 #include <asm/barrier.h>
 #include <asm/sysregs.h>
 
+#include "context_switch.h"
 #include "event_handlers.h"
+#include "vcpu.h"
 #include "vectors_vcpu.h"
 
 // VCPU_TRACE_CONTEXT_SAVED and VCPU_DEBUG_CONTEXT_SAVED defines are used as
@@ -31,6 +36,191 @@
 #define VCPU_TRACE_CONTEXT_SAVED 1
 #endif
 
+// Lazy EL1 register context switching.
+//
+// Most EL1 registers, and the EL2 registers that only affect VMs, are not
+// modified by the hypervisor, and rarely by the VM once it has booted. They
+// are only loaded if another VCPU has loaded its registers on this CPU since
+// the current VCPU last did so, which avoids reloading them when a VCPU
+// resumes after blocking or being preempted by a hypervisor thread. They are
+// always saved, so the VCPU's saved context remains up to date if it
+// migrates or is powered off.
+//
+// The owner pointer is only compared, never dereferenced. A new VCPU must
+// load its registers before it can match, so a stale owner is harmless.
+CPULOCAL_DECLARE_STATIC(const thread_t *, vcpu_el1_owner);
+
+static bool
+vcpu_el1_is_live(const thread_t *thread) REQUIRE_PREEMPT_DISABLED
+{
+	return (CPULOCAL(vcpu_el1_owner) == thread) &&
+	       (thread->vcpu_regs_el1_cpu == cpulocal_get_index());
+}
+
+static void
+vcpu_el1_load(thread_t *thread) REQUIRE_PREEMPT_DISABLED
+{
+	register_CPACR_EL1_write(thread->vcpu_regs_el1.cpacr_el1);
+	register_CSSELR_EL1_write(thread->vcpu_regs_el1.csselr_el1);
+	register_CONTEXTIDR_EL1_write(thread->vcpu_regs_el1.contextidr_el1);
+	register_MAIR_EL1_write(thread->vcpu_regs_el1.mair_el1);
+	register_SCTLR_EL1_write(thread->vcpu_regs_el1.sctlr_el1);
+	register_TCR_EL1_write(thread->vcpu_regs_el1.tcr_el1);
+	register_TPIDR_EL0_write(thread->vcpu_regs_el1.tpidr_el0);
+	register_TPIDR_EL1_write(thread->vcpu_regs_el1.tpidr_el1);
+	register_TPIDRRO_EL0_write(thread->vcpu_regs_el1.tpidrro_el0);
+	register_TTBR0_EL1_write(thread->vcpu_regs_el1.ttbr0_el1);
+	register_TTBR1_EL1_write(thread->vcpu_regs_el1.ttbr1_el1);
+	register_VBAR_EL1_write(thread->vcpu_regs_el1.vbar_el1);
+	register_VMPIDR_EL2_write(thread->vcpu_regs_mpidr_el1);
+#if SCHEDULER_CAN_MIGRATE
+	register_VPIDR_EL2_write(thread->vcpu_regs_midr_el1);
+#endif
+#if !defined(CPU_HAS_NO_ACTLR_EL1)
+	register_ACTLR_EL1_write(thread->vcpu_regs_el1.actlr_el1);
+#endif
+#if !defined(CPU_HAS_NO_AMAIR_EL1)
+	register_AMAIR_EL1_write(thread->vcpu_regs_el1.amair_el1);
+#endif
+#if !defined(CPU_HAS_NO_AFSR0_EL1)
+	register_AFSR0_EL1_write(thread->vcpu_regs_el1.afsr0_el1);
+#endif
+#if !defined(CPU_HAS_NO_AFSR1_EL1)
+	register_AFSR1_EL1_write(thread->vcpu_regs_el1.afsr1_el1);
+#endif
+#if defined(ARCH_ARM_HAVE_SCXT)
+	if (vcpu_runtime_flags_get_scxt_allowed(&thread->vcpu_flags)) {
+		register_SCXTNUM_EL0_write(thread->vcpu_regs_el1.scxtnum_el0);
+		register_SCXTNUM_EL1_write(thread->vcpu_regs_el1.scxtnum_el1);
+	}
+#endif
+
+	thread->vcpu_regs_el1_cpu = cpulocal_get_index();
+	CPULOCAL(vcpu_el1_owner)  = thread;
+}
+
+void
+vcpu_el1_invalidate(thread_t *thread)
+{
+	thread->vcpu_regs_el1_cpu = CPU_INDEX_INVALID;
+}
+
+// Lazy FP/SIMD context switching.
+//
+// A VCPU's FP registers are not loaded when it is switched in. Instead, its
+// FP/SIMD and SVE instructions are trapped by CPTR_EL2 until first use, when
+// the registers of the CPU's previous FP owner are saved and the VCPU's own
+// registers are loaded. If the owner is switched in again before any other
+// VCPU has used FP on the CPU, its registers are still live, so neither the
+// save nor the load is needed.
+//
+// A VCPU that may migrate must not leave unsaved state on a CPU it may never
+// return to, so its registers are saved when it is switched out. It remains
+// the owner, so the load can still be skipped if it returns to the same CPU.
+//
+// The hypervisor itself does not use the FP registers, so it only needs FP
+// access enabled at EL2 while switching them.
+CPULOCAL_DECLARE_STATIC(thread_t *_Atomic, vcpu_fp_owner);
+// True if the owner's saved registers are up to date with the live ones.
+CPULOCAL_DECLARE_STATIC(bool, vcpu_fp_saved);
+
+static void
+vcpu_fp_set_trapped(thread_t *thread, bool trapped)
+{
+#if defined(ARCH_ARM_FEAT_VHE)
+	CPTR_EL2_E2H1_set_FPEN(&thread->vcpu_regs_el2.cptr_el2,
+			       trapped ? 0U : 3U);
+#else
+	CPTR_EL2_E2H0_set_TFP(&thread->vcpu_regs_el2.cptr_el2, trapped);
+#endif
+}
+
+static bool
+vcpu_fp_is_live(const thread_t *thread) REQUIRE_PREEMPT_DISABLED
+{
+	return (atomic_load_relaxed(&CPULOCAL(vcpu_fp_owner)) == thread) &&
+	       (thread->vcpu_regs_fpr_cpu == cpulocal_get_index());
+}
+
+static bool
+vcpu_fp_may_migrate(const thread_t *thread)
+{
+#if SCHEDULER_CAN_MIGRATE
+	return !vcpu_option_flags_get_pinned(&thread->vcpu_options);
+#else
+	(void)thread;
+	return false;
+#endif
+}
+
+static void
+vcpu_fp_load(const thread_t *thread)
+{
+	register_FPCR_write(thread->vcpu_regs_fpr.fpcr);
+	register_FPSR_write(thread->vcpu_regs_fpr.fpsr);
+
+	__asm__ volatile("ldp	q0, q1, [%[q]]		;"
+			 "ldp	q2, q3, [%[q], 32]	;"
+			 "ldp	q4, q5, [%[q], 64]	;"
+			 "ldp	q6, q7, [%[q], 96]	;"
+			 "ldp	q8, q9, [%[q], 128]	;"
+			 "ldp	q10, q11, [%[q], 160]	;"
+			 "ldp	q12, q13, [%[q], 192]	;"
+			 "ldp	q14, q15, [%[q], 224]	;"
+			 "ldp	q16, q17, [%[q], 256]	;"
+			 "ldp	q18, q19, [%[q], 288]	;"
+			 "ldp	q20, q21, [%[q], 320]	;"
+			 "ldp	q22, q23, [%[q], 352]	;"
+			 "ldp	q24, q25, [%[q], 384]	;"
+			 "ldp	q26, q27, [%[q], 416]	;"
+			 "ldp	q28, q29, [%[q], 448]	;"
+			 "ldp	q30, q31, [%[q], 480]	;"
+			 :
+			 : [q] "r"(thread->vcpu_regs_fpr.q),
+			   "m"(thread->vcpu_regs_fpr), "m"(asm_ordering));
+}
+
+static void
+vcpu_fp_save(thread_t *thread)
+{
+	thread->vcpu_regs_fpr.fpcr = register_FPCR_read();
+	thread->vcpu_regs_fpr.fpsr = register_FPSR_read();
+
+	__asm__ volatile("stp	q0, q1, [%[q]]		;"
+			 "stp	q2, q3, [%[q], 32]	;"
+			 "stp	q4, q5, [%[q], 64]	;"
+			 "stp	q6, q7, [%[q], 96]	;"
+			 "stp	q8, q9, [%[q], 128]	;"
+			 "stp	q10, q11, [%[q], 160]	;"
+			 "stp	q12, q13, [%[q], 192]	;"
+			 "stp	q14, q15, [%[q], 224]	;"
+			 "stp	q16, q17, [%[q], 256]	;"
+			 "stp	q18, q19, [%[q], 288]	;"
+			 "stp	q20, q21, [%[q], 320]	;"
+			 "stp	q22, q23, [%[q], 352]	;"
+			 "stp	q24, q25, [%[q], 384]	;"
+			 "stp	q26, q27, [%[q], 416]	;"
+			 "stp	q28, q29, [%[q], 448]	;"
+			 "stp	q30, q31, [%[q], 480]	;"
+			 : "=m"(thread->vcpu_regs_fpr)
+			 : [q] "r"(thread->vcpu_regs_fpr.q), "m"(asm_ordering));
+}
+
+// Save the owner's registers if they are not already saved. FP access must
+// be enabled at EL2.
+static void
+vcpu_fp_save_owner(void) REQUIRE_PREEMPT_DISABLED
+{
+	thread_t *owner = atomic_load_consume(&CPULOCAL(vcpu_fp_owner));
+
+	if ((owner != NULL) && !CPULOCAL(vcpu_fp_saved)) {
+		// Only VCPUs that can't migrate leave their state unsaved.
+		assert_debug(owner->vcpu_regs_fpr_cpu == cpulocal_get_index());
+		vcpu_fp_save(owner);
+		CPULOCAL(vcpu_fp_saved) = true;
+	}
+}
+
 void
 vcpu_context_switch_load(void)
 {
@@ -46,51 +236,30 @@ vcpu_context_switch_load(void)
 #endif
 
 	if (compiler_expected(thread->kind == THREAD_KIND_VCPU)) {
-		register_CPACR_EL1_write(thread->vcpu_regs_el1.cpacr_el1);
-		register_CSSELR_EL1_write(thread->vcpu_regs_el1.csselr_el1);
-		register_CONTEXTIDR_EL1_write(
-			thread->vcpu_regs_el1.contextidr_el1);
+		// Registers that change on most exceptions taken to EL1, or
+		// that the hypervisor may use itself, are always loaded.
 		register_ELR_EL1_write(thread->vcpu_regs_el1.elr_el1);
 		register_ESR_EL1_write(thread->vcpu_regs_el1.esr_el1);
 		register_FAR_EL1_write(thread->vcpu_regs_el1.far_el1);
 		register_PAR_EL1_base_write(thread->vcpu_regs_el1.par_el1.base);
-		register_MAIR_EL1_write(thread->vcpu_regs_el1.mair_el1);
-		register_SCTLR_EL1_write(thread->vcpu_regs_el1.sctlr_el1);
 		register_SP_EL0_write(thread->vcpu_regs_el1.sp_el0);
 		register_SP_EL1_write(thread->vcpu_regs_el1.sp_el1);
 		register_SPSR_EL1_A64_write(thread->vcpu_regs_el1.spsr_el1);
-		register_TCR_EL1_write(thread->vcpu_regs_el1.tcr_el1);
-		register_TPIDR_EL0_write(thread->vcpu_regs_el1.tpidr_el0);
-		register_TPIDR_EL1_write(thread->vcpu_regs_el1.tpidr_el1);
-		register_TPIDRRO_EL0_write(thread->vcpu_regs_el1.tpidrro_el0);
-		register_TTBR0_EL1_write(thread->vcpu_regs_el1.ttbr0_el1);
-		register_TTBR1_EL1_write(thread->vcpu_regs_el1.ttbr1_el1);
-		register_VBAR_EL1_write(thread->vcpu_regs_el1.vbar_el1);
-		register_VMPIDR_EL2_write(thread->vcpu_regs_mpidr_el1);
-#if SCHEDULER_CAN_MIGRATE
-		register_VPIDR_EL2_write(thread->vcpu_regs_midr_el1);
-#endif
-#if !defined(CPU_HAS_NO_ACTLR_EL1)
-		register_ACTLR_EL1_write(thread->vcpu_regs_el1.actlr_el1);
-#endif
-#if !defined(CPU_HAS_NO_AMAIR_EL1)
-		register_AMAIR_EL1_write(thread->vcpu_regs_el1.amair_el1);
-#endif
-#if !defined(CPU_HAS_NO_AFSR0_EL1)
-		register_AFSR0_EL1_write(thread->vcpu_regs_el1.afsr0_el1);
-#endif
-#if !defined(CPU_HAS_NO_AFSR1_EL1)
-		register_AFSR1_EL1_write(thread->vcpu_regs_el1.afsr1_el1);
-#endif
 
-		// Floating-point access should not be disabled for any VM
+		if (!vcpu_el1_is_live(thread)) {
+			vcpu_el1_load(thread);
+		}
+
+		// Floating-point access should not be disabled for any VM, but
+		// it is trapped until first use unless the registers are live.
+		bool fp_live = vcpu_fp_is_live(thread);
+		if (fp_live) {
+			CPULOCAL(vcpu_fp_saved) = false;
+		}
+		vcpu_fp_set_trapped(thread, !fp_live);
 #if defined(ARCH_ARM_FEAT_VHE)
-		assert_debug(CPTR_EL2_E2H1_get_FPEN(
-				     &thread->vcpu_regs_el2.cptr_el2) == 3);
 		register_CPTR_EL2_E2H1_write(thread->vcpu_regs_el2.cptr_el2);
 #else
-		assert_debug(CPTR_EL2_E2H0_get_TFP(
-				     &thread->vcpu_regs_el2.cptr_el2) == 0);
 		register_CPTR_EL2_E2H0_write(thread->vcpu_regs_el2.cptr_el2);
 #endif
 
@@ -108,36 +277,6 @@ vcpu_context_switch_load(void)
 		register_VBAR_EL2_write(
 			VBAR_EL2_cast(CPULOCAL(vcpu_aarch64_vectors)));
 
-		register_FPCR_write(thread->vcpu_regs_fpr.fpcr);
-		register_FPSR_write(thread->vcpu_regs_fpr.fpsr);
-
-#if defined(ARCH_ARM_HAVE_SCXT)
-		if (vcpu_runtime_flags_get_scxt_allowed(&thread->vcpu_flags)) {
-			register_SCXTNUM_EL0_write(
-				thread->vcpu_regs_el1.scxtnum_el0);
-			register_SCXTNUM_EL1_write(
-				thread->vcpu_regs_el1.scxtnum_el1);
-		}
-#endif
-		__asm__ volatile("ldp	q0, q1, [%[q]]		;"
-				 "ldp	q2, q3, [%[q], 32]	;"
-				 "ldp	q4, q5, [%[q], 64]	;"
-				 "ldp	q6, q7, [%[q], 96]	;"
-				 "ldp	q8, q9, [%[q], 128]	;"
-				 "ldp	q10, q11, [%[q], 160]	;"
-				 "ldp	q12, q13, [%[q], 192]	;"
-				 "ldp	q14, q15, [%[q], 224]	;"
-				 "ldp	q16, q17, [%[q], 256]	;"
-				 "ldp	q18, q19, [%[q], 288]	;"
-				 "ldp	q20, q21, [%[q], 320]	;"
-				 "ldp	q22, q23, [%[q], 352]	;"
-				 "ldp	q24, q25, [%[q], 384]	;"
-				 "ldp	q26, q27, [%[q], 416]	;"
-				 "ldp	q28, q29, [%[q], 448]	;"
-				 "ldp	q30, q31, [%[q], 480]	;"
-				 :
-				 : [q] "r"(thread->vcpu_regs_fpr.q),
-				   "m"(thread->vcpu_regs_fpr));
 	} else {
 		// Set the constant non-VCPU HCR
 		HCR_EL2_t nonvm_hcr = HCR_EL2_default();
@@ -157,9 +296,20 @@ vcpu_context_switch_save(void)
 {
 	thread_t *thread = thread_get_self();
 
-	if (compiler_expected(
+	if (compiler_expected(thread->kind == THREAD_KIND_VCPU) &&
+	    vcpu_fp_may_migrate(thread) && vcpu_fp_is_live(thread)) {
+		// The registers stay live, but must be saved in case the VCPU
+		// uses them next on another CPU.
+		vcpu_fp_save(thread);
+		CPULOCAL(vcpu_fp_saved) = true;
+	}
+
+	if (compiler_unexpected(
 		    (thread->kind == THREAD_KIND_VCPU) &&
-		    !scheduler_is_blocked(thread, SCHEDULER_BLOCK_VCPU_OFF))) {
+		    scheduler_is_blocked(thread, SCHEDULER_BLOCK_VCPU_OFF))) {
+		// The saved registers will be reset or discarded.
+		vcpu_el1_invalidate(thread);
+	} else if (compiler_expected(thread->kind == THREAD_KIND_VCPU)) {
 		thread->vcpu_regs_el1.cpacr_el1	 = register_CPACR_EL1_read();
 		thread->vcpu_regs_el1.csselr_el1 = register_CSSELR_EL1_read();
 		thread->vcpu_regs_el1.contextidr_el1 =
@@ -196,8 +346,6 @@ vcpu_context_switch_save(void)
 
 		// Read back HCR_EL2 as VSE may have been cleared.
 		thread->vcpu_regs_el2.hcr_el2 = register_HCR_EL2_read();
-		thread->vcpu_regs_fpr.fpcr    = register_FPCR_read();
-		thread->vcpu_regs_fpr.fpsr    = register_FPSR_read();
 
 #if defined(ARCH_ARM_HAVE_SCXT)
 		if (vcpu_runtime_flags_get_scxt_allowed(&thread->vcpu_flags)) {
@@ -207,24 +355,6 @@ vcpu_context_switch_save(void)
 				register_SCXTNUM_EL1_read();
 		}
 #endif
-		__asm__ volatile("stp	q0, q1, [%[q]]		;"
-				 "stp	q2, q3, [%[q], 32]	;"
-				 "stp	q4, q5, [%[q], 64]	;"
-				 "stp	q6, q7, [%[q], 96]	;"
-				 "stp	q8, q9, [%[q], 128]	;"
-				 "stp	q10, q11, [%[q], 160]	;"
-				 "stp	q12, q13, [%[q], 192]	;"
-				 "stp	q14, q15, [%[q], 224]	;"
-				 "stp	q16, q17, [%[q], 256]	;"
-				 "stp	q18, q19, [%[q], 288]	;"
-				 "stp	q20, q21, [%[q], 320]	;"
-				 "stp	q22, q23, [%[q], 352]	;"
-				 "stp	q24, q25, [%[q], 384]	;"
-				 "stp	q26, q27, [%[q], 416]	;"
-				 "stp	q28, q29, [%[q], 448]	;"
-				 "stp	q30, q31, [%[q], 480]	;"
-				 : "=m"(thread->vcpu_regs_fpr)
-				 : [q] "r"(thread->vcpu_regs_fpr.q));
 
 #if SCHEDULER_CAN_MIGRATE
 		if (!vcpu_option_flags_get_pinned(&thread->vcpu_options)) {
@@ -238,3 +368,93 @@ vcpu_context_switch_save(void)
 #endif
 	}
 }
+
+vcpu_trap_result_t
+vcpu_handle_vcpu_trap_fp_enabled(void)
+{
+	thread_t *thread = thread_get_self();
+	assert(thread->kind == THREAD_KIND_VCPU);
+
+	// The RCU read keeps the previous owner from being freed while its
+	// registers are saved.
+	preempt_disable();
+	rcu_read_start();
+
+	assert_debug(!vcpu_fp_is_live(thread));
+
+	// Enabling FP access for the VCPU also enables it for EL2.
+	vcpu_fp_set_trapped(thread, false);
+#if defined(ARCH_ARM_FEAT_VHE)
+	register_CPTR_EL2_E2H1_write_ordered(thread->vcpu_regs_el2.cptr_el2,
+					     &asm_ordering);
+#else
+	register_CPTR_EL2_E2H0_write_ordered(thread->vcpu_regs_el2.cptr_el2,
+					     &asm_ordering);
+#endif
+	asm_context_sync_ordered(&asm_ordering);
+
+	vcpu_fp_save_owner();
+	vcpu_fp_load(thread);
+
+	thread->vcpu_regs_fpr_cpu = cpulocal_get_index();
+	CPULOCAL(vcpu_fp_saved)	  = false;
+	atomic_store_relaxed(&CPULOCAL(vcpu_fp_owner), thread);
+
+	rcu_read_finish();
+	preempt_enable();
+
+	return VCPU_TRAP_RESULT_RETRY;
+}
+
+error_t
+vcpu_handle_power_cpu_suspend(void)
+{
+	// The EL1 registers may be lost if the CPU powers off.
+	CPULOCAL(vcpu_el1_owner) = NULL;
+
+	// The registers may be lost if the CPU powers off, so save the
+	// owner's state and release it. This is harmless if the suspend is
+	// aborted.
+	rcu_read_start();
+	if (atomic_load_relaxed(&CPULOCAL(vcpu_fp_owner)) != NULL) {
+#if defined(ARCH_ARM_FEAT_VHE)
+		CPTR_EL2_E2H1_t cptr =
+			register_CPTR_EL2_E2H1_read_ordered(&asm_ordering);
+		CPTR_EL2_E2H1_set_FPEN(&cptr, 3);
+		register_CPTR_EL2_E2H1_write_ordered(cptr, &asm_ordering);
+#else
+		CPTR_EL2_E2H0_t cptr =
+			register_CPTR_EL2_E2H0_read_ordered(&asm_ordering);
+		CPTR_EL2_E2H0_set_TFP(&cptr, 0);
+		register_CPTR_EL2_E2H0_write_ordered(cptr, &asm_ordering);
+#endif
+		asm_context_sync_ordered(&asm_ordering);
+
+		vcpu_fp_save_owner();
+		atomic_store_relaxed(&CPULOCAL(vcpu_fp_owner), NULL);
+	}
+	rcu_read_finish();
+
+	return OK;
+}
+
+void
+vcpu_handle_power_cpu_offline(void)
+{
+	(void)vcpu_handle_power_cpu_suspend();
+}
+
+void
+vcpu_arch_deactivate_thread(thread_t *thread)
+{
+	assert(thread->kind == THREAD_KIND_VCPU);
+
+	// The VCPU's registers no longer need to be saved, but no CPU may
+	// refer to it as its FP owner after it is freed.
+	for (cpu_index_t cpu = 0U; cpu < PLATFORM_MAX_CORES; cpu++) {
+		thread_t *expected = thread;
+		(void)atomic_compare_exchange_strong_explicit(
+			&CPULOCAL_BY_INDEX(vcpu_fp_owner, cpu), &expected, NULL,
+			memory_order_relaxed, memory_order_relaxed);
+	}
+}
@@ -10,15 +10,20 @@
 #include <compiler.h>
 #include <idle.h>
 #include <log.h>
+#include <platform_timer.h>
 #include <preempt.h>
 #include <scheduler.h>
 #include <thread.h>
 #include <trace.h>
+#include <util.h>
 #include <vcpu.h>
 
 #include <events/vcpu.h>
 
+#include <asm/barrier.h>
+
 #include "event_handlers.h"
+#include "vcpu_halt_poll.h"
 
 void
 vcpu_handle_scheduler_selected_thread(thread_t *thread, bool *can_idle)
@@ -32,6 +37,81 @@ vcpu_handle_scheduler_selected_thread(thread_t *thread, bool *can_idle)
 	vcpu_runtime_flags_set_vcpu_can_idle(&thread->vcpu_flags, *can_idle);
 }
 
+#if defined(VCPU_HALT_POLL)
+// Poll for a wakeup for the current halt-polling window, before the VCPU is
+// put to sleep. Interrupts are briefly enabled between polls, so the VCPU may
+// be woken by an interrupt or IPI, or preempted by another thread.
+static bool
+vcpu_halt_poll(thread_t *current, ticks_t start) REQUIRE_PREEMPT_DISABLED
+{
+	bool	woken  = false;
+	ticks_t window = platform_timer_convert_ns_to_ticks(
+		current->vcpu_halt_poll_window);
+	ticks_t now = start;
+
+	while ((now - start) < window) {
+		if (vcpu_pending_wakeup()) {
+			woken = true;
+			break;
+		}
+
+		preempt_enable();
+		asm_yield();
+		preempt_disable();
+
+		now = platform_timer_get_current_ticks();
+	}
+
+	nanoseconds_t poll_ns = platform_timer_convert_ticks_to_ns(now - start);
+	current->vcpu_halt_poll_time += poll_ns;
+
+	if (woken) {
+		current->vcpu_halt_poll_hits++;
+		TRACE(DEBUG, VCPU_HALT_POLL_HIT,
+		      "vcpu: {:#x} halt poll hit after {:d}ns (window {:d}ns),"
+		      " hits {:d}, total {:d}ns",
+		      (uintptr_t)current, poll_ns,
+		      current->vcpu_halt_poll_window,
+		      current->vcpu_halt_poll_hits,
+		      current->vcpu_halt_poll_time);
+	}
+
+	return woken;
+}
+
+// Adjust the halt-polling window after a halt that polling did not catch.
+static void
+vcpu_halt_poll_missed(thread_t *current, ticks_t start)
+{
+	nanoseconds_t halt_ns = platform_timer_convert_ticks_to_ns(
+		platform_timer_get_current_ticks() - start);
+	nanoseconds_t window = current->vcpu_halt_poll_window;
+
+	if (halt_ns <= VCPU_HALT_POLL_NS_MAX) {
+		// A longer window would have avoided the sleep.
+		window = util_min(util_max(window * 2U, VCPU_HALT_POLL_NS_MIN),
+				  VCPU_HALT_POLL_NS_MAX);
+	} else {
+		// The halt was long, so polling only wasted time. Below the
+		// minimum, the window shrinks to zero, which still allows it
+		// to grow again after a short halt.
+		window = window / 2U;
+		if (window < VCPU_HALT_POLL_NS_MIN) {
+			window = 0U;
+		}
+	}
+
+	current->vcpu_halt_poll_misses++;
+	TRACE(DEBUG, VCPU_HALT_POLL_MISS,
+	      "vcpu: {:#x} halt poll miss, halted {:d}ns (window {:d}ns),"
+	      " misses {:d}, total {:d}ns",
+	      (uintptr_t)current, halt_ns, current->vcpu_halt_poll_window,
+	      current->vcpu_halt_poll_misses, current->vcpu_halt_poll_time);
+
+	current->vcpu_halt_poll_window = window;
+}
+#endif // VCPU_HALT_POLL
+
 vcpu_trap_result_t
 vcpu_handle_vcpu_trap_wfi(ESR_EL2_ISS_WFI_WFE_t iss)
 {
@@ -40,6 +120,11 @@ vcpu_handle_vcpu_trap_wfi(ESR_EL2_ISS_WFI_WFE_t iss)
 	thread_t *current = thread_get_self();
 	assert(current->kind == THREAD_KIND_VCPU);
 
+#if defined(VCPU_HALT_POLL)
+	bool	halt_polled = false;
+	ticks_t halt_start  = 0U;
+#endif
+
 	assert_preempt_enabled();
 	preempt_disable();
 
@@ -64,6 +149,17 @@ vcpu_handle_vcpu_trap_wfi(ESR_EL2_ISS_WFI_WFE_t iss)
 #if !defined(VCPU_IDLE_IN_EL1) || !VCPU_IDLE_IN_EL1
 	if (vcpu_runtime_flags_get_vcpu_can_idle(&current->vcpu_flags) &&
 	    !vcpu_interrupted) {
+#if defined(VCPU_HALT_POLL)
+		// Nothing else is waiting to run on this CPU, so the VCPU may
+		// poll briefly for a wakeup instead of sleeping.
+		if (vcpu_option_flags_get_halt_poll(&current->vcpu_options)) {
+			halt_start = platform_timer_get_current_ticks();
+			if (vcpu_halt_poll(current, halt_start)) {
+				goto out;
+			}
+			halt_polled = true;
+		}
+#endif
 		if (vcpu_block_start()) {
 			goto out;
 		}
@@ -104,6 +200,11 @@ vcpu_handle_vcpu_trap_wfi(ESR_EL2_ISS_WFI_WFE_t iss)
 	(void)scheduler_yield();
 
 out:
+#if defined(VCPU_HALT_POLL)
+	if (halt_polled) {
+		vcpu_halt_poll_missed(current, halt_start);
+	}
+#endif
 	preempt_enable();
 
 	return ret;
@@ -8,3 +8,8 @@ vcpu_bind_virq(thread_t *vcpu, vic_t *vic, virq_t virq,
 
 error_t
 vcpu_unbind_virq(thread_t *vcpu, vcpu_virq_type_t virq_type);
+
+// Release any per-CPU state that refers to a VCPU that is being deactivated.
+// This is implemented by the architecture.
+void
+vcpu_arch_deactivate_thread(thread_t *thread);
@@ -146,6 +146,7 @@ vcpu_handle_object_deactivate_thread(thread_t *thread)
 {
 	if (thread->kind == THREAD_KIND_VCPU) {
 		vic_unbind(&thread->vcpu_halt_virq_src);
+		vcpu_arch_deactivate_thread(thread);
 	}
 }
 